@@ -5,53 +5,140 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "disk_layer.h"
 
 #define ADDRESS_SIZE ((ssize_t) 8)
 #define INODE_B_COUNT ((ssize_t) (BLOCK_COUNT/10)) // blocks being allocated for inodes
-#define DATA_B_COUNT ((ssize_t) (BLOCK_COUNT - INODE_B_COUNT - 1)) // blocks allocated for storing data
+#define INODES_PER_BLOCK ((ssize_t) (BLOCK_SIZE / sizeof(struct disk_inode))) // inodes packed in one inode block
+#define INODE_BITMAP_BLOCKS ((ssize_t) ((INODE_B_COUNT * INODES_PER_BLOCK) / (BLOCK_SIZE * 8) + 1)) // one bit per inode
+#define INODE_BITMAP_START ((ssize_t) (INODE_B_COUNT + 1)) // inode bitmap sits right after the inode blocks
+#define BLOCK_BITMAP_BLOCKS ((ssize_t) (BLOCK_COUNT / (BLOCK_SIZE * 8) + 1)) // one bit per block of the device
+#define BLOCK_BITMAP_START ((ssize_t) (INODE_BITMAP_START + INODE_BITMAP_BLOCKS)) // block bitmap follows the inode bitmap
+#define DATA_B_START ((ssize_t) (BLOCK_BITMAP_START + BLOCK_BITMAP_BLOCKS)) // first block usable for data
+#define DATA_B_COUNT ((ssize_t) (BLOCK_COUNT - DATA_B_START)) // blocks allocated for storing data
 #define DIRECT_B_COUNT ((ssize_t) 10) // number of direct blocks per inode
 #define DBLOCKS_PER_BLOCK ((ssize_t) (BLOCK_SIZE / ADDRESS_SIZE)) // number of block addresses storable by a block i.e. 4K/4 = 0.5 KB
-#define FREE_LIST_BLOCKS ((ssize_t) ((DATA_B_COUNT/DBLOCKS_PER_BLOCK) + 1)) // number of freelist blocks needed to store the information of data blocks
+#define BLOCKS_PER_GROUP ((ssize_t) 2048) // blocks of one block group, 8MB with 4K blocks
+#define BLOCK_GROUP_COUNT ((ssize_t) ((BLOCK_COUNT + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP)) // the last group may be partial
+#define FIRST_DATA_GROUP ((ssize_t) (DATA_B_START / BLOCKS_PER_GROUP)) // the groups before it hold only metadata
+#define DATA_GROUP_COUNT ((ssize_t) (BLOCK_GROUP_COUNT - FIRST_DATA_GROUP)) // groups with dblocks, inodes are spread over them
+#define EXTENT_CLASS_COUNT ((ssize_t) 32) // size classes of free extents, class k holds lengths 2^k to 2^(k+1)-1
+#define EXTENT_TABLE_MIN_BITS ((ssize_t) 6) // the free extent hash tables never shrink below 64 buckets
+#define INLINE_DATA_SIZE ((ssize_t) 52) // inline bytes, they share the block map area of the on-disk inode
+#define DISK_INODE_SIZE ((ssize_t) 128) // bytes of an on-disk inode
+#define INODE_VERSION ((ssize_t) 3) // layout of the on-disk inode, 1 was the in-memory struct written as is, 2 had no alloc_blocks
+#define DIRENT_VERSION ((ssize_t) 2) // layout of directory entries, 1 had an 8 byte inode number and record length
+#define DISK_INODE_ALLOCATED ((uint32_t) 1) // flags of the on-disk inode
+#define DISK_INODE_INLINE ((uint32_t) 2)
+#define DISK_INODE_INDEXED ((uint32_t) 4)
+#define DISK_UNWRITTEN_FLAG ((uint32_t) 1 << 31) // UNWRITTEN_FLAG of a 32 bit on-disk block map entry
+#define UNWRITTEN_FLAG ((ssize_t) 1 << 62) // set on a mapped dblock that is preallocated but never written
+#define IS_UNWRITTEN(entry) (((entry) & UNWRITTEN_FLAG) != 0) // such blocks read as zeros
+#define DBLOCK_NUM(entry) ((entry) & ~UNWRITTEN_FLAG) // dblock number of a block map entry
 // 10 direct blocks = 20KB
 // single indirect stores BLOCK_SIZE/ADDRESS_SIZE = 4KB/8 = 0.5K * 4K = 2MB
 // double indirect stores 0.5K * 0.5K * 4K = 1GB
 // triple indirect stores 0.5K * 0.5K * 0.5K * 4K = 500GB
 
+#define FS_MAGIC ((ssize_t) 0x434841524D465332) // "CHARMFS2", marks a formatted device
+
 struct superBlock {
+    ssize_t magic; // FS_MAGIC once the device has been formatted
     ssize_t inode_count; // total number of inodes we can have
     ssize_t latest_inum; // latest inode that is free
     ssize_t inodes_per_block; // how many inodes per block
-    ssize_t free_list_head; // block containing addresses of free dblocks, when 0 that means fs is full
+    ssize_t block_group_count; // groups the blocks are split into, inodes are spread over them evenly
+    ssize_t blocks_per_group; // blocks of one group, the groups start at block 0
+    ssize_t free_inode_count; // inodes left to hand out, mirrors the zero bits of the inode bitmap
+    ssize_t free_dblock_count; // dblocks left to hand out, mirrors the zero bits of the block bitmap
+    ssize_t inode_version; // INODE_VERSION the inode blocks were formatted with
+    ssize_t orphan_head; // first unlinked inode whose blocks still have to be reclaimed, 0 when none
+    ssize_t dirent_version; // DIRENT_VERSION the directories were written with
+};
+
+// growable list of dblock numbers, used to collect blocks before a batched free
+struct dblock_list {
+    ssize_t* dblock_nums;
+    ssize_t count;
+    ssize_t capacity;
 };
 
 struct iNode {
-    ssize_t direct_blocks[DIRECT_B_COUNT]; // direct block numbers
-    ssize_t single_indirect; // single indirection -> this is a block number which contains the block numbers
-    ssize_t double_indirect;
-    ssize_t triple_indirect;
+    union {
+        struct {
+            ssize_t direct_blocks[DIRECT_B_COUNT]; // direct block numbers
+            ssize_t single_indirect; // single indirection -> this is a block number which contains the block numbers
+            ssize_t double_indirect;
+            ssize_t triple_indirect;
+        };
+        char inline_data[INLINE_DATA_SIZE]; // contents of a small file or directory when is_inline is set
+    };
     ssize_t link_count; // how many links an inode has
     ssize_t file_size; // size of file
     ssize_t num_blocks; // number of blocks a file has
+    ssize_t alloc_blocks; // dblocks the inode holds, data and indirect blocks, for st_blocks
     bool allocated; // boolean value to track allocation
+    bool is_inline; // data lives in inline_data, the inode maps no blocks
+    bool is_indexed; // directory with a hashed index of its entries
     ssize_t user_id;
     ssize_t group_id;
     mode_t mode; // 664 etc - rwx rwx rwx (user, group, global) - 9 bits
-    time_t access_time;
-    time_t creation_time;
-    time_t modification_time;
-    time_t status_change_time;
+    struct timespec access_time;
+    struct timespec creation_time;
+    struct timespec modification_time;
+    struct timespec status_change_time;
+    ssize_t next_orphan; // next inode on the orphan list, 0 ends the list
+    ssize_t alloc_goal; // dblock the next block of the file is placed at, 0 lets the allocator pick
 };
 
+// fixed width inode as stored in the inode blocks, translated to and from struct iNode
+struct disk_inode {
+    uint32_t mode;
+    uint32_t link_count;
+    uint32_t user_id;
+    uint32_t group_id;
+    uint64_t file_size;
+    uint32_t num_blocks;
+    uint32_t next_orphan;
+    uint32_t alloc_goal;
+    uint32_t flags; // DISK_INODE_ALLOCATED, DISK_INODE_INLINE, DISK_INODE_INDEXED
+    int64_t access_time; // nanoseconds since the epoch
+    int64_t creation_time;
+    int64_t modification_time;
+    int64_t status_change_time;
+    uint32_t alloc_blocks;
+    union {
+        uint32_t blocks[DIRECT_B_COUNT + 3]; // direct, single, double and triple indirect
+        char inline_data[INLINE_DATA_SIZE];
+    };
+};
+
+_Static_assert(sizeof(struct disk_inode) == DISK_INODE_SIZE, "on-disk inode has to stay 128 bytes");
+
 // init the super block, ilist and free list
 bool make_fs();
 
+// what load_fs found on the device
+enum fs_load_status{
+    FS_LOADED,
+    FS_NOT_FOUND, // no file system magic in the superblock, the device can be formatted
+    FS_UNUSABLE, // an incompatible layout or an unreadable device, it is left untouched
+};
+
+// reads the superblock and both bitmaps of an existing file system, nothing is kept unless it is FS_LOADED
+enum fs_load_status load_fs();
+
+// picks up the file system already on the device, formats it only when there is none
+// and refuses to mount one that load_fs cannot use
+bool mount_fs();
+
 /*
 allocates a new inode and returns the inode_num
-Inputs:
-    inode_num: the num associated with the inode
+The search runs on the in-memory inode bitmap starting at latest_inum,
+so no inode block is read while looking for a free slot
 Returns:
-    inode num / -1;
+    inode num / -1 when no inode is left
 */
 ssize_t create_new_inode();
 
@@ -64,6 +151,26 @@ Returns:
 */
 struct iNode* read_inode(ssize_t inode_num);
 
+/*
+Reads several inodes, every inode block is read once however many of the inodes it holds
+Inputs:
+    inode_nums: the nums of the inodes
+    count: number of inodes
+    inodes: gets the inode for inode_nums[i] at index i, each one is freed by the caller
+Returns:
+    true/false, on failure no inode is handed out
+*/
+bool read_inodes(const ssize_t* inode_nums, ssize_t count, struct iNode** inodes);
+
+/*
+Starts loading the inode blocks of several inodes in the background, in block order with
+neighbouring blocks asked for together. Nothing is read when it returns
+Inputs:
+    inode_nums: the nums of the inodes, invalid ones are skipped
+    count: number of inodes
+*/
+void prefetch_inodes(const ssize_t* inode_nums, ssize_t count);
+
 /*
 writes the inode struct into the inode_num
 Inputs:
@@ -83,6 +190,15 @@ Returns:
 */
 bool free_inode(ssize_t inode_num);
 
+/*
+allocates a new inode and returns the inode_num, searching from the first inode of a block group
+Inputs:
+    group: block group whose inodes are preferred
+Returns:
+    inode num / -1 when no inode is left
+*/
+ssize_t create_new_inode_in_group(ssize_t group);
+
 /*
 assigns a new dblock and returns the dblock_num
 Inputs: 
@@ -92,6 +208,48 @@ Returns:
 */
 ssize_t create_new_dblock();
 
+/*
+assigns the free dblock closest after goal. The rest of the goal's group is
+searched first, then the following groups, wrapping around the device.
+Inputs:
+    goal: preferred dblock, 0 takes the lowest free dblock
+Returns:
+    dblocknum on success; -1 on failure
+*/
+ssize_t create_new_dblock_near(ssize_t goal);
+
+/*
+assigns count contiguous free dblocks. The run starts at goal when it is free that far,
+otherwise the first free extent of the smallest size class that always holds it is taken from the free extent index
+Inputs:
+    goal: preferred first dblock, 0 for no preference
+    count: number of dblocks in the run
+Returns:
+    first dblocknum of the run on success; -1 when there is no such run
+*/
+ssize_t create_new_dblock_run(ssize_t goal, ssize_t count);
+
+// like create_new_dblock_run without taking the blocks, used to steer an allocation goal
+ssize_t find_dblock_run(ssize_t goal, ssize_t count);
+
+// length of the free extent starting at dblock_num, 0 when no free extent starts there
+ssize_t free_extent_length(ssize_t dblock_num);
+
+// block group holding the dblock
+ssize_t dblock_group(ssize_t dblock_num);
+
+// first dblock of a group usable for data
+ssize_t group_first_dblock(ssize_t group);
+
+// block group an inode belongs to, the inode table is split evenly over the groups holding dblocks
+ssize_t inode_group(ssize_t inode_num);
+
+// group with the most free dblocks, new directories are spread over the groups with it
+ssize_t least_used_group();
+
+// number of free dblocks left in a group
+ssize_t group_free_dblocks(ssize_t group);
+
 /*
 returns the read info buf from the dblock given by dblock_num
 Inputs:
@@ -120,7 +278,92 @@ Returns:
 */
 bool free_dblock(ssize_t dblock_num);
 
+/*
+Frees a batch of dblocks, each block bitmap block touched is written once
+per batch. Freed data is not zeroed.
+Inputs:
+    dblock_nums: the dblock numbers to release
+    count: number of entries in dblock_nums
+Returns:
+    true / false
+*/
+bool free_dblocks(const ssize_t* dblock_nums, ssize_t count);
+
+// appends a dblock number to the list, growing it when needed
+bool append_dblock(struct dblock_list* list, ssize_t dblock_num);
+
+// releases every dblock of an inode, data and indirect blocks, in one batch
+bool free_dblocks_from_inode(struct iNode* inode);
+
+/*
+Collects the blocks mapped by an indirect block into freed
+Inputs:
+    dblock_num: the indirect block
+    depth: 1 for single, 2 for double and 3 for triple indirection
+    from: first file block (relative to this indirect block) to release.
+        With 0 the indirect block itself is released too, otherwise the
+        cleared entries are written back.
+    freed: list collecting the released dblocks
+Returns:
+    true / false
+*/
+bool release_indirect(ssize_t dblock_num, ssize_t depth, ssize_t from, struct dblock_list* freed);
+
+/*
+Counts the dblocks a file really holds, holes are left out and indirect blocks are counted
+Inputs:
+    inode: inode of the file
+Returns:
+    number of dblocks, -1 when an indirect block can't be read
+*/
+ssize_t count_mapped_dblocks(const struct iNode* inode);
+
 bool is_valid_inum(ssize_t inode_num);
 
+// zeros the block map of an inode and its allocated count, which also clears its inline data
+void clear_block_map(struct iNode* inode);
+
+// points the inode at the blocks another inode maps, with their count
+void copy_block_map(struct iNode* inode, const struct iNode* from);
+
+// translates between the in-memory and the on-disk inode
+void inode_to_disk(const struct iNode* inode, struct disk_inode* disk);
+void inode_from_disk(const struct disk_inode* disk, struct iNode* inode);
+
+/*
+Puts an unlinked inode on the on-disk orphan list, its blocks are released
+later by the reclaim thread (or at the next mount after a crash)
+Inputs:
+    inode_num: the num associated with the inode
+    inode: the inode, written back with its orphan link
+Returns:
+    true / false
+*/
+bool push_orphan(ssize_t inode_num, struct iNode* inode);
+
+// returns the first inode on the orphan list, 0 when it is empty
+ssize_t get_orphan_head();
+
+// number of free dblocks, served from the superblock counter
+ssize_t get_free_dblock_count();
+
+// number of free inodes, served from the superblock counter
+ssize_t get_free_inode_count();
+
+// total number of inodes of the file system
+ssize_t get_inode_count();
+
+// writes the superblock if allocations changed its free counters since it was last written, called at unmount
+bool sync_superblock();
+
+/*
+Takes the head of the orphan list off the list and frees the inode
+Inputs:
+    inode_num: the inode expected at the head
+Returns:
+    true / false
+*/
+bool pop_orphan(ssize_t inode_num);
+
 #endif
 
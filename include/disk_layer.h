@@ -12,10 +12,12 @@
 // #define FS_SIZE ((ssize_t) 10737418240) // 10GB - taking 1 min
 // #define FS_SIZE ((ssize_t) 32212254720) // 30GB - taking 4:30 min
 #else
-//currently implementing in memory FS
+//currently implementing in memory FS, a build can pass its own size with -DFS_SIZE
+#ifndef FS_SIZE
 #define FS_SIZE ((ssize_t) 104857600)
 //100 MB
 #endif
+#endif
 
 #define BLOCK_SIZE ((ssize_t) 4096)
 //4 KB
@@ -29,6 +31,8 @@ bool dealloc_memory();
 bool read_block(ssize_t block_id, char *buffer);
 // writes data into block_id from buffer
 bool write_block(ssize_t block_id, char *buffer);
+// starts reading count blocks from block_id in the background so later reads don't wait, true/false
+bool prefetch_blocks(ssize_t block_id, ssize_t count);
 // de-reference the pointer to nothing
 void free_memory(void *ptr);
 
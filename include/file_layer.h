@@ -2,21 +2,46 @@
 #define __FILE_LAYER_H__
 
 #include <fcntl.h>
+#include <linux/falloc.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include "disk_layer.h"
 #include "block_layer.h"
 
 #define SINGLE_INDIRECT_BLOCK_COUNT ((ssize_t) (BLOCK_SIZE / ADDRESS_SIZE)) //1024
 #define DOUBLE_INDIRECT_BLOCK_COUNT ((ssize_t) (SINGLE_INDIRECT_BLOCK_COUNT * (BLOCK_SIZE / ADDRESS_SIZE))) //1048576
 #define TRIPLE_INDIRECT_BLOCK_COUNT ((ssize_t) (DOUBLE_INDIRECT_BLOCK_COUNT * (BLOCK_SIZE / ADDRESS_SIZE))) //1073742000
-#define ADDRESS_PTR_SZ ((ssize_t) 8)
-#define INODE_SZ ((ssize_t) 8)
+#define MAX_FILE_BLOCKS ((ssize_t) (DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT + TRIPLE_INDIRECT_BLOCK_COUNT)) // all the block map reaches
+#define MAX_FILE_SIZE ((ssize_t) (MAX_FILE_BLOCKS * BLOCK_SIZE)) // writes, truncates and fallocates past it fail with EFBIG
 #define MAX_NAME_LENGTH ((ssize_t) 255) // max len of a name
 #define ROOT_INODE ((ssize_t) 2)
-#define STRING_LENGTH_SZ ((ssize_t) 2)
+#define DIR_TYPE_UNKNOWN ((unsigned char) 0) // type of empty entries, readers of an unknown type fall back to the inode
+#define DIR_ENTRY_TYPE(mode) ((unsigned char) (((mode) & S_IFMT) >> 12)) // same values as DT_* of dirent.h
+#define DIR_TYPE_TO_MODE(type) ((mode_t) (type) << 12)
+_Static_assert(MAX_FILE_BLOCKS <= UINT32_MAX, "num_blocks of a file has to fit the 32 bit on-disk field");
+
 #define CACHE_SIZE ((ssize_t) 50000)
+#define NEGATIVE_DENTRY ((ssize_t) 0) // cached value of a name known to be missing, no inode has number 0
 #define DEFAULT_PERMS (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)
+#define RECLAIM_BATCH_BLOCKS ((ssize_t) 4096) // blocks released per reclaim step - 16MB
+#define RECLAIM_INTERVAL_US ((useconds_t) 1000) // pause between two reclaim steps
+#define INODE_LOCK_COUNT ((ssize_t) 64) // stripes of the per-inode locks, inodes in one stripe share a lock
+#define DIR_INDEX_THRESHOLD ((ssize_t) 4) // blocks a linear directory fills up before it gets a hashed index
+#define DIR_SPACE_CACHE_SIZE ((ssize_t) 4096) // directory blocks whose free space is remembered
+#define DX_ROOT_OFFSET ((ssize_t) 40) // index root in block 0, in the space ".." spans past its name
+#define DX_NODE_OFFSET ((ssize_t) 24) // index of an index block, behind an empty entry spanning the block
+#define DX_MAX_LEVELS ((ssize_t) 2) // the root and one level of index blocks above the leaves
+#define DIR_COOKIE_FIRST ((ssize_t) 2) // readdir cookies of "." and ".." are 0 and 1, the names' start here
+#define DIR_COOKIE_RANK_BITS 16 // low bits of a name's cookie, its rank among the names with the same hash
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0) // renameat2 flags, stdio.h only has them with _GNU_SOURCE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA 3 // whence values of lseek, unistd.h only has them with _GNU_SOURCE
+#define SEEK_HOLE 4
+#endif
 
 // used when he details of a specific dir entry has to be retrieved.
 struct file_pos_in_dir{
@@ -27,6 +52,40 @@ struct file_pos_in_dir{
     ssize_t prev_entry;// usually contains the record len of the previous entry. If the entry is the 1st entry, it stores -1
 };
 
+/*
+Directory entry as laid out in a directory block, DIRENT_VERSION of the superblock. The entries
+follow each other and the last one spans to the end of the block, rec_len covers the header, the
+name and the free space after it. An entry with inum 0 is empty.
+*/
+struct dir_entry{
+    uint32_t inum;
+    uint16_t rec_len;
+    uint8_t name_length;
+    uint8_t type; // DIR_ENTRY_TYPE of the inode
+    uint32_t hash; // dir_hash of the name, a lookup compares names only when it matches
+    char name[];
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct dir_entry) == 12, "directory entry header has to stay 12 bytes");
+
+/*
+Hashed directory index. Block 0 keeps "." and ".." with the root after them, the
+leaves are ordinary directory blocks holding the entries of one hash range each.
+An index entry sends the hashes from its own up to the next entry's to fblock_num,
+the first entry of the root covers every hash below the second.
+*/
+struct dx_header{
+    uint32_t levels; // levels of index blocks, only set in the root
+    uint32_t count;
+    uint32_t limit;
+    uint32_t unused;
+};
+
+struct dx_entry{
+    uint32_t hash;
+    uint32_t fblock_num;
+};
+
 // fblock is essentially position of the datablock relative to that file
 
 // Returns char array index of the last slash of parent's path
@@ -35,6 +94,8 @@ ssize_t get_parent_id(const char* const path, ssize_t path_len);
 bool get_parent_path(char* const buff, const char* const path, ssize_t path_len);
 // copy child file into a given buffer
 bool get_child_name(char* const buff, const char* const path, ssize_t path_len);
+// inode number of the directory entry at pos of a directory block
+ssize_t dir_entry_inum(const char* dblock, ssize_t pos);
 // get dblock num corr to file block number
 ssize_t fblock_num_to_dblock_num(const struct iNode* const inode, ssize_t fblock_num);
 
@@ -48,11 +109,41 @@ Returns:
     true/false
 */
 bool add_dblock_to_inode(struct iNode* inode, const ssize_t dblock_num);
-// free the blocks inside single indirect
-bool remove_single_indirect(ssize_t dblock_num);
-// free the blocks inside double indirect
-bool remove_double_indirect(ssize_t dblock_num);
-
+// allocates a dblock for the file right after its previous one, inside the inode's block group when it has room
+ssize_t create_new_dblock_for_inode(struct iNode* inode);
+// allocates a zeroed dblock to hold block addresses, next to the data it maps
+ssize_t create_new_indirect_dblock(struct iNode* inode);
+/*
+Moves the inline data of an inode into its first dblock and clears the inline flag,
+the caller writes the inode back
+Inputs:
+    inode: the inline inode
+    dblock: full BLOCK_SIZE contents for the block, NULL to take the inline bytes
+Returns:
+    true / false
+*/
+bool move_inline_data_to_block(struct iNode* inode, const char* dblock);
+// hash of an entry name, it picks the leaf of an indexed directory
+uint32_t dir_hash(const char* name, ssize_t name_length);
+// number of blocks of a directory, an inline directory counts as one
+ssize_t dir_block_count(const struct iNode* const inode);
+// reads a directory block into a new BLOCK_SIZE buffer, dblock_num is set to 0 for an inline directory
+char* read_dir_block(const struct iNode* const inode, ssize_t fblock_num, ssize_t* dblock_num);
+// writes back a directory block, inline entries that no longer fit move the directory to a dblock
+bool write_dir_block(struct iNode* inode, ssize_t dblock_num, char* dblock);
+// moves the allocation goal to a free run that holds the blocks appended for [first_fblock, end_fblock)
+void steer_goal_to_run(struct iNode* inode, ssize_t first_fblock, ssize_t end_fblock);
+// grows the file to num_blocks blocks, the new ones are holes and need no block map change
+void extend_with_holes(struct iNode* inode, ssize_t num_blocks);
+/*
+Removes the blocks from fblock_num till the end of the file, all of them
+are released through one batched free
+Inputs:
+    inode: File to shrink
+    fblock_num: first file block to remove
+Returns:
+    true/false
+*/
 bool remove_dblocks_from_inode(struct iNode* inode, ssize_t fblock_num);
 /*
 Returns the inode for the file at the end of the path
@@ -63,6 +154,14 @@ Returns:
 */
 ssize_t get_inode_num_from_path(const char* const path);
 
+// dentry cache, keyed by path, with "." and ".." paths never cached.
+// lookup gives -1 for a path not cached and NEGATIVE_DENTRY for one cached as missing
+ssize_t lookup_dentry(const char* path);
+// caches the first path_len characters of path, its parent path has to be cached already
+void cache_dentry(const char* path, ssize_t path_len, ssize_t inode_num);
+// has to be called whenever a name is removed or replaced, it drops everything cached under the path too
+void drop_dentry(const char* path);
+
 ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode);
 
 bool is_empty_dir(struct iNode* inode);
@@ -90,28 +189,215 @@ bool custom_mknod(const char* path, mode_t mode, dev_t dev);
 
 struct file_pos_in_dir find_file(const char *const name, const struct iNode* const parent_inode);
 
+// -EFBIG for a size past MAX_FILE_SIZE
 ssize_t custom_truncate(const char* path, size_t offset);
 
 ssize_t custom_unlink(const char* path);
 
+/*
+Renames by moving the directory entry, the file data is not touched
+Inputs:
+    from: current path
+    to: new path, a file there is replaced unless flags say otherwise
+    flags: 0, RENAME_NOREPLACE or RENAME_EXCHANGE
+Returns:
+    0 on success, -errno on failure
+*/
+ssize_t custom_rename(const char* from, const char* to, unsigned int flags);
+
+/*
+Adds a second name for a file, both names share the inode
+Inputs:
+    from: path of the existing file
+    to: new path, must not exist yet
+Returns:
+    0 on success, -errno on failure
+*/
+ssize_t custom_link(const char* from, const char* to);
+
+/*
+Creates a symbolic link, a target of up to INLINE_DATA_SIZE bytes is kept in the inode
+and a longer one in a single dblock
+Inputs:
+    target: the path the link points to, it need not exist
+    path: path of the new link
+Returns:
+    0 on success, -errno on failure
+*/
+ssize_t custom_symlink(const char* target, const char* path);
+
+/*
+Reads the target of a symbolic link, the result is not null terminated
+Inputs:
+    path: path of the link
+    buff: buffer for the target
+    size: size of buff, a longer target is truncated
+Returns:
+    number of bytes placed in buff, -errno on failure
+*/
+ssize_t custom_readlink(const char* path, char* buff, size_t size);
+
+/*
+Shrinks a directory after mass deletes: emptied index leaves are freed and the entries are packed
+into as few blocks as they need, a hashed index that is no longer needed is dropped. Unlink never
+moves entries, this does. Readdir cookies don't depend on where entries are, a listing in progress goes on
+Inputs:
+    path: path of the directory
+Returns:
+    number of blocks freed, -errno on failure
+*/
+ssize_t custom_compact_dir(const char* path);
+
 ssize_t custom_close(ssize_t file_descriptor);
 
 ssize_t custom_open(const char* path, ssize_t oflag);
 
 ssize_t custom_read(const char* path, void* buff, size_t nbytes, size_t offset);
 
+// a write crossing MAX_FILE_SIZE is cut short there, one starting at it fails with -EFBIG
 ssize_t custom_write(const char* path, void* buff, size_t nbytes, size_t offset);
 
+// buffer to build a write into fblock_num from, allocating the block when it is a hole
+char* load_dblock_for_write(struct iNode* inode, ssize_t fblock_num, ssize_t* dblock_num);
+
+// zeros the bytes [from, to) of a file block, holes and unwritten blocks are left alone
+bool zero_fblock_range(struct iNode* inode, ssize_t fblock_num, ssize_t from, ssize_t to);
+
+// releases the blocks fully inside [offset, offset+len) and zeros the partially covered ones
+bool punch_hole(struct iNode* inode, size_t offset, size_t len);
+
+// allocates the missing blocks of [offset, offset+len) as unwritten blocks
+bool preallocate_blocks(struct iNode* inode, size_t offset, size_t len);
+
+/*
+Finds the first file block at or after fblock_num that holds data, or that is a hole.
+Unwritten blocks count as holes. Indirect blocks that are not there are skipped whole.
+Inputs:
+    inode: the file
+    fblock_num: block to start from
+    data: true to look for data, false for a hole
+Returns:
+    the file block; -1 when there is no data left, num_blocks when there is no hole before it
+*/
+ssize_t find_fblock(const struct iNode* const inode, ssize_t fblock_num, bool data);
+
+/*
+Answers SEEK_DATA and SEEK_HOLE from the block map, without reading file data
+The fuse 2 API has no lseek operation, so a mount does not reach this, it is for callers of the file layer
+Inputs:
+    path: path to the file
+    offset: offset to search from
+    whence: SEEK_DATA or SEEK_HOLE
+Returns:
+    the offset found, -ENXIO when offset is past the data or the end of file, -errno on failure
+*/
+ssize_t custom_lseek(const char* path, ssize_t offset, int whence);
+
+// called for each entry of a directory by walk_dir_entries, next_offset resumes the walk right after the entry,
+// inode is NULL unless the walk loads inodes, false stops the walk
+typedef bool (*dir_entry_visitor)(const char* name, ssize_t inode_num, unsigned char type, const struct iNode* inode,
+                                  ssize_t next_offset, void* arg);
+
+/*
+Visits the entries of a directory, "." and ".." first and the names in hash order, a linear directory
+or one leaf of an index in memory at a time
+Inputs:
+    inode: the directory
+    offset: 0 to start at the beginning or a next_offset handed out by an earlier walk. A cookie is
+    DIR_COOKIE_FIRST plus the hash of the next name and its rank among the names with that hash, so
+    creates, unlinks, leaf splits and compaction between walks make one skip or repeat no other name
+    load_inodes: hand each entry its inode as well, the inodes of one leaf are read together
+    so entries sharing an inode block cost one read. Names and types alone need no inode read at all
+    visit: called for each entry
+    arg: passed on to visit
+Returns:
+    true/false, false when a directory block or an inode could not be read
+*/
+bool walk_dir_entries(const struct iNode* const inode, ssize_t offset, bool load_inodes, dir_entry_visitor visit, void* arg);
+
+// called for each mapped entry of a file by walk_file_blocks, false stops the walk
+typedef bool (*fblock_visitor)(ssize_t fblock_num, ssize_t entry, void* arg);
+
+// visits the non-zero block map entries of a file in file block order, holes are skipped
+bool walk_file_blocks(const struct iNode* const inode, fblock_visitor visit, void* arg);
+
+// layout of the blocks of a file on the device
+struct frag_stats{
+    ssize_t mapped_blocks; // data and unwritten blocks, holes excluded
+    ssize_t extents; // runs of blocks that follow each other on the device
+    ssize_t last_dblock;
+    ssize_t score; // 0 for a single run up to 100 when no two blocks are adjacent
+};
+
+bool get_frag_stats(const struct iNode* const inode, struct frag_stats* stats);
+
+// fragmentation score of the file at path, -errno on failure
+ssize_t custom_frag_score(const char* path);
+
+/*
+Moves the blocks of a fragmented file into one contiguous run while it stays in use.
+The data is copied to the new run under a new block map. Under the inode lock, the new map
+is swapped in with a single inode write and the old blocks are freed, unless the file was
+written to during the copy.
+Inputs:
+    path: path to the file
+Returns:
+    0 on success or when the file is not fragmented, -ENOSPC when there is no run
+    large enough, -EAGAIN when the file changed during the copy, -EINVAL for anything
+    but a regular file, -errno on failure
+*/
+ssize_t custom_defrag(const char* path);
+
+/*
+Fills in the usage of the file system, served from the superblock counters
+Inputs:
+    stat_buff: statvfs to fill
+Returns:
+    true / false
+*/
+bool custom_statfs(struct statvfs* stat_buff);
+
+/*
+Preallocates or deallocates space of a file
+Inputs:
+    path: path to the file
+    mode: 0, FALLOC_FL_KEEP_SIZE or FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE
+    offset: start of the range
+    len: length of the range
+Returns:
+    0 on success, -errno on failure
+*/
+ssize_t custom_fallocate(const char* path, int mode, size_t offset, size_t len);
+
 /*
 Adds a new entry to a directory represented by the inode
 Inputs:
     inode: Directory to add the new entry
     inode_num: The new entry to add
     inode_name: The name of the new entry
+    mode: mode of the new entry, its file type is kept in the entry
 Returns:
     true / false
 */
-bool add_new_entry(struct iNode* inode, ssize_t inode_num, char* inode_name);
+bool add_new_entry(struct iNode* inode, ssize_t inode_num, char* inode_name, mode_t mode);
+
+/*
+Releases up to max_blocks blocks of the inode at the head of the orphan list,
+the inode itself is freed by the step that finds it without blocks
+Inputs:
+    max_blocks: throttle for the number of blocks released in one go
+Returns:
+    true if an orphan was worked on, false when the list is empty or on failure
+*/
+bool reclaim_orphan_step(ssize_t max_blocks);
+
+// background thread draining the orphan list at a throttled rate
+bool start_reclaim_thread();
+
+void stop_reclaim_thread();
+
+// writes back the state kept only in memory, the free counters of the superblock
+bool sync_file_layer();
 
 bool init_file_layer();
 
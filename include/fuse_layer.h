@@ -10,11 +10,18 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <sys/ioctl.h>
 #include "debug.h"
 #include "file_layer.h"
 
 static const struct fuse_operations fuse_ops;
 
+// ioctls on an open file: defragment it, and read its fragmentation score (0-100) into an int
+#define CHARM_IOC_DEFRAG _IO('C', 1)
+#define CHARM_IOC_FRAG_SCORE _IOR('C', 2, int)
+// on a directory: compact it after mass deletes, the number of blocks freed goes into an int
+#define CHARM_IOC_COMPACT_DIR _IOR('C', 3, int)
+
 // Errors:
     // ENOENT (No such file or directory)
 
@@ -33,11 +40,16 @@ static const struct fuse_operations fuse_ops;
 
 // TODO 
 // opendir
-// symlink
-// init - not reqd as init_file_layer launched
+// init - file system is set up by init_file_layer, only the reclaim thread is launched here
 
 static int inode_to_stdbuff(struct iNode* inode, struct stat* stdbuff);
 
+static void* charm_init(struct fuse_conn_info* conn);
+
+static void charm_destroy(void* private_data);
+
+static int charm_statfs(const char* path, struct statvfs* stat_buff);
+
 static int charm_access(const char* path, int mode);
 
 static int charm_chown(const char* path, uid_t uid, gid_t gid);
@@ -69,6 +81,17 @@ static int charm_unlink(const char* path);
 // why not ssize_t
 static int charm_write(const char* path, const char* buff, size_t size, off_t offset, struct fuse_file_info* file_info);
 
+static int charm_fallocate(const char* path, int mode, off_t offset, off_t len, struct fuse_file_info* file_info);
+
+// defragmentation and the fragmentation score of a file, compaction of a directory, see CHARM_IOC_*
+static int charm_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* file_info, unsigned int flags, void* data);
+
 static int charm_rename(const char *from, const char *to);
 
+static int charm_link(const char* from, const char* to);
+
+static int charm_symlink(const char* target, const char* path);
+
+static int charm_readlink(const char* path, char* buff, size_t size);
+
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@ struct node {
     ssize_t value;
     struct node* prev;
     struct node* next;
+    struct node* chain; // next node of the same hash bucket
 };
 
 struct lru_cache {
@@ -18,6 +19,32 @@ struct lru_cache {
     struct node** map;
 };
 
+// one path component, the path to a node is the names on the way down from the root
+struct path_node {
+    struct path_node* parent;
+    struct path_node* first_child;
+    struct path_node* prev_sibling;
+    struct path_node* next_sibling;
+    struct path_node* prev; // recency list
+    struct path_node* next;
+    struct path_node* chain; // next node of the same hash bucket
+    ssize_t value;
+    ssize_t name_length;
+    char name[];
+};
+
+// LRU cache of paths as a trie of their components, a parent is always used more recently than
+// its children so eviction only ever takes leaves. Children are found through one hash map
+// keyed by the parent node and the name
+struct path_cache {
+    struct path_node* root;
+    struct path_node* head;
+    struct path_node* tail;
+    ssize_t size;
+    ssize_t capacity;
+    struct path_node** map;
+};
+
 void create_cache(struct lru_cache* cache, ssize_t capacity);
 
 bool pop_cache(struct lru_cache* cache, const char* key);
@@ -27,3 +54,33 @@ void set_cache(struct lru_cache* cache, const char* key, ssize_t value);
 ssize_t get_cache(struct lru_cache* cache, const char* key);
 
 void free_cache(struct lru_cache* cache);
+
+void create_path_cache(struct path_cache* cache, ssize_t capacity);
+
+/*
+Value of the longest cached prefix of a path, repeated slashes are skipped like single ones
+Inputs:
+    path: path to look up
+    matched: set to the length of the path the returned value covers, may be NULL
+Returns:
+    value of the deepest cached component, -1 when not even the first one is cached
+*/
+ssize_t get_path_cache(struct path_cache* cache, const char* path, ssize_t* matched);
+
+/*
+Caches the first path_len characters of a path, every component but the last has to be cached already.
+A new value for a cached path drops everything cached under it
+Returns:
+    true on success and false when the parent path isn't cached
+*/
+bool set_path_cache(struct path_cache* cache, const char* path, ssize_t path_len, ssize_t value);
+
+/*
+Drops a path and everything cached under it, a path without components empties the cache
+Returns:
+    number of entries dropped
+*/
+ssize_t pop_path_cache(struct path_cache* cache, const char* path);
+
+// Frees every node, the cache itself belongs to the caller
+void free_path_cache(struct path_cache* cache);
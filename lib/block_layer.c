@@ -1,12 +1,43 @@
+#define _GNU_SOURCE // recursive mutex initializer
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "../include/disk_layer.h"
 #include "../include/block_layer.h"
 #include "../include/debug.h"
 
 static struct superBlock* super_block = NULL;
+// one bit per inode, kept in memory and mirrored to the inode bitmap blocks
+static unsigned char* inode_bitmap = NULL;
+// one bit per block of the device, blocks before DATA_B_START are always set
+static unsigned char* block_bitmap = NULL;
+// free dblocks of each block group, rebuilt from the block bitmap at mount
+static ssize_t* group_free_count = NULL;
+// every dblock below this one is in use, allocations without a goal start here
+static ssize_t first_free_hint = 0;
+// free extent index, one node per free extent. A node is on the list of its size class and is found
+// by its first and by its last block through two hash tables
+struct free_extent{
+    ssize_t start;
+    ssize_t length;
+    struct free_extent* next; // size class list
+    struct free_extent* prev;
+    struct free_extent* start_chain; // next node in the bucket of its first block
+    struct free_extent* end_chain; // next node in the bucket of its last block
+};
+static struct free_extent** extents_by_start = NULL;
+static struct free_extent** extents_by_end = NULL;
+// both tables have 2^extent_table_bits buckets, resized to stay near one node per bucket
+static ssize_t extent_table_bits = 0;
+static ssize_t extent_count = 0;
+// first extent of every size class, NULL when the class is empty
+static struct free_extent* extent_bucket[EXTENT_CLASS_COUNT];
+// the free counters changed since the superblock was last written, load_fs rebuilds them from the bitmaps
+static bool super_block_dirty = false;
+// serializes the allocators and inode block updates between the fuse threads and the reclaim thread
+static pthread_mutex_t block_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 bool write_superblock(){
     char buff[BLOCK_SIZE];
@@ -16,23 +47,39 @@ bool write_superblock(){
         printf("Could not write superblock into memory");
         return false;
     }
+    super_block_dirty = false;
     return true;
 }
 
+bool sync_superblock(){
+    pthread_mutex_lock(&block_lock);
+    bool status = !super_block_dirty || write_superblock();
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
 bool init_superblock(){
     // assign memory
     super_block = (struct superBlock*) malloc(sizeof(struct superBlock));
     // initialize values
+    super_block->magic = FS_MAGIC;
+    super_block->orphan_head = 0;
     super_block->latest_inum = 3; // It means this is the first free inode, need 1 and 2 for file level op
-    super_block->inodes_per_block = (BLOCK_SIZE) / sizeof(struct iNode);
+    super_block->inodes_per_block = INODES_PER_BLOCK;
     super_block->inode_count = (INODE_B_COUNT * super_block->inodes_per_block);
-    super_block->free_list_head = INODE_B_COUNT + 1;
+    super_block->block_group_count = BLOCK_GROUP_COUNT;
+    super_block->blocks_per_group = BLOCKS_PER_GROUP;
+    super_block->free_inode_count = super_block->inode_count - super_block->latest_inum;
+    super_block->free_dblock_count = DATA_B_COUNT;
+    super_block->inode_version = INODE_VERSION;
+    super_block->dirent_version = DIRENT_VERSION;
     return write_superblock();
 }
 
 bool init_inode_list(){
     // Indirect blocks will use Data blocks itself to store the addresses.
-    struct iNode inode[sizeof(struct iNode)];
+    struct iNode inode[1];
+    memset(inode, 0, sizeof(struct iNode));
     for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
         inode->direct_blocks[i] = 0; // using 0 because 0 can only be used by superblock
     }
@@ -43,6 +90,8 @@ bool init_inode_list(){
     inode->file_size = 0;
     inode->num_blocks = 0;
     inode->allocated = false;
+    inode->next_orphan = 0;
+    inode->alloc_goal = 0;
     char buff[BLOCK_SIZE];
     ssize_t dummy_value = 0;
     for(ssize_t block_id=1; block_id<=INODE_B_COUNT; block_id++){
@@ -50,8 +99,8 @@ bool init_inode_list(){
         memset(buff, dummy_value, BLOCK_SIZE);
         // each i-node block will be initialized with stuct inode. 
         for(ssize_t i=0; i<super_block->inodes_per_block; i++){
-            memcpy(buff+offset, inode, sizeof(struct iNode));
-            offset += sizeof(struct iNode);
+            inode_to_disk(inode, (struct disk_inode*) (buff+offset));
+            offset += sizeof(struct disk_inode);
         }
         if(!write_block(block_id, buff)){    
             printf("Could not create inode at block - %ld", block_id);
@@ -61,96 +110,497 @@ bool init_inode_list(){
     return true;
 }
 
-bool init_freelist(){
-    char buff[BLOCK_SIZE];
-    ssize_t block_id = super_block->free_list_head;
-    ssize_t dummy_value = 0;
-     // 0th index will store the address of the next free list block that holds the addresses. 
-    // Eg: Block 100:
-    // 101-612, Block[0]=613
-    for(ssize_t i=0; i<FREE_LIST_BLOCKS; i++){
-        ssize_t curr_block_id = block_id;
-        // printf("Started with %ld and ", curr_block_id);
-        memset(buff, dummy_value, BLOCK_SIZE);
-        ssize_t offset = 0;
-        for(ssize_t j=1; j<DBLOCKS_PER_BLOCK; j++){
-            offset += ADDRESS_SIZE;
-            block_id++;
-            if(block_id >= BLOCK_COUNT){
-                memcpy(buff+offset, &dummy_value, ADDRESS_SIZE);
-            } else{
-                memcpy(buff+offset, &block_id, ADDRESS_SIZE);
+// writes back the inode bitmap block holding the bit of inode_num
+bool write_inode_bitmap_block(ssize_t inode_num){
+    ssize_t bitmap_block = inode_num / (BLOCK_SIZE * 8);
+    if(!write_block(INODE_BITMAP_START + bitmap_block, (char*) inode_bitmap + bitmap_block * BLOCK_SIZE)){
+        printf("Could not write inode bitmap block %ld\n", bitmap_block);
+        return false;
+    }
+    return true;
+}
+
+bool init_inode_bitmap(){
+    inode_bitmap = (unsigned char*) calloc(INODE_BITMAP_BLOCKS, BLOCK_SIZE);
+    if(inode_bitmap==NULL){
+        return false;
+    }
+    // inodes below latest_inum are reserved (0, 1 unused and 2 is root)
+    for(ssize_t inode_num=0; inode_num<super_block->latest_inum; inode_num++){
+        inode_bitmap[inode_num/8] |= 1 << (inode_num%8);
+    }
+    // bits past the last inode in the final byte are never handed out
+    for(ssize_t inode_num=super_block->inode_count; inode_num%8!=0; inode_num++){
+        inode_bitmap[inode_num/8] |= 1 << (inode_num%8);
+    }
+    for(ssize_t i=0; i<INODE_BITMAP_BLOCKS; i++){
+        if(!write_block(INODE_BITMAP_START + i, (char*) inode_bitmap + i * BLOCK_SIZE)){
+            printf("Could not write inode bitmap block %ld\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// writes back one block of the block bitmap
+bool write_block_bitmap_block(ssize_t bitmap_block){
+    if(!write_block(BLOCK_BITMAP_START + bitmap_block, (char*) block_bitmap + bitmap_block * BLOCK_SIZE)){
+        printf("Could not write block bitmap block %ld\n", bitmap_block);
+        return false;
+    }
+    return true;
+}
+
+// counts the free dblocks of every group from the block bitmap
+bool init_group_free_count(){
+    group_free_count = (ssize_t*) calloc(BLOCK_GROUP_COUNT, sizeof(ssize_t));
+    if(group_free_count==NULL){
+        return false;
+    }
+    first_free_hint = BLOCK_COUNT;
+    for(ssize_t dblock_num=DATA_B_START; dblock_num<BLOCK_COUNT; dblock_num++){
+        if((block_bitmap[dblock_num/8] & (1 << (dblock_num%8)))==0){
+            group_free_count[dblock_group(dblock_num)]++;
+            if(first_free_hint==BLOCK_COUNT){
+                first_free_hint = dblock_num;
             }
         }
-        block_id++;
-        // assigning next free_block_id at the first position
-        if(block_id >= BLOCK_COUNT){
-            memcpy(buff, &dummy_value, ADDRESS_SIZE);
-        } else{
-            memcpy(buff, &block_id, ADDRESS_SIZE);
+    }
+    return true;
+}
+
+static ssize_t extent_class(ssize_t length){
+    ssize_t class = 0;
+    while(length > 1 && class < EXTENT_CLASS_COUNT-1){
+        length >>= 1;
+        class++;
+    }
+    return class;
+}
+
+static bool is_free_dblock(ssize_t dblock_num){
+    return (block_bitmap[dblock_num/8] & (1 << (dblock_num%8)))==0;
+}
+
+static ssize_t extent_hash(ssize_t dblock_num){
+    // fibonacci hashing, free extents often start at blocks a fixed stride apart
+    return (ssize_t) (((uint64_t) dblock_num * 0x9E3779B97F4A7C15ull) >> (64 - extent_table_bits));
+}
+
+static struct free_extent* extent_starting_at(ssize_t dblock_num){
+    for(struct free_extent* extent=extents_by_start[extent_hash(dblock_num)]; extent!=NULL; extent=extent->start_chain){
+        if(extent->start==dblock_num){
+            return extent;
         }
-        // printf("ended with %ld\n", block_id);
-        if(!write_block(curr_block_id, buff)){
-            printf("Unable to write in the free list");
-            return false;
+    }
+    return NULL;
+}
+
+static struct free_extent* extent_ending_at(ssize_t dblock_num){
+    for(struct free_extent* extent=extents_by_end[extent_hash(dblock_num)]; extent!=NULL; extent=extent->end_chain){
+        if(extent->start+extent->length-1==dblock_num){
+            return extent;
         }
-        if(block_id >= BLOCK_COUNT){
-            break; // this wont happen but safe
+    }
+    return NULL;
+}
+
+// length of the free extent starting at dblock_num, 0 when no extent starts there
+static ssize_t extent_length(ssize_t dblock_num){
+    struct free_extent* extent = extent_starting_at(dblock_num);
+    return extent==NULL ? 0 : extent->length;
+}
+
+static void hash_extent(struct free_extent* extent){
+    ssize_t start_bucket = extent_hash(extent->start);
+    ssize_t end_bucket = extent_hash(extent->start+extent->length-1);
+    extent->start_chain = extents_by_start[start_bucket];
+    extents_by_start[start_bucket] = extent;
+    extent->end_chain = extents_by_end[end_bucket];
+    extents_by_end[end_bucket] = extent;
+}
+
+// rebuilds both tables with 2^bits buckets from the size class lists, the old ones stay when out of memory
+static void resize_extent_tables(ssize_t bits){
+    struct free_extent** by_start = (struct free_extent**) calloc((size_t) 1 << bits, sizeof(struct free_extent*));
+    struct free_extent** by_end = (struct free_extent**) calloc((size_t) 1 << bits, sizeof(struct free_extent*));
+    if(by_start==NULL || by_end==NULL){
+        free_memory(by_start);
+        free_memory(by_end);
+        return;
+    }
+    free_memory(extents_by_start);
+    free_memory(extents_by_end);
+    extents_by_start = by_start;
+    extents_by_end = by_end;
+    extent_table_bits = bits;
+    for(ssize_t class=0; class<EXTENT_CLASS_COUNT; class++){
+        for(struct free_extent* extent=extent_bucket[class]; extent!=NULL; extent=extent->next){
+            hash_extent(extent);
+        }
+    }
+}
+
+static void add_free_extent(ssize_t start, ssize_t length){
+    if(extent_count >= ((ssize_t) 1 << extent_table_bits)){
+        resize_extent_tables(extent_table_bits+1);
+    }
+    struct free_extent* extent = (struct free_extent*) malloc(sizeof(struct free_extent));
+    if(extent==NULL){
+        // its blocks are still free in the bitmap, only runs can't be taken from them
+        printf("Could not index the free extent at %ld\n", start);
+        return;
+    }
+    ssize_t class = extent_class(length);
+    extent->start = start;
+    extent->length = length;
+    extent->prev = NULL;
+    extent->next = extent_bucket[class];
+    if(extent_bucket[class]!=NULL){
+        extent_bucket[class]->prev = extent;
+    }
+    extent_bucket[class] = extent;
+    hash_extent(extent);
+    extent_count++;
+}
+
+static void unhash_extent(struct free_extent** chain, struct free_extent* extent, bool by_start){
+    while(*chain!=extent){
+        chain = by_start ? &(*chain)->start_chain : &(*chain)->end_chain;
+    }
+    *chain = by_start ? extent->start_chain : extent->end_chain;
+}
+
+static void remove_free_extent(struct free_extent* extent){
+    if(extent->prev==NULL){
+        extent_bucket[extent_class(extent->length)] = extent->next;
+    }
+    else{
+        extent->prev->next = extent->next;
+    }
+    if(extent->next!=NULL){
+        extent->next->prev = extent->prev;
+    }
+    unhash_extent(&extents_by_start[extent_hash(extent->start)], extent, true);
+    unhash_extent(&extents_by_end[extent_hash(extent->start+extent->length-1)], extent, false);
+    free_memory(extent);
+    extent_count--;
+    if(extent_table_bits > EXTENT_TABLE_MIN_BITS && extent_count < ((ssize_t) 1 << extent_table_bits) / 4){
+        resize_extent_tables(extent_table_bits-1);
+    }
+}
+
+// first block of the free extent holding dblock_num, a block whose predecessor is used is its own head.
+// Only a block in the middle of an extent is searched for, backwards through the bitmap a byte at a time.
+static ssize_t extent_head(ssize_t dblock_num){
+    if(extent_starting_at(dblock_num)!=NULL){
+        return dblock_num;
+    }
+    ssize_t start = dblock_num;
+    while(start > DATA_B_START && is_free_dblock(start-1)){
+        if(start%8==0 && start-8 >= DATA_B_START && block_bitmap[start/8-1]==0){
+            start -= 8;
+        }
+        else{
+            start--;
+        }
+    }
+    return start;
+}
+
+// splits [first, first+count) out of the free extent starting at start, to be called before the blocks are marked used
+static void take_from_extent_index(ssize_t start, ssize_t first, ssize_t count){
+    struct free_extent* extent = extent_starting_at(start);
+    if(extent==NULL){
+        return;
+    }
+    ssize_t length = extent->length;
+    remove_free_extent(extent);
+    if(first > start){
+        add_free_extent(start, first-start);
+    }
+    if(start+length > first+count){
+        add_free_extent(first+count, start+length-first-count);
+    }
+}
+
+// puts a freed block back, merged with the free extents around it, after its bit is cleared
+static void return_to_extent_index(ssize_t dblock_num){
+    ssize_t start = dblock_num;
+    ssize_t length = 1;
+    struct free_extent* before = dblock_num > DATA_B_START && is_free_dblock(dblock_num-1) ? extent_ending_at(dblock_num-1) : NULL;
+    if(before!=NULL){
+        start = before->start;
+        length += before->length;
+        remove_free_extent(before);
+    }
+    struct free_extent* after = dblock_num+1 < BLOCK_COUNT && is_free_dblock(dblock_num+1) ? extent_starting_at(dblock_num+1) : NULL;
+    if(after!=NULL){
+        length += after->length;
+        remove_free_extent(after);
+    }
+    add_free_extent(start, length);
+}
+
+// drops every node of the free extent index and its tables
+static void free_extent_index(){
+    for(ssize_t class=0; class<EXTENT_CLASS_COUNT; class++){
+        while(extent_bucket[class]!=NULL){
+            struct free_extent* next = extent_bucket[class]->next;
+            free_memory(extent_bucket[class]);
+            extent_bucket[class] = next;
+        }
+    }
+    free_memory(extents_by_start);
+    free_memory(extents_by_end);
+    extents_by_start = NULL;
+    extents_by_end = NULL;
+    extent_table_bits = 0;
+    extent_count = 0;
+}
+
+// builds the free extent index from the block bitmap
+bool init_extent_index(){
+    free_extent_index();
+    extents_by_start = (struct free_extent**) calloc((size_t) 1 << EXTENT_TABLE_MIN_BITS, sizeof(struct free_extent*));
+    extents_by_end = (struct free_extent**) calloc((size_t) 1 << EXTENT_TABLE_MIN_BITS, sizeof(struct free_extent*));
+    if(extents_by_start==NULL || extents_by_end==NULL){
+        free_extent_index();
+        return false;
+    }
+    extent_table_bits = EXTENT_TABLE_MIN_BITS;
+    ssize_t start = -1;
+    for(ssize_t dblock_num=DATA_B_START; dblock_num<=BLOCK_COUNT; dblock_num++){
+        bool free_block = dblock_num<BLOCK_COUNT && is_free_dblock(dblock_num);
+        if(free_block && start==-1){
+            start = dblock_num;
+        }
+        else if(!free_block && start!=-1){
+            add_free_extent(start, dblock_num-start);
+            start = -1;
         }
     }
     return true;
 }
 
-ssize_t create_new_dblock(){
-    if(super_block->free_list_head == 0)
-    {
+ssize_t free_extent_length(ssize_t dblock_num){
+    if(dblock_num < DATA_B_START || dblock_num >= BLOCK_COUNT){
+        return 0;
+    }
+    pthread_mutex_lock(&block_lock);
+    ssize_t length = extent_length(dblock_num);
+    pthread_mutex_unlock(&block_lock);
+    return length;
+}
+
+bool init_block_bitmap(){
+    block_bitmap = (unsigned char*) calloc(BLOCK_BITMAP_BLOCKS, BLOCK_SIZE);
+    if(block_bitmap==NULL){
+        return false;
+    }
+    // superblock, inode blocks and both bitmaps are never handed out
+    for(ssize_t block_id=0; block_id<DATA_B_START; block_id++){
+        block_bitmap[block_id/8] |= 1 << (block_id%8);
+    }
+    // neither are the bits past the end of the device
+    for(ssize_t block_id=BLOCK_COUNT; block_id<BLOCK_BITMAP_BLOCKS*BLOCK_SIZE*8; block_id++){
+        block_bitmap[block_id/8] |= 1 << (block_id%8);
+    }
+    for(ssize_t i=0; i<BLOCK_BITMAP_BLOCKS; i++){
+        if(!write_block_bitmap_block(i)){
+            return false;
+        }
+    }
+    return init_group_free_count() && init_extent_index();
+}
+
+ssize_t dblock_group(ssize_t dblock_num){
+    return dblock_num / BLOCKS_PER_GROUP;
+}
+
+ssize_t group_first_dblock(ssize_t group){
+    ssize_t dblock_num = group * BLOCKS_PER_GROUP;
+    return dblock_num < DATA_B_START ? DATA_B_START : dblock_num;
+}
+
+ssize_t inode_group(ssize_t inode_num){
+    return FIRST_DATA_GROUP + inode_num * DATA_GROUP_COUNT / super_block->inode_count;
+}
+
+ssize_t least_used_group(){
+    ssize_t best = 0;
+    for(ssize_t group=1; group<BLOCK_GROUP_COUNT; group++){
+        if(group_free_count[group] > group_free_count[best]){
+            best = group;
+        }
+    }
+    return best;
+}
+
+ssize_t group_free_dblocks(ssize_t group){
+    if(group<0 || group>=BLOCK_GROUP_COUNT){
+        return 0;
+    }
+    return group_free_count[group];
+}
+
+static ssize_t take_free_dblock(ssize_t goal){
+    if(goal < DATA_B_START || goal >= BLOCK_COUNT){
+        goal = first_free_hint;
+    }
+    if(goal >= BLOCK_COUNT){
         printf("No more blocks left\n");
         return -1;
     }
-    char buff[BLOCK_SIZE];
-    if(!read_block(super_block->free_list_head, buff)){
+    // the goal's group is visited twice, from the goal on first and from its start last
+    ssize_t group = dblock_group(goal);
+    for(ssize_t visit_count=0; visit_count<=BLOCK_GROUP_COUNT; visit_count++, group=(group+1)%BLOCK_GROUP_COUNT){
+        if(group_free_count[group]==0){
+            continue;
+        }
+        ssize_t dblock_num = (visit_count==0) ? goal : group_first_dblock(group);
+        ssize_t group_end = (group+1) * BLOCKS_PER_GROUP;
+        if(group_end > BLOCK_COUNT){
+            group_end = BLOCK_COUNT;
+        }
+        for(; dblock_num<group_end; dblock_num++){
+            if(dblock_num%8==0 && block_bitmap[dblock_num/8]==0xFF){
+                // all 8 blocks of this byte are taken
+                dblock_num += 7;
+                continue;
+            }
+            if((block_bitmap[dblock_num/8] & (1 << (dblock_num%8)))==0){
+                // past the first block of the scan a free block follows a used one and heads its extent
+                take_from_extent_index(extent_head(dblock_num), dblock_num, 1);
+                block_bitmap[dblock_num/8] |= 1 << (dblock_num%8);
+                group_free_count[group]--;
+                super_block->free_dblock_count--;
+                if(dblock_num==first_free_hint){
+                    first_free_hint++;
+                }
+                super_block_dirty = true;
+                if(!write_block_bitmap_block(dblock_num / (BLOCK_SIZE * 8))){
+                    return -1;
+                }
+                return dblock_num;
+            }
+        }
+    }
+    printf("No more blocks left\n");
+    return -1;
+}
+
+ssize_t create_new_dblock_near(ssize_t goal){
+    pthread_mutex_lock(&block_lock);
+    ssize_t status = take_free_dblock(goal);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+// free extent the run of count blocks comes from: the first one that fits from the goal on inside the
+// goal's group, otherwise the first extent of the smallest size class whose extents all hold count blocks.
+// Only when every such class is empty is the class of count itself searched. -1 if there is none
+static ssize_t fitting_extent(ssize_t goal, ssize_t count){
+    if(count<=0){
         return -1;
     }
-    ssize_t *dblock_num_ptr = (ssize_t *)buff;
-    ssize_t ans = 0;
-    //DBLOCKS_PER_BLOCK gives the number of block addresses a block can hold.
-    // iterating from 1st index because 0th index is used to point to the next free node.
-    for(ssize_t i=1; i<DBLOCKS_PER_BLOCK; i++){
-        ssize_t dblock_num = dblock_num_ptr[i];
-        if(dblock_num_ptr[i]!=0){
-            // printf("pos - %ld : %ld\n", i, dblock_num);
-            // the dblock is free and we are allotting this
-            dblock_num_ptr[i]=0;
-            ans = dblock_num;
-            break;
+    if(goal >= DATA_B_START && goal < BLOCK_COUNT && group_free_count[dblock_group(goal)] >= count){
+        ssize_t group_end = (dblock_group(goal)+1) * BLOCKS_PER_GROUP;
+        if(group_end > BLOCK_COUNT){
+            group_end = BLOCK_COUNT;
+        }
+        ssize_t dblock_num = goal;
+        if(is_free_dblock(goal)){
+            // the goal may be in the middle of an extent
+            ssize_t start = extent_head(goal);
+            ssize_t length = extent_length(start);
+            if(start + length >= goal + count){
+                return start;
+            }
+            dblock_num = length>0 ? start + length : goal + 1;
+        }
+        // free extents are stepped over whole, used blocks one at a time
+        while(dblock_num < group_end){
+            if(!is_free_dblock(dblock_num)){
+                dblock_num++;
+                continue;
+            }
+            ssize_t length = extent_length(dblock_num);
+            if(length >= count){
+                return dblock_num;
+            }
+            dblock_num += length>0 ? length : 1;
         }
     }
-    ssize_t temp = super_block->free_list_head;
-    if(ans == 0){
-        //freeList node itself is allocated as DataBlock
-        ans = super_block->free_list_head;
-        // move free_list_head to the next free_list_block
-        super_block->free_list_head = dblock_num_ptr[0];
-        dblock_num_ptr[0] = 0;
-        printf("Freelist Node %ld is now a dblock\n", ans);
-        if(!write_superblock()){
-            return -1;
+    ssize_t class = extent_class(count);
+    // a class starting at count or above holds no extent too short, its first one is taken as is
+    for(ssize_t fitting=(count==((ssize_t)1 << class)) ? class : class+1; fitting<EXTENT_CLASS_COUNT; fitting++){
+        if(extent_bucket[fitting]!=NULL){
+            return extent_bucket[fitting]->start;
         }
     }
-    /*
-     Any point during the creation of free list, only the free_list_head is manipulated. Either get a free block from the free_list_head or the 
-     free_list_head itself is the new dblock.
-     Hence the free_list_head has to be updated. Hence the write operation.
-    */
-    if(!write_block(temp, buff)){
-        printf("Could not write free_list block\n");
+    for(struct free_extent* extent=extent_bucket[class]; extent!=NULL; extent=extent->next){
+        if(extent->length >= count){
+            return extent->start;
+        }
+    }
+    return -1;
+}
+
+// first dblock of the run taken from the extent, goal when the run fits in the extent from there
+static ssize_t run_start_in_extent(ssize_t extent, ssize_t goal, ssize_t count){
+    return (goal >= extent && goal + count <= extent + extent_length(extent)) ? goal : extent;
+}
+
+static ssize_t take_free_run(ssize_t goal, ssize_t count){
+    ssize_t extent = fitting_extent(goal, count);
+    if(extent==-1){
+        printf("No run of %ld free blocks left\n", count);
         return -1;
     }
-    return ans;
+    ssize_t run_start = run_start_in_extent(extent, goal, count);
+    take_from_extent_index(extent, run_start, count);
+    bool dirty[BLOCK_BITMAP_BLOCKS];
+    memset(dirty, 0, sizeof(dirty));
+    for(ssize_t dblock_num=run_start; dblock_num<run_start+count; dblock_num++){
+        block_bitmap[dblock_num/8] |= 1 << (dblock_num%8);
+        group_free_count[dblock_group(dblock_num)]--;
+        dirty[dblock_num / (BLOCK_SIZE * 8)] = true;
+    }
+    super_block->free_dblock_count -= count;
+    if(run_start==first_free_hint){
+        first_free_hint += count;
+    }
+    super_block_dirty = true;
+    for(ssize_t i=0; i<BLOCK_BITMAP_BLOCKS; i++){
+        if(dirty[i] && !write_block_bitmap_block(i)){
+            return -1;
+        }
+    }
+    return run_start;
+}
+
+ssize_t create_new_dblock_run(ssize_t goal, ssize_t count){
+    pthread_mutex_lock(&block_lock);
+    ssize_t status = take_free_run(goal, count);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+ssize_t find_dblock_run(ssize_t goal, ssize_t count){
+    pthread_mutex_lock(&block_lock);
+    ssize_t extent = fitting_extent(goal, count);
+    ssize_t run_start = extent==-1 ? -1 : run_start_in_extent(extent, goal, count);
+    pthread_mutex_unlock(&block_lock);
+    return run_start;
+}
+
+ssize_t create_new_dblock(){
+    return create_new_dblock_near(0);
 }
 
 char *read_dblock(ssize_t dblock_num){
-    if(dblock_num <= INODE_B_COUNT || dblock_num > BLOCK_COUNT){
+    if(dblock_num < DATA_B_START || dblock_num > BLOCK_COUNT){
         printf("Invalid data block number %ld provided", dblock_num);
         return NULL;
     }
@@ -163,7 +613,7 @@ char *read_dblock(ssize_t dblock_num){
 }
 
 bool write_dblock(ssize_t dblock_num, char *buff){
-    if(dblock_num <= INODE_B_COUNT || dblock_num > BLOCK_COUNT){
+    if(dblock_num < DATA_B_START || dblock_num > BLOCK_COUNT){
         printf("Invalid data block number %ld provided\n", dblock_num);
         return false;
     }
@@ -172,57 +622,143 @@ bool write_dblock(ssize_t dblock_num, char *buff){
 }
 
 bool free_dblock(ssize_t dblock_num){
-    if(dblock_num <= INODE_B_COUNT || dblock_num > BLOCK_COUNT){
-        printf("Invalid data block number %ld provided\n", dblock_num);
-        return false;
-    }
-    char buff[BLOCK_SIZE];
-    memset(buff, 0, BLOCK_SIZE);
-    // flushing the data (might be doing two times) TODO
-    write_block(dblock_num, buff);
-    if(super_block->free_list_head==0){
-        // this is when all data blocks are used up and a data block becomes free. The newly freed block is now the head of free-list
-        super_block->free_list_head = dblock_num;
-        if(!write_superblock()){
+    return free_dblocks(&dblock_num, 1);
+}
+
+static bool release_dblocks(const ssize_t* dblock_nums, ssize_t count){
+    for(ssize_t i=0; i<count; i++){
+        if(dblock_nums[i] < DATA_B_START || dblock_nums[i] >= BLOCK_COUNT){
+            printf("Invalid data block number %ld provided\n", dblock_nums[i]);
             return false;
         }
     }
-    if(!read_block(super_block->free_list_head, buff)){
-        return false;
-    }
-    ssize_t* dblock_num_ptr = (ssize_t*) buff;
-    ssize_t ans = 0;
-    for(ssize_t i=1; i<DBLOCKS_PER_BLOCK; i++){
-        // if the free list head have one of the entry as 0, then that place can be updated with the block address of newly released block
-        if(dblock_num_ptr[i]==0){
-            dblock_num_ptr[i] = dblock_num;
-            ans = 1;
-            break;
+    // bits are cleared in memory and every bitmap block touched is written once.
+    // Freed data is not zeroed, the allocation paths that need a clean block clear it themselves.
+    bool dirty[BLOCK_BITMAP_BLOCKS];
+    memset(dirty, 0, sizeof(dirty));
+    ssize_t released = 0;
+    for(ssize_t i=0; i<count; i++){
+        ssize_t dblock_num = dblock_nums[i];
+        if((block_bitmap[dblock_num/8] & (1 << (dblock_num%8)))==0){
+            printf("Dblock %ld is already free\n", dblock_num);
+            continue;
         }
+        block_bitmap[dblock_num/8] &= ~(1 << (dblock_num%8));
+        return_to_extent_index(dblock_num);
+        group_free_count[dblock_group(dblock_num)]++;
+        released++;
+        if(dblock_num < first_free_hint){
+            first_free_hint = dblock_num;
+        }
+        dirty[dblock_num / (BLOCK_SIZE * 8)] = true;
     }
-    // this is when all free list address is completely filled with addresses i.e it is fully occupied with free block addresses. In this case,
-    // the newly released dblock becomes the head of free list.
-    if(ans==0){
-        // dblock will be made the new free list which points to old one
-        ssize_t temp = super_block->free_list_head;
-        super_block->free_list_head = dblock_num;
-        printf("Dblock %ld is named as the free list head\n", dblock_num);
-        if(!write_superblock()){
+    for(ssize_t i=0; i<BLOCK_BITMAP_BLOCKS; i++){
+        if(dirty[i] && !write_block_bitmap_block(i)){
             return false;
         }
-        memset(buff, 0, BLOCK_SIZE);
-        //0th index of dblock_num points to previous free_list_head.
-        memcpy(buff, &temp, ADDRESS_SIZE);
-        if(!write_block(dblock_num, buff)){
+    }
+    if(released==0){
+        return true;
+    }
+    super_block->free_dblock_count += released;
+    return write_superblock();
+}
+
+bool free_dblocks(const ssize_t* dblock_nums, ssize_t count){
+    pthread_mutex_lock(&block_lock);
+    bool status = release_dblocks(dblock_nums, count);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+bool append_dblock(struct dblock_list* list, ssize_t dblock_num){
+    if(list->count==list->capacity){
+        ssize_t capacity = list->capacity==0 ? DBLOCKS_PER_BLOCK : 2*list->capacity;
+        ssize_t* dblock_nums = (ssize_t*) realloc(list->dblock_nums, capacity * sizeof(ssize_t));
+        if(dblock_nums==NULL){
+            printf("Could not grow the dblock list to %ld entries\n", capacity);
             return false;
         }
+        list->dblock_nums = dblock_nums;
+        list->capacity = capacity;
     }
-    else{
-        if(!write_block(super_block->free_list_head, buff)){
+    list->dblock_nums[list->count++] = dblock_num;
+    return true;
+}
+
+bool release_indirect(ssize_t dblock_num, ssize_t depth, ssize_t from, struct dblock_list* freed){
+    ssize_t* entries = (ssize_t*) read_dblock(dblock_num);
+    if(entries==NULL){
+        return false;
+    }
+    // number of file blocks covered by one entry of this indirect block
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= DBLOCKS_PER_BLOCK;
+    }
+    for(ssize_t i=from/span; i<DBLOCKS_PER_BLOCK; i++){
+        if(entries[i]==0){
+            continue;
+        }
+        // only the first entry can be partially kept
+        ssize_t entry_from = (i==from/span) ? from%span : 0;
+        if(depth>1 && !release_indirect(entries[i], depth-1, entry_from, freed)){
+            free_memory(entries);
             return false;
         }
+        if(entry_from==0){
+            if(!append_dblock(freed, DBLOCK_NUM(entries[i]))){
+                free_memory(entries);
+                return false;
+            }
+            entries[i] = 0;
+        }
     }
-    return true;
+    bool status = (from==0) ? append_dblock(freed, dblock_num) : write_dblock(dblock_num, (char*) entries);
+    free_memory(entries);
+    return status;
+}
+
+// mapped entries under an indirect block of the given depth, the indirect blocks included
+static ssize_t count_indirect(ssize_t dblock_num, ssize_t depth){
+    ssize_t* entries = (ssize_t*) read_dblock(dblock_num);
+    if(entries==NULL){
+        return -1;
+    }
+    ssize_t count = 1;
+    for(ssize_t i=0; i<DBLOCKS_PER_BLOCK && count!=-1; i++){
+        if(entries[i]==0){
+            continue;
+        }
+        ssize_t below = depth>1 ? count_indirect(entries[i], depth-1) : 1;
+        count = below==-1 ? -1 : count+below;
+    }
+    free_memory(entries);
+    return count;
+}
+
+ssize_t count_mapped_dblocks(const struct iNode* inode){
+    if(inode->is_inline){
+        return 0;
+    }
+    ssize_t count = 0;
+    for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
+        if(inode->direct_blocks[i]!=0){
+            count++;
+        }
+    }
+    ssize_t indirect[3] = {inode->single_indirect, inode->double_indirect, inode->triple_indirect};
+    for(ssize_t depth=1; depth<=3; depth++){
+        if(indirect[depth-1]==0){
+            continue;
+        }
+        ssize_t below = count_indirect(indirect[depth-1], depth);
+        if(below==-1){
+            return -1;
+        }
+        count += below;
+    }
+    return count;
 }
 
 //helper functions
@@ -230,6 +766,105 @@ bool is_valid_inum(ssize_t inode_num){
     return inode_num>0 && inode_num<super_block->inode_count;
 }
 
+void clear_block_map(struct iNode* inode){
+    memset(inode->direct_blocks, 0, sizeof(inode->direct_blocks));
+    inode->single_indirect = 0;
+    inode->double_indirect = 0;
+    inode->triple_indirect = 0;
+    inode->alloc_blocks = 0;
+}
+
+void copy_block_map(struct iNode* inode, const struct iNode* from){
+    memcpy(inode->direct_blocks, from->direct_blocks, sizeof(inode->direct_blocks));
+    inode->single_indirect = from->single_indirect;
+    inode->double_indirect = from->double_indirect;
+    inode->triple_indirect = from->triple_indirect;
+    inode->alloc_blocks = from->alloc_blocks;
+}
+
+// block map entries are 32 bits on disk, the unwritten mark moves to their top bit
+static uint32_t entry_to_disk(ssize_t entry){
+    return IS_UNWRITTEN(entry) ? (uint32_t) DBLOCK_NUM(entry) | DISK_UNWRITTEN_FLAG : (uint32_t) entry;
+}
+
+static ssize_t entry_from_disk(uint32_t entry){
+    return (entry & DISK_UNWRITTEN_FLAG) ? (ssize_t) (entry & ~DISK_UNWRITTEN_FLAG) | UNWRITTEN_FLAG : (ssize_t) entry;
+}
+
+// times are nanoseconds since the epoch on disk
+static int64_t time_to_disk(const struct timespec* spec){
+    return (int64_t) spec->tv_sec * 1000000000 + spec->tv_nsec;
+}
+
+static struct timespec time_from_disk(int64_t nanoseconds){
+    // floor division so times before the epoch keep a positive tv_nsec
+    struct timespec spec = {nanoseconds / 1000000000, nanoseconds % 1000000000};
+    if(spec.tv_nsec<0){
+        spec.tv_sec--;
+        spec.tv_nsec += 1000000000;
+    }
+    return spec;
+}
+
+void inode_to_disk(const struct iNode* inode, struct disk_inode* disk){
+    memset(disk, 0, sizeof(struct disk_inode));
+    disk->mode = inode->mode;
+    disk->link_count = inode->link_count;
+    disk->user_id = inode->user_id;
+    disk->group_id = inode->group_id;
+    disk->file_size = inode->file_size;
+    disk->num_blocks = inode->num_blocks;
+    disk->alloc_blocks = inode->alloc_blocks;
+    disk->next_orphan = inode->next_orphan;
+    disk->alloc_goal = inode->alloc_goal;
+    disk->flags = (inode->allocated ? DISK_INODE_ALLOCATED : 0) | (inode->is_inline ? DISK_INODE_INLINE : 0) |
+        (inode->is_indexed ? DISK_INODE_INDEXED : 0);
+    disk->access_time = time_to_disk(&inode->access_time);
+    disk->creation_time = time_to_disk(&inode->creation_time);
+    disk->modification_time = time_to_disk(&inode->modification_time);
+    disk->status_change_time = time_to_disk(&inode->status_change_time);
+    if(inode->is_inline){
+        memcpy(disk->inline_data, inode->inline_data, INLINE_DATA_SIZE);
+        return;
+    }
+    for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
+        disk->blocks[i] = entry_to_disk(inode->direct_blocks[i]);
+    }
+    disk->blocks[DIRECT_B_COUNT] = inode->single_indirect;
+    disk->blocks[DIRECT_B_COUNT+1] = inode->double_indirect;
+    disk->blocks[DIRECT_B_COUNT+2] = inode->triple_indirect;
+}
+
+void inode_from_disk(const struct disk_inode* disk, struct iNode* inode){
+    memset(inode, 0, sizeof(struct iNode));
+    inode->mode = disk->mode;
+    inode->link_count = disk->link_count;
+    inode->user_id = disk->user_id;
+    inode->group_id = disk->group_id;
+    inode->file_size = disk->file_size;
+    inode->num_blocks = disk->num_blocks;
+    inode->alloc_blocks = disk->alloc_blocks;
+    inode->next_orphan = disk->next_orphan;
+    inode->alloc_goal = disk->alloc_goal;
+    inode->allocated = (disk->flags & DISK_INODE_ALLOCATED) != 0;
+    inode->is_inline = (disk->flags & DISK_INODE_INLINE) != 0;
+    inode->is_indexed = (disk->flags & DISK_INODE_INDEXED) != 0;
+    inode->access_time = time_from_disk(disk->access_time);
+    inode->creation_time = time_from_disk(disk->creation_time);
+    inode->modification_time = time_from_disk(disk->modification_time);
+    inode->status_change_time = time_from_disk(disk->status_change_time);
+    if(inode->is_inline){
+        memcpy(inode->inline_data, disk->inline_data, INLINE_DATA_SIZE);
+        return;
+    }
+    for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
+        inode->direct_blocks[i] = entry_from_disk(disk->blocks[i]);
+    }
+    inode->single_indirect = disk->blocks[DIRECT_B_COUNT];
+    inode->double_indirect = disk->blocks[DIRECT_B_COUNT+1];
+    inode->triple_indirect = disk->blocks[DIRECT_B_COUNT+2];
+}
+
 //which block contains the corresponding inode_num
 ssize_t inode_num_to_block_id(ssize_t inode_num){
     return 1 + (inode_num/super_block->inodes_per_block);
@@ -240,46 +875,58 @@ ssize_t inode_num_to_offset(ssize_t inode_num){
     return inode_num % super_block->inodes_per_block;
 }
 
-ssize_t create_new_inode(){
-    // TODO: Worst case - O(N) for finding one even with use of latest inum
-    if(!is_valid_inum(super_block->latest_inum)){
-        printf("Invalid inode num - %ld being accessed or out of range during create_new_inode\n", super_block->latest_inum);
+static ssize_t take_free_inode(ssize_t inode_num){
+    if(super_block->free_inode_count<=0){
+        printf("Unable to find memory for inode\n");
         return -1;
     }
-    // latest-inum is the next inum value from the prev allocated inum. Being used to improve the search.
-    ssize_t block_id = inode_num_to_block_id(super_block->latest_inum);
-    ssize_t offset = inode_num_to_offset(super_block->latest_inum);
-    char buff[BLOCK_SIZE];
-    struct iNode* temp = NULL;
-    struct iNode* inode = NULL;
-    ssize_t visit_count = 0;
-    while(visit_count != super_block->inode_count){
-        // reading block
-        if(!read_block(block_id, buff)){
-            return false;
+    for(ssize_t visit_count=0; visit_count<super_block->inode_count; visit_count++, inode_num++){
+        if(inode_num>=super_block->inode_count){
+            inode_num = 0;
+        }
+        if(inode_bitmap[inode_num/8]==0xFF){
+            // all 8 inodes of this byte are taken, jump to the last one of them
+            visit_count += 7 - inode_num%8;
+            inode_num += 7 - inode_num%8;
+            continue;
         }
-        temp = (struct iNode* ) buff;
-        for(; offset<super_block->inodes_per_block; offset++){
-            inode = temp+offset;
-            visit_count++;
-            if(inode->allocated==false){
-                //allocating the corresponding inode.
-                ssize_t ans = super_block->latest_inum;
-                // getting the new latest inum from block_id and offset
-                super_block->latest_inum += visit_count;
-                inode->allocated = true;
-                DEBUG_PRINTF("Inum %03d Block %03d Offset %03d allocated\n", ans, block_id, offset);
-                // printf("Inum %03d Block %03d Offset %03d allocated\n", ans, block_id, offset);
-                return ans;
+        if((inode_bitmap[inode_num/8] & (1 << (inode_num%8)))==0){
+            inode_bitmap[inode_num/8] |= 1 << (inode_num%8);
+            super_block->free_inode_count--;
+            super_block->latest_inum = inode_num + 1;
+            super_block_dirty = true;
+            if(!write_inode_bitmap_block(inode_num)){
+                return -1;
             }
+            DEBUG_PRINTF("Inum %03ld allocated\n", inode_num);
+            return inode_num;
         }
-        offset = 0;
-        block_id = (block_id%INODE_B_COUNT) + 1;
     }
     printf("Unable to find memory for inode\n");
     return -1;
 }
 
+ssize_t create_new_inode(){
+    pthread_mutex_lock(&block_lock);
+    // latest-inum is the next inum value from the prev allocated inum. Being used to improve the search.
+    ssize_t status = take_free_inode(super_block->latest_inum);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+ssize_t create_new_inode_in_group(ssize_t group){
+    if(group<FIRST_DATA_GROUP || group>=BLOCK_GROUP_COUNT){
+        return create_new_inode();
+    }
+    pthread_mutex_lock(&block_lock);
+    // first inode mapping to the group, the inverse of inode_group
+    ssize_t data_group = group - FIRST_DATA_GROUP;
+    ssize_t inode_num = (data_group * super_block->inode_count + DATA_GROUP_COUNT - 1) / DATA_GROUP_COUNT;
+    ssize_t status = take_free_inode(inode_num);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
 struct iNode* read_inode(ssize_t inode_num){
     if(!is_valid_inum(inode_num)){
         printf("Invalid inode num - %ld being accessed or out of range\n", inode_num);
@@ -293,15 +940,102 @@ struct iNode* read_inode(ssize_t inode_num){
     if(!read_block(block_id, buff)){
         return false;
     }
-    struct iNode* inode = (struct iNode*)buff;
+    struct disk_inode* inode = (struct disk_inode*)buff;
     inode = inode + offset;
     struct iNode* ans = (struct iNode*)malloc(sizeof(struct iNode));
-    //read inode to a buff and return the buff
-    memcpy(ans, inode, sizeof(struct iNode));
+    //translate the on-disk inode into the buff and return the buff
+    inode_from_disk(inode, ans);
     return ans;
 }
 
-bool write_inode(ssize_t inode_num, struct iNode* inode){
+// an inode asked for by read_inodes and where its result goes
+struct inode_request{
+    ssize_t inode_num;
+    ssize_t index;
+};
+
+static int compare_inode_requests(const void* a, const void* b){
+    ssize_t num_a = ((const struct inode_request*) a)->inode_num;
+    ssize_t num_b = ((const struct inode_request*) b)->inode_num;
+    return num_a < num_b ? -1 : (num_a > num_b ? 1 : 0);
+}
+
+bool read_inodes(const ssize_t* inode_nums, ssize_t count, struct iNode** inodes){
+    struct inode_request* requests = (struct inode_request*) malloc(count * sizeof(struct inode_request));
+    if(requests==NULL){
+        return false;
+    }
+    for(ssize_t i=0; i<count; i++){
+        requests[i].inode_num = inode_nums[i];
+        requests[i].index = i;
+        inodes[i] = NULL;
+    }
+    // in inode order the inodes sharing an inode block come one after another
+    qsort(requests, count, sizeof(struct inode_request), compare_inode_requests);
+    char buff[BLOCK_SIZE];
+    ssize_t loaded_block_id = -1;
+    bool status = true;
+    for(ssize_t i=0; i<count && status; i++){
+        ssize_t inode_num = requests[i].inode_num;
+        if(!is_valid_inum(inode_num)){
+            printf("Invalid inode num - %ld being accessed or out of range\n", inode_num);
+            status = false;
+            break;
+        }
+        ssize_t block_id = inode_num_to_block_id(inode_num);
+        if(block_id!=loaded_block_id){
+            status = read_block(block_id, buff);
+            loaded_block_id = block_id;
+        }
+        struct iNode* inode = status ? (struct iNode*) malloc(sizeof(struct iNode)) : NULL;
+        if(inode==NULL){
+            status = false;
+            break;
+        }
+        inode_from_disk((struct disk_inode*) buff + inode_num_to_offset(inode_num), inode);
+        inodes[requests[i].index] = inode;
+    }
+    free_memory(requests);
+    if(!status){
+        for(ssize_t i=0; i<count; i++){
+            free_memory(inodes[i]);
+            inodes[i] = NULL;
+        }
+    }
+    return status;
+}
+
+static int compare_block_ids(const void* a, const void* b){
+    ssize_t id_a = *(const ssize_t*) a;
+    ssize_t id_b = *(const ssize_t*) b;
+    return id_a < id_b ? -1 : (id_a > id_b ? 1 : 0);
+}
+
+void prefetch_inodes(const ssize_t* inode_nums, ssize_t count){
+    ssize_t* block_ids = (ssize_t*) malloc(count * sizeof(ssize_t));
+    if(block_ids==NULL){
+        return;
+    }
+    ssize_t block_count = 0;
+    for(ssize_t i=0; i<count; i++){
+        if(is_valid_inum(inode_nums[i])){
+            block_ids[block_count++] = inode_num_to_block_id(inode_nums[i]);
+        }
+    }
+    qsort(block_ids, block_count, sizeof(ssize_t), compare_block_ids);
+    // one request per run of adjacent inode blocks, a block held by several inodes is asked for once
+    for(ssize_t i=0; i<block_count; ){
+        ssize_t end = i+1;
+        while(end<block_count && block_ids[end]-block_ids[end-1]<=1){
+            end++;
+        }
+        prefetch_blocks(block_ids[i], block_ids[end-1]-block_ids[i]+1);
+        i = end;
+    }
+    free_memory(block_ids);
+}
+
+static bool store_inode(ssize_t inode_num, struct iNode* inode){
     if(!is_valid_inum(inode_num)){
         printf("Invalid inode num - %ld being accessed or out of range\n", inode_num);
         return false;
@@ -314,10 +1048,10 @@ bool write_inode(ssize_t inode_num, struct iNode* inode){
     if(!read_block(block_id, buff)){
         return false;
     }
-    struct iNode* temp = (struct iNode*)buff;
+    struct disk_inode* temp = (struct disk_inode*)buff;
     temp = temp + offset;
     //update the blockId with the inum data
-    memcpy(temp, inode, sizeof(struct iNode));
+    inode_to_disk(inode, temp);
     if(!write_block(block_id, buff)){
         return false;
     }
@@ -325,127 +1059,40 @@ bool write_inode(ssize_t inode_num, struct iNode* inode){
     return true;
 }
 
+bool write_inode(ssize_t inode_num, struct iNode* inode){
+    pthread_mutex_lock(&block_lock);
+    bool status = store_inode(inode_num, inode);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
 bool free_dblocks_from_inode(struct iNode* inode){
-    bool done = false;
-    char dblock_list_buff[BLOCK_SIZE];
-    char single_indirect_block_buff[BLOCK_SIZE];
-    char double_indirect_block_buff[BLOCK_SIZE];
-    ssize_t* dblock_list_ptr;
-    ssize_t* single_indirect_block_ptr;
-    ssize_t* double_indirect_block_ptr;
-    // freeing direct block
-    for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
-        if(inode->direct_blocks[i]==0){
-            done = true;
-            break;
-        }
-        if(!free_dblock(inode->direct_blocks[i])){
-            return false;
-        }
-    }
-    if(done || inode->single_indirect==0){
+    if(inode->is_inline){
+        // the block map holds file data, there is nothing to free
         return true;
     }
-    // freeing single indirect
-    if(!read_block(inode->single_indirect, dblock_list_buff)){
-        return false;
-    }
-    // store dblock number each by int
-    dblock_list_ptr = (ssize_t* )dblock_list_buff;
-    for(ssize_t i=0; i<DBLOCKS_PER_BLOCK; i++){
-        if(dblock_list_ptr[i]==0){
-            done = true;
-            break;
+    // every block of the file is collected first and handed back in one batch
+    struct dblock_list freed = {NULL, 0, 0};
+    bool status = true;
+    for(ssize_t i=0; i<DIRECT_B_COUNT && status; i++){
+        if(inode->direct_blocks[i]!=0){
+            status = append_dblock(&freed, DBLOCK_NUM(inode->direct_blocks[i]));
         }
-        //free individual datablocks referred in Single Indirect block
-        if(!free_dblock(dblock_list_ptr[i])){
-            return false;
-        }
-    }
-    if(!free_dblock(inode->single_indirect)){
-        return false;
-    }
-    if(done || inode->double_indirect==0){
-        return true;
-    }
-    // freeing double indirect
-    if(!read_block(inode->double_indirect, single_indirect_block_buff)){
-        return false;
     }
-    single_indirect_block_ptr = (ssize_t* )single_indirect_block_buff;
-    for(ssize_t i=0; i<DBLOCKS_PER_BLOCK; i++){
-        if(single_indirect_block_ptr[i]==0){
-            done = true;
-            break;
-        }
-        //read individual single indirect block within double indirect block and free the datablocks within them
-        if(!read_block(single_indirect_block_ptr[i], dblock_list_buff)){
-            return false;
-        }
-        dblock_list_ptr = (ssize_t* )dblock_list_buff;
-        for(ssize_t j=0; j<DBLOCKS_PER_BLOCK; j++){
-            if(dblock_list_ptr[j]==0){
-                done = true;
-                break;
-            }
-            if(!free_dblock(dblock_list_ptr[j])){
-                return false;
-            }
-        }
-        if(!free_dblock(single_indirect_block_ptr[i])){
-            return false;
+    ssize_t indirect_blocks[3] = {inode->single_indirect, inode->double_indirect, inode->triple_indirect};
+    for(ssize_t depth=1; depth<=3 && status; depth++){
+        if(indirect_blocks[depth-1]!=0){
+            status = release_indirect(indirect_blocks[depth-1], depth, 0, &freed);
         }
     }
-    if(!free_dblock(inode->double_indirect)){
-        return false;
-    }
-    if(done || inode->triple_indirect==0){
-        return true;
-    }
-    // freeing triple indirect
-    if(!read_block(inode->triple_indirect, double_indirect_block_buff)){
-        return false;
-    }
-    double_indirect_block_ptr = (ssize_t* )double_indirect_block_buff;
-    for(ssize_t k=0; k<DBLOCKS_PER_BLOCK; k++){
-        if(double_indirect_block_ptr[k]==0){
-            done = true;
-            break;
-        }
-        if(!read_block(double_indirect_block_ptr[k], single_indirect_block_buff)){
-            return false;
-        }
-        single_indirect_block_ptr = (ssize_t* )single_indirect_block_buff;
-        for(ssize_t i=0; i<DBLOCKS_PER_BLOCK; i++){
-            if(single_indirect_block_ptr[i]==0){
-                done = true;
-                break;
-            }
-            if(!read_block(single_indirect_block_ptr[i], dblock_list_buff)){
-                return false;
-            }
-            dblock_list_ptr = (ssize_t* )dblock_list_buff;
-            for(ssize_t j=0; j<DBLOCKS_PER_BLOCK; j++){
-                if(dblock_list_ptr[j]==0){
-                    done = true;
-                    break;
-                }
-                if(!free_dblock(dblock_list_ptr[j])){
-                    return false;
-                }
-            }
-            if(!free_dblock(single_indirect_block_ptr[i])){
-                return false;
-            }
-        }
-    }
-    if(!free_dblock(inode->triple_indirect)){
-        return false;
+    if(status){
+        status = free_dblocks(freed.dblock_nums, freed.count);
     }
-    return true;
+    free_memory(freed.dblock_nums);
+    return status;
 }
 
-bool free_inode(ssize_t inode_num){
+static bool release_inode(ssize_t inode_num){
     if(!is_valid_inum(inode_num)){
         printf("Invalid inode num - %ld being accessed or out of range\n", inode_num);
         return false;
@@ -456,31 +1103,93 @@ bool free_inode(ssize_t inode_num){
     if(!read_block(block_id, buff)){
         return false;
     }
-    struct iNode* temp = (struct iNode*)buff;
-    temp = temp + offset;
+    struct disk_inode* disk = (struct disk_inode*)buff;
+    disk = disk + offset;
+    struct iNode temp[1];
+    inode_from_disk(disk, temp);
 
     // freeing all the datablocks referred in inode && setting the allocated flag to false.
     if(!free_dblocks_from_inode(temp)){
         return false;
     }
+    // a stale block map would get freed a second time once the inode is reused
+    clear_block_map(temp);
+    temp->is_inline = false;
+    temp->is_indexed = false;
+    temp->num_blocks = 0;
+    temp->file_size = 0;
+    temp->alloc_goal = 0;
     temp->allocated = false;
+    inode_to_disk(temp, disk);
     if(!write_block(block_id, buff)){
         return false;
     }
+    if(inode_bitmap[inode_num/8] & (1 << (inode_num%8))){
+        inode_bitmap[inode_num/8] &= ~(1 << (inode_num%8));
+        super_block->free_inode_count++;
+        super_block_dirty = true;
+        if(!write_inode_bitmap_block(inode_num)){
+            return false;
+        }
+    }
     DEBUG_PRINTF("Inode %ld has been freed \n", inode_num);
     return true;
 }
 
-bool make_fs(){
-    // this calls disk layer
-    // TODO: If alloc memory indicates re-mounting on an existing partiton,
-    // don't init everything again and just read super block
-    if(!alloc_memory()){
-        printf("Memory allocation for block failed \n");
-        return false;
+bool free_inode(ssize_t inode_num){
+    pthread_mutex_lock(&block_lock);
+    bool status = release_inode(inode_num);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+bool push_orphan(ssize_t inode_num, struct iNode* inode){
+    pthread_mutex_lock(&block_lock);
+    inode->next_orphan = super_block->orphan_head;
+    bool status = store_inode(inode_num, inode);
+    if(status){
+        super_block->orphan_head = inode_num;
+        status = write_superblock();
     }
-    DEBUG_PRINTF("Memory Allocated for block \n");
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
+
+ssize_t get_orphan_head(){
+    return super_block->orphan_head;
+}
+
+ssize_t get_free_dblock_count(){
+    return super_block->free_dblock_count;
+}
+
+ssize_t get_free_inode_count(){
+    return super_block->free_inode_count;
+}
+
+ssize_t get_inode_count(){
+    return super_block->inode_count;
+}
+
+bool pop_orphan(ssize_t inode_num){
+    pthread_mutex_lock(&block_lock);
+    bool status = false;
+    struct iNode* inode = NULL;
+    if(inode_num!=super_block->orphan_head){
+        printf("Inode %ld is not at the head of the orphan list\n", inode_num);
+    }
+    else if((inode = read_inode(inode_num))!=NULL){
+        // unhooked before freeing, a crash in between leaks the inode instead of
+        // leaving a freed (and maybe re-used) inode on the orphan list
+        super_block->orphan_head = inode->next_orphan;
+        status = write_superblock() && release_inode(inode_num);
+    }
+    free_memory(inode);
+    pthread_mutex_unlock(&block_lock);
+    return status;
+}
 
+bool format_fs(){
     if(!init_superblock()){
         printf("Superblock allocation failed \n");
         return false;
@@ -493,10 +1202,129 @@ bool make_fs(){
     }
     DEBUG_PRINTF("Inode List created \n");
 
-    if(!init_freelist()){
-        printf("Free List allocation failed \n");
+    if(!init_inode_bitmap()){
+        printf("Inode bitmap allocation failed \n");
+        return false;
+    }
+    DEBUG_PRINTF("Inode bitmap created \n");
+
+    if(!init_block_bitmap()){
+        printf("Block bitmap allocation failed \n");
         return false;
     }
-    DEBUG_PRINTF("Free List created \n");
+    DEBUG_PRINTF("Block bitmap created \n");
     return true;
-}
\ No newline at end of file
+}
+
+// drops what load_fs read in before it gave up
+static void unload_fs(){
+    free_memory(super_block);
+    free_memory(inode_bitmap);
+    free_memory(block_bitmap);
+    free_memory(group_free_count);
+    free_extent_index();
+    super_block = NULL;
+    inode_bitmap = NULL;
+    block_bitmap = NULL;
+    group_free_count = NULL;
+}
+
+// reads back the superblock and both bitmaps of an already formatted device
+enum fs_load_status load_fs(){
+    char buff[BLOCK_SIZE];
+    if(!read_block(0, buff)){
+        printf("Superblock could not be read\n");
+        return FS_UNUSABLE;
+    }
+    struct superBlock* disk_super_block = (struct superBlock*) buff;
+    if(disk_super_block->magic!=FS_MAGIC){
+        return FS_NOT_FOUND;
+    }
+    if(disk_super_block->inodes_per_block!=INODES_PER_BLOCK ||
+       disk_super_block->inode_count!=INODE_B_COUNT*INODES_PER_BLOCK ||
+       disk_super_block->block_group_count!=BLOCK_GROUP_COUNT || disk_super_block->blocks_per_group!=BLOCKS_PER_GROUP){
+        printf("File system geometry does not match this build: %ld inodes in groups of %ld blocks\n",
+               disk_super_block->inode_count, disk_super_block->blocks_per_group);
+        return FS_UNUSABLE;
+    }
+    if(disk_super_block->inode_version!=INODE_VERSION || disk_super_block->dirent_version!=DIRENT_VERSION){
+        printf("File system has inode version %ld and dirent version %ld, this build reads %ld and %ld\n",
+               disk_super_block->inode_version, disk_super_block->dirent_version, INODE_VERSION, DIRENT_VERSION);
+        return FS_UNUSABLE;
+    }
+    super_block = (struct superBlock*) malloc(sizeof(struct superBlock));
+    inode_bitmap = (unsigned char*) malloc(INODE_BITMAP_BLOCKS * BLOCK_SIZE);
+    block_bitmap = (unsigned char*) malloc(BLOCK_BITMAP_BLOCKS * BLOCK_SIZE);
+    if(super_block==NULL || inode_bitmap==NULL || block_bitmap==NULL){
+        unload_fs();
+        return FS_UNUSABLE;
+    }
+    memcpy(super_block, disk_super_block, sizeof(struct superBlock));
+    for(ssize_t i=0; i<INODE_BITMAP_BLOCKS; i++){
+        if(!read_block(INODE_BITMAP_START + i, (char*) inode_bitmap + i * BLOCK_SIZE)){
+            unload_fs();
+            return FS_UNUSABLE;
+        }
+    }
+    for(ssize_t i=0; i<BLOCK_BITMAP_BLOCKS; i++){
+        if(!read_block(BLOCK_BITMAP_START + i, (char*) block_bitmap + i * BLOCK_SIZE)){
+            unload_fs();
+            return FS_UNUSABLE;
+        }
+    }
+    if(!init_group_free_count() || !init_extent_index()){
+        unload_fs();
+        return FS_UNUSABLE;
+    }
+    // the free counters are only written back at sync, the bitmaps are the truth after a crash
+    ssize_t free_dblocks = 0;
+    for(ssize_t group=0; group<BLOCK_GROUP_COUNT; group++){
+        free_dblocks += group_free_count[group];
+    }
+    ssize_t free_inodes = 0;
+    for(ssize_t inode_num=0; inode_num<super_block->inode_count; inode_num++){
+        if((inode_bitmap[inode_num/8] & (1 << (inode_num%8)))==0){
+            free_inodes++;
+        }
+    }
+    if(free_dblocks!=super_block->free_dblock_count || free_inodes!=super_block->free_inode_count){
+        printf("Free counts %ld dblocks and %ld inodes fixed up to %ld and %ld\n", super_block->free_dblock_count,
+               super_block->free_inode_count, free_dblocks, free_inodes);
+        super_block->free_dblock_count = free_dblocks;
+        super_block->free_inode_count = free_inodes;
+        if(!write_superblock()){
+            unload_fs();
+            return FS_UNUSABLE;
+        }
+    }
+    return FS_LOADED;
+}
+
+bool make_fs(){
+    // this calls disk layer
+    if(!alloc_memory()){
+        printf("Memory allocation for block failed \n");
+        return false;
+    }
+    DEBUG_PRINTF("Memory Allocated for block \n");
+    return format_fs();
+}
+
+bool mount_fs(){
+    if(!alloc_memory()){
+        printf("Memory allocation for block failed \n");
+        return false;
+    }
+    DEBUG_PRINTF("Memory Allocated for block \n");
+    enum fs_load_status status = load_fs();
+    if(status==FS_LOADED){
+        printf("Mounted existing file system, %ld inodes free\n", super_block->free_inode_count);
+        return true;
+    }
+    if(status==FS_UNUSABLE){
+        // formatting would wipe whatever is still on the device
+        printf("Refusing to mount, the device holds a file system this build cannot use\n");
+        return false;
+    }
+    return format_fs();
+}
@@ -27,13 +27,8 @@ bool alloc_memory(){
         return false;
     }
     printf("address is %p \n", &m_ptr);
-    char buff[BLOCK_SIZE];
-    memset(&buff, 0, BLOCK_SIZE);
-    for(ssize_t i=0; i<BLOCK_COUNT; i++){
-        if(!write_block(i, buff)){
-            return false;
-        }
-    }
+    // the device is not wiped here, make_fs formats the metadata it needs
+    // and an existing file system is picked up as is on re-mount
 #else
     m_ptr = (char *) malloc(FS_SIZE);
     if(!m_ptr){
@@ -74,12 +69,9 @@ bool read_block(ssize_t block_id, char *buffer){
         return false;
     }
 #ifdef DISK
+    // positional io so that the fuse threads and the reclaim thread don't share a file offset
     off_t offset = (unsigned long) BLOCK_SIZE * block_id;
-    off_t status = lseek(m_ptr, offset, SEEK_SET);
-    if(status == -1){
-        return false;
-    }
-    if(read(m_ptr, buffer, BLOCK_SIZE) != BLOCK_SIZE){
+    if(pread(m_ptr, buffer, BLOCK_SIZE, offset) != BLOCK_SIZE){
         return false;
     }
 #else
@@ -100,11 +92,7 @@ bool write_block(ssize_t block_id, char *buffer){
     }
 #ifdef DISK
     off_t offset = (unsigned long) BLOCK_SIZE * block_id;
-    off_t status = lseek(m_ptr, offset, SEEK_SET);
-    if(status == -1){
-        return false;
-    }
-    if(write(m_ptr, buffer, BLOCK_SIZE) != BLOCK_SIZE){
+    if(pwrite(m_ptr, buffer, BLOCK_SIZE, offset) != BLOCK_SIZE){
         return false;
     }
 #else
@@ -115,6 +103,21 @@ bool write_block(ssize_t block_id, char *buffer){
     return true;
 }
 
+bool prefetch_blocks(ssize_t block_id, ssize_t count){
+    if(block_id<0 || count<=0 || block_id+count > BLOCK_COUNT){
+        printf("Invalid prefetch of block index - out of range\n");
+        return false;
+    }
+#ifdef DISK
+    // the kernel queues the reads into the page cache and returns right away
+    off_t offset = (unsigned long) BLOCK_SIZE * block_id;
+    return posix_fadvise(m_ptr, offset, (off_t) BLOCK_SIZE * count, POSIX_FADV_WILLNEED) == 0;
+#else
+    // nothing to wait for in memory
+    return true;
+#endif
+}
+
 void free_memory(void *ptr){
     if(ptr!=NULL){
         free(ptr);
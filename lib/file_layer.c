@@ -1,12 +1,53 @@
+#define _GNU_SOURCE // recursive mutex initializer
 #include <errno.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "../include/debug.h"
 #include "../include/disk_layer.h"
 #include "../include/file_layer.h"
 #include "../include/lru_cache.h"
 
-static struct lru_cache iname_cache;
+// dentry cache, a trie of path components with the inode number of each cached path
+static struct path_cache dentry_cache;
+static pthread_mutex_t dentry_lock = PTHREAD_MUTEX_INITIALIZER;
+// bumped under dentry_lock once the entries of a directory changed, striped by its inode number.
+// A lookup only caches what it found if the generation it started with is still current
+static ssize_t dir_generations[INODE_LOCK_COUNT];
+// largest free record of each directory block by dblock number, a hint that is checked before it is trusted
+static struct lru_cache dir_space_cache;
+static pthread_mutex_t dir_space_lock = PTHREAD_MUTEX_INITIALIZER;
+// orphan_lock guards the orphan list between unlink and the reclaim thread
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t orphan_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reclaim_thread;
+static bool reclaim_running = false;
+// per-inode locks, striped by inode number. Whatever reads the blocks of a file or writes its inode back
+// holds the lock, so a defrag can't swap the block map underneath it. Writers of the data or the
+// block map also bump the generation of the stripe, which is how a defrag notices them
+static pthread_mutex_t inode_locks[INODE_LOCK_COUNT] = {[0 ... INODE_LOCK_COUNT-1] = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP};
+static ssize_t inode_generations[INODE_LOCK_COUNT];
+
+static void lock_inode(ssize_t inode_num){
+    pthread_mutex_lock(&inode_locks[inode_num % INODE_LOCK_COUNT]);
+}
+
+static void unlock_inode(ssize_t inode_num){
+    pthread_mutex_unlock(&inode_locks[inode_num % INODE_LOCK_COUNT]);
+}
+
+static void begin_inode_write(ssize_t inode_num){
+    lock_inode(inode_num);
+    inode_generations[inode_num % INODE_LOCK_COUNT]++;
+}
+
+// inode timestamps keep nanoseconds, like the disk inode
+static struct timespec current_time(){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now;
+}
 
 // Returns char array index of the last slash of parent's path
 ssize_t get_parent_id(const char* const path, ssize_t path_len){
@@ -47,542 +88,1243 @@ bool get_child_name(char* const buff, const char* const path, ssize_t path_len){
     return true;
 }
 
+// locates the indirect tree holding fblock_num, returns its depth and sets the fblock number relative to the tree
+static ssize_t indirect_root(struct iNode* inode, ssize_t fblock_num, ssize_t** root, ssize_t* rel_fblock_num){
+    ssize_t* indirect_blocks[3] = {&inode->single_indirect, &inode->double_indirect, &inode->triple_indirect};
+    ssize_t start = DIRECT_B_COUNT;
+    ssize_t span = SINGLE_INDIRECT_BLOCK_COUNT;
+    for(ssize_t depth=1; depth<=3; depth++){
+        if(fblock_num < start+span || depth==3){
+            *root = indirect_blocks[depth-1];
+            *rel_fblock_num = fblock_num - start;
+            return depth;
+        }
+        start += span;
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    return -1;
+}
+
 // get dblock num corr to file block number
 ssize_t fblock_num_to_dblock_num(const struct iNode* const inode, ssize_t fblock_num){
-    ssize_t dblock_num = -1;
-    if(fblock_num > inode->num_blocks){
+    if(fblock_num >= inode->num_blocks){
         printf("invalid file block num - %ld with block count as %ld\n", fblock_num, inode->num_blocks);
-        return dblock_num;
+        return -1;
     }
     // if its part of direct block
     if(fblock_num<DIRECT_B_COUNT){
-        dblock_num = inode->direct_blocks[fblock_num];
-    }
-    // single indirect
-    else if(fblock_num < DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT){
-        if(inode->single_indirect==0){
-            return dblock_num;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(inode->single_indirect);
-        dblock_num = single_indirect_buff[fblock_num-DIRECT_B_COUNT];
-        free_memory(single_indirect_buff);
-    }
-    // double indirect
-    else if(fblock_num < DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT){
-        if(inode->double_indirect==0){
-            return dblock_num;
-        }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(inode->double_indirect);
-        ssize_t offset = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT;
-        dblock_num = double_indirect_buff[offset/SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(double_indirect_buff);
-        if(dblock_num<=0){
-            return -1;
+        return inode->direct_blocks[fblock_num];
+    }
+    ssize_t* root;
+    ssize_t rel_fblock_num;
+    ssize_t depth = indirect_root((struct iNode*) inode, fblock_num, &root, &rel_fblock_num);
+    // file blocks covered by one entry at the current level
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    ssize_t dblock_num = *root;
+    for(; depth>=1; depth--){
+        // a missing indirect block maps nothing, all of its range is a hole
+        if(dblock_num==0){
+            return 0;
         }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-        dblock_num = single_indirect_buff[offset%SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(single_indirect_buff);
-    }
-    // triple indirect
-    else{
-        if(inode->triple_indirect==0){
-            return dblock_num;
-        }
-        ssize_t* triple_indirect_buff = (ssize_t*) read_dblock(inode->triple_indirect);
-        ssize_t offset = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT - DOUBLE_INDIRECT_BLOCK_COUNT;
-        dblock_num = triple_indirect_buff[offset/DOUBLE_INDIRECT_BLOCK_COUNT];
-        free_memory(triple_indirect_buff);
-        if(dblock_num<=0){
+        ssize_t* indirect_buff = (ssize_t*) read_dblock(dblock_num);
+        if(indirect_buff==NULL){
             return -1;
         }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-        dblock_num = double_indirect_buff[(offset/SINGLE_INDIRECT_BLOCK_COUNT)%SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(double_indirect_buff);
-        if(dblock_num<=0){
-            return -1;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-        dblock_num = single_indirect_buff[offset%SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(single_indirect_buff);
+        dblock_num = indirect_buff[rel_fblock_num/span];
+        free_memory(indirect_buff);
+        rel_fblock_num %= span;
+        span /= SINGLE_INDIRECT_BLOCK_COUNT;
     }
     return dblock_num;
 }
 
 bool write_dblock_to_inode(struct iNode* inode, ssize_t fblock_num, ssize_t dblock_num){
     // over-writing an existing block with a new block
-    if(fblock_num > inode->num_blocks){
+    if(fblock_num >= inode->num_blocks){
         printf("invalid file block num");
         return false;
     }
     // if direct block
     if(fblock_num < DIRECT_B_COUNT){
         inode->direct_blocks[fblock_num] = dblock_num;
+        return true;
     }
-    // single indirect
-    else if(fblock_num < DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT){
-        if(inode->single_indirect==0){
-            return false;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(inode->single_indirect);
-        single_indirect_buff[fblock_num-DIRECT_B_COUNT] = dblock_num;
-        write_dblock(inode->single_indirect, (char*)single_indirect_buff);
-        free_memory(single_indirect_buff);
-    }
-    // double indirect
-    else if(fblock_num < DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT){
-        if(inode->double_indirect==0){
-            return false;
-        }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(inode->double_indirect);
-        ssize_t offset = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT;
-        ssize_t single_dblock_num = double_indirect_buff[offset/SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(double_indirect_buff);
-        if(single_dblock_num<=0){
-            return false;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(single_dblock_num);
-        single_indirect_buff[offset%SINGLE_INDIRECT_BLOCK_COUNT] = dblock_num;
-        write_dblock(single_dblock_num, (char*)single_indirect_buff);
-        free_memory(single_indirect_buff);
-    }
-    // triple indirect
-    else{
-        if(inode->triple_indirect==0){
-            return dblock_num;
-        }
-        ssize_t* triple_indirect_buff = (ssize_t*) read_dblock(inode->triple_indirect);
-        ssize_t offset = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT - DOUBLE_INDIRECT_BLOCK_COUNT;
-        ssize_t double_dblock_num = triple_indirect_buff[offset/DOUBLE_INDIRECT_BLOCK_COUNT];
-        free_memory(triple_indirect_buff);
-        if(double_dblock_num<=0){
-            return -1;
-        }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(double_dblock_num);
-        ssize_t single_dblock_num = double_indirect_buff[(offset/SINGLE_INDIRECT_BLOCK_COUNT)%SINGLE_INDIRECT_BLOCK_COUNT];
-        free_memory(double_indirect_buff);
-        if(single_dblock_num<=0){
-            return -1;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(single_dblock_num);
-        single_indirect_buff[offset%SINGLE_INDIRECT_BLOCK_COUNT] = dblock_num;
-        write_dblock(single_dblock_num, (char*)single_indirect_buff);
-        free_memory(single_indirect_buff);
-    }
-    return true;
-}
-
-// TODO: VERIFY// Done
-struct file_pos_in_dir find_file(const char* const name, const struct iNode* const parent_inode){
-    /*
-    Each file entry in the directory is stored in the following format.
-    INUM, RECORD_LEN/ADDR_PTR, FILE_STR_LEN, FILE_NAME
-    INUM, RECORD_LEN/ADDR_PTR, FILE_STR_LEN sizes are predefined in file_layer.h
-    as INODE_SZ, ADDRESS_PTR_SZ, STRING_LENGTH_SZ. Only the FILE_NAME size is variable based on len.
-    */
-    struct file_pos_in_dir file;
-    /*
-    This data structure is what is returned.
-    It will hold the datablock containing the file_record, corresponding dBlock_num, fblock_num,
-    pointer to the inode_num for the file (1st field of record) and a pointer to the record
-    previous to the file to be found. This is sent for the sake of manipulation wrt to records during deletion.
-    */
-    // if the file is found, the pointer to the inode is present in file.start_pos
-    // file.prev_entry holds the starting point of the preceding entry the file entry in question.
-    file.prev_entry = -1;
-    //if not a directory, return
-    // printf("Inside find_file(), checking is this a dir\n");
-    // printf("%ld\n",S_ISDIR(parent_inode->mode));
-    if(!S_ISDIR(parent_inode->mode)){
-        file.start_pos = -1;
-        return file;
-    }
-    // TODO : Check if name is in bounds, else return garbage
-    ssize_t name_length = strlen(name);
-    // traverse through the datablocks in parent directory to find the entry for the file.
-    // printf("parent_inode->num_blocks:%ld\n",parent_inode->num_blocks);
-    for(ssize_t i=0; i<parent_inode->num_blocks; i++){
-        file.dblock_num = fblock_num_to_dblock_num(parent_inode, i);
-        file.fblock_num = i;
-        file.prev_entry = -1; // prev_entry will ideally contain the pointer record which preceeds the file record.
-        // However, it will be initialied to -1 in the beginning for each block.
-        if(file.dblock_num<=0){
-            file.start_pos = -1;
-            printf("file.dblock_num<=0\n");
-            return file;
-        }
-        file.dblock = read_dblock(file.dblock_num);
-        ssize_t curr_pos = 0;
-        // curr_pos points to the beginning of a record that we are currently inspecting.
-        // It will be updated based on the record_len field of the curr_record.
-        while(curr_pos<BLOCK_SIZE){
-            if(((ssize_t*) (file.dblock+curr_pos))[0]!=0){ //refers to inum for an entry
-                ssize_t str_start_pos = curr_pos + INODE_SZ + ADDRESS_PTR_SZ + STRING_LENGTH_SZ;
-                //points to the start of filename string for the record.
-                unsigned short str_length = ((unsigned short*) (file.dblock+curr_pos+INODE_SZ+ADDRESS_PTR_SZ))[0];
-                if(str_length==name_length && strncmp(file.dblock+str_start_pos, name, name_length)==0){
-                    //checks if the file_name and len matches that with the curr_record
-                    file.start_pos = curr_pos;
-                    return file;
-                }
-            }
-            // if there is no match
-            ssize_t next_entry_offset = ((ssize_t*) (file.dblock+curr_pos+INODE_SZ))[0]; //rec_len corresponding to curr_pos
-            if(next_entry_offset<=0){
-                file.start_pos = -1;
-                printf("next_entry_offset: %ld\n",next_entry_offset);
-                return file;
-            }
-            file.prev_entry = curr_pos; //prev will now point to curr and curr will point to the next record in the block.
-            curr_pos += next_entry_offset;
-        }
-    }
-    //record not found
-    // printf("record not found\n");
-    file.start_pos = -1; // -1 is set to start_pos when the record is not found.
-    file.prev_entry = -1;
-    return file;
-}
-
-bool add_dblock_to_inode(struct iNode* inode, const ssize_t dblock_num){
-    // adding a new data block in inode, num_blocks would already be incremented
-    ssize_t fblock_num = inode->num_blocks;
-    // if direct block
-    if(fblock_num < DIRECT_B_COUNT){
-        inode->direct_blocks[fblock_num] = dblock_num;
+    ssize_t* root;
+    ssize_t rel_fblock_num;
+    ssize_t depth = indirect_root(inode, fblock_num, &root, &rel_fblock_num);
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
     }
-    // single indirect
-    else if(fblock_num < DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT){
-        if(fblock_num == DIRECT_B_COUNT){
-            ssize_t single_dblock_num = create_new_dblock();
-            if(single_dblock_num==-1){
-                return false;
-            }
-            inode->single_indirect = single_dblock_num;
+    if(*root==0){
+        if(dblock_num==0){
+            // still a hole
+            return true;
         }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(inode->single_indirect);
-        single_indirect_buff[fblock_num-DIRECT_B_COUNT] = dblock_num;
-        if(!write_dblock(inode->single_indirect, (char*)single_indirect_buff)){
+        *root = create_new_indirect_dblock(inode);
+        if(*root<=0){
+            *root = 0;
             return false;
         }
-        free_memory(single_indirect_buff);
     }
-    // double indirect
-    else if(fblock_num < DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT){
-        if(fblock_num==DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT){
-            ssize_t double_dblock_num = create_new_dblock();
-            if(double_dblock_num==-1){
-                return false;
-            }
-            inode->double_indirect = double_dblock_num;
-        }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(inode->double_indirect);
-        ssize_t offset = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT;
-        if(offset%SINGLE_INDIRECT_BLOCK_COUNT == 0){
-            ssize_t single_dblock_num = create_new_dblock();
-            if(single_dblock_num==-1){
-                return false;
-            }
-            double_indirect_buff[offset/SINGLE_INDIRECT_BLOCK_COUNT] = single_dblock_num;
-            if(!write_dblock(inode->double_indirect, (char*)double_indirect_buff)){
-                return false;
-            }
-        }
-        ssize_t single_dblock_num = double_indirect_buff[offset/SINGLE_INDIRECT_BLOCK_COUNT];
-        if(single_dblock_num<=0){
+    ssize_t indirect_dblock_num = *root;
+    for(; depth>=1; depth--){
+        ssize_t* indirect_buff = (ssize_t*) read_dblock(indirect_dblock_num);
+        if(indirect_buff==NULL){
             return false;
         }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(single_dblock_num);
-        single_indirect_buff[offset%SINGLE_INDIRECT_BLOCK_COUNT] = dblock_num;
-        if(!write_dblock(single_dblock_num, (char*)single_indirect_buff)){
-            return false;
+        ssize_t index = rel_fblock_num/span;
+        if(depth==1){
+            indirect_buff[index] = dblock_num;
+            bool status = write_dblock(indirect_dblock_num, (char*) indirect_buff);
+            free_memory(indirect_buff);
+            return status;
         }
-        free_memory(double_indirect_buff);
-        free_memory(single_indirect_buff);
-    }
-    // triple indirect
-    else{
-        if(fblock_num==DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT+DOUBLE_INDIRECT_BLOCK_COUNT){
-            ssize_t triple_dblock_num = create_new_dblock();
-            if(triple_dblock_num==-1){
-                return false;
-            }
-            inode->triple_indirect = triple_dblock_num;
-        }
-        ssize_t* triple_indirect_buff = (ssize_t*) read_dblock(inode->triple_indirect);
-        ssize_t triple_fblock_num = fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT - DOUBLE_INDIRECT_BLOCK_COUNT;
-        ssize_t triple_fblock_offset = triple_fblock_num/DOUBLE_INDIRECT_BLOCK_COUNT;
-        if(triple_fblock_num % DOUBLE_INDIRECT_BLOCK_COUNT == 0){
-            ssize_t double_dblock_num = create_new_dblock();
-            if(double_dblock_num==-1){
-                return false;
-            }
-            triple_indirect_buff[triple_fblock_offset] = double_dblock_num;
-            if(!write_dblock(inode->triple_indirect, (char *)triple_indirect_buff)){
-                return false;
+        ssize_t next_dblock_num = indirect_buff[index];
+        if(next_dblock_num==0){
+            if(dblock_num==0){
+                free_memory(indirect_buff);
+                return true;
             }
-        }
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(triple_indirect_buff[triple_fblock_offset]);
-        if(triple_fblock_num % SINGLE_INDIRECT_BLOCK_COUNT == 0){
-            ssize_t single_dblock_num = create_new_dblock();
-            if(single_dblock_num==-1){
+            // indirect blocks are created on the way down, next to the data block being mapped
+            next_dblock_num = create_new_indirect_dblock(inode);
+            if(next_dblock_num<=0){
+                free_memory(indirect_buff);
                 return false;
             }
-            double_indirect_buff[(triple_fblock_num/SINGLE_INDIRECT_BLOCK_COUNT)%SINGLE_INDIRECT_BLOCK_COUNT] = single_dblock_num;
-            if(!write_dblock(triple_indirect_buff[triple_fblock_offset], (char*)double_indirect_buff)){
+            indirect_buff[index] = next_dblock_num;
+            if(!write_dblock(indirect_dblock_num, (char*) indirect_buff)){
+                free_memory(indirect_buff);
                 return false;
             }
         }
-        ssize_t double_fblock_offset = (triple_fblock_num/SINGLE_INDIRECT_BLOCK_COUNT)%SINGLE_INDIRECT_BLOCK_COUNT;
-        ssize_t single_dblock_num = double_indirect_buff[double_fblock_offset];
-        if(single_dblock_num<=0){
-            return false;
-        }
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(single_dblock_num);
-        single_indirect_buff[triple_fblock_num % SINGLE_INDIRECT_BLOCK_COUNT] = dblock_num;
-        if(!write_dblock(single_dblock_num, (char*)single_indirect_buff)){
-            return false;
-        }
-        free_memory(triple_indirect_buff);
-        free_memory(double_indirect_buff);
-        free_memory(single_indirect_buff);
+        free_memory(indirect_buff);
+        indirect_dblock_num = next_dblock_num;
+        rel_fblock_num %= span;
+        span /= SINGLE_INDIRECT_BLOCK_COUNT;
     }
-    inode->num_blocks++;
-    return true;
+    return false;
 }
 
-// free the blocks inside single indirect
-bool remove_single_indirect(ssize_t dblock_num){
-    if(dblock_num<=0){
-        printf("Invalid dblock num for single indirection removal");
+bool move_inline_data_to_block(struct iNode* inode, const char* dblock){
+    char block[BLOCK_SIZE];
+    memset(block, 0, BLOCK_SIZE);
+    if(dblock!=NULL){
+        memcpy(block, dblock, BLOCK_SIZE);
+    }
+    else{
+        memcpy(block, inode->inline_data, INLINE_DATA_SIZE);
+    }
+    // the block map shares its bytes with the inline data
+    clear_block_map(inode);
+    inode->is_inline = false;
+    inode->num_blocks = 0;
+    if(inode->file_size==0){
         return true;
     }
-    ssize_t* single_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-    for(ssize_t i=0; i<BLOCK_SIZE/ADDRESS_SIZE; i++){
-        if(single_indirect_buff[i]==0){
-            break;
-        }
-        free_dblock(single_indirect_buff[i]);
+    ssize_t dblock_num = create_new_dblock_for_inode(inode);
+    if(dblock_num<=0){
+        return false;
     }
-    free_dblock(dblock_num);
-    free_memory(single_indirect_buff);
-    return true;
+    if(!write_dblock(dblock_num, block)){
+        return false;
+    }
+    return add_dblock_to_inode(inode, dblock_num);
 }
 
-// free the blocks inside double indirect
-bool remove_double_indirect(ssize_t dblock_num){
-    if(dblock_num<=0){
-        printf("Invalid dblock num for double indirection removal");
-        return true;
+ssize_t dir_block_count(const struct iNode* const inode){
+    if(inode->is_inline){
+        return inode->file_size>0 ? 1 : 0;
     }
-    ssize_t* double_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-    for(ssize_t i=0; i<BLOCK_SIZE/ADDRESS_SIZE; i++){
-        if(double_indirect_buff[i]==0){
-            break;
-        }
-        remove_single_indirect(double_indirect_buff[i]);
+    return inode->num_blocks;
+}
+
+char* read_dir_block(const struct iNode* const inode, ssize_t fblock_num, ssize_t* dblock_num){
+    if(inode->is_inline){
+        // the last inline record already spans to BLOCK_SIZE, so the copy reads like a regular block
+        *dblock_num = 0;
+        char* dblock = (char*) calloc(1, BLOCK_SIZE);
+        memcpy(dblock, inode->inline_data, INLINE_DATA_SIZE);
+        return dblock;
     }
-    free_dblock(dblock_num);
-    free_memory(double_indirect_buff);
-    return true;
+    *dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+    if(*dblock_num<=0){
+        return NULL;
+    }
+    return read_dblock(*dblock_num);
 }
 
-// free the blocks inside triple indirect
-bool remove_triple_indirect(ssize_t dblock_num){
-    if(dblock_num<=0){
-        printf("Invalid dblock num for triple indirection removal");
-        return true;
+uint32_t dir_hash(const char* name, ssize_t name_length){
+    // 32 bit FNV-1a, it is stored in the index and the entries so it must never change
+    uint32_t hash = 2166136261u;
+    for(ssize_t i=0; i<name_length; i++){
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define DIR_ENTRY_SIZE(name_length) ((ssize_t) sizeof(struct dir_entry) + (ssize_t) (name_length))
+_Static_assert(DX_ROOT_OFFSET >= DIR_ENTRY_SIZE(1) + DIR_ENTRY_SIZE(2), "the index root has to start past . and ..");
+
+static struct dir_entry* dir_entry_at(const char* dblock, ssize_t pos){
+    return (struct dir_entry*) (dblock+pos);
+}
+
+ssize_t dir_entry_inum(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->inum;
+}
+
+static ssize_t dir_entry_rec_len(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->rec_len;
+}
+
+static void set_dir_entry_rec_len(char* dblock, ssize_t pos, ssize_t rec_len){
+    dir_entry_at(dblock, pos)->rec_len = rec_len;
+}
+
+static unsigned short dir_entry_name_length(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->name_length;
+}
+
+static unsigned char dir_entry_type(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->type;
+}
+
+static uint32_t dir_entry_hash(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->hash;
+}
+
+static const char* dir_entry_name(const char* dblock, ssize_t pos){
+    return dir_entry_at(dblock, pos)->name;
+}
+
+static void write_dir_entry(char* dblock, ssize_t pos, ssize_t inum, ssize_t rec_len, unsigned char type,
+                            const char* name, unsigned short name_length){
+    struct dir_entry* entry = dir_entry_at(dblock, pos);
+    entry->inum = inum;
+    entry->rec_len = rec_len;
+    entry->name_length = name_length;
+    entry->type = type;
+    entry->hash = dir_hash(name, name_length);
+    memcpy(entry->name, name, name_length);
+}
+
+static bool is_dot_entry(const char* name, ssize_t name_length){
+    return (name_length==1 && name[0]=='.') || (name_length==2 && name[0]=='.' && name[1]=='.');
+}
+
+bool write_dir_block(struct iNode* inode, ssize_t dblock_num, char* dblock){
+    if(!inode->is_inline){
+        return write_dblock(dblock_num, dblock);
     }
-    ssize_t* triple_indirect_buff = (ssize_t*) read_dblock(dblock_num);
-    for(ssize_t i=0; i<BLOCK_SIZE/ADDRESS_SIZE; i++){
-        if(triple_indirect_buff[i]==0){
+    // find where the last record ends, it is the one whose length reaches the block end
+    ssize_t curr_pos = 0;
+    while(true){
+        ssize_t rec_len = dir_entry_rec_len(dblock, curr_pos);
+        if(rec_len<=0){
+            printf("Could be a bug, check this\n");
+            return false;
+        }
+        if(curr_pos+rec_len>=BLOCK_SIZE){
             break;
         }
-        remove_double_indirect(triple_indirect_buff[i]);
+        curr_pos += rec_len;
+    }
+    ssize_t used = curr_pos + DIR_ENTRY_SIZE(dir_entry_name_length(dblock, curr_pos));
+    if(used > INLINE_DATA_SIZE){
+        return move_inline_data_to_block(inode, dblock);
     }
-    free_dblock(dblock_num);
-    free_memory(triple_indirect_buff);
+    memset(inode->inline_data, 0, INLINE_DATA_SIZE);
+    memcpy(inode->inline_data, dblock, used);
     return true;
 }
 
-bool remove_dblocks_from_inode(struct iNode* inode, ssize_t fblock_num){
-    // remove blocks from fblock_num to num_blocks from inode
-    if(fblock_num >= inode->num_blocks){
-        printf("Can't remove block that doesn't exist");
-        return false;
-    }
-    ssize_t curr_blocks = inode->num_blocks;
-    inode->num_blocks = fblock_num;
-    // remove direct blocks
-    if(fblock_num<=DIRECT_B_COUNT){
-        for(ssize_t i=fblock_num; i<curr_blocks && i<DIRECT_B_COUNT; i++){
-            free_dblock(inode->direct_blocks[i]);
-            inode->direct_blocks[i] = 0;
-        }
-        if(curr_blocks<=DIRECT_B_COUNT){
-            return true;
-        }
-        remove_single_indirect(inode->single_indirect);
-        inode->single_indirect = 0;
-        if(curr_blocks <= DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT){
-            return true;
+// position of the entry for name in a directory block, -1 when it is not there and -2 on a broken block
+static ssize_t find_in_block(const char* dblock, const char* name, ssize_t name_length, uint32_t hash, ssize_t* prev_entry){
+    *prev_entry = -1;
+    ssize_t curr_pos = 0;
+    while(curr_pos<BLOCK_SIZE){
+        // the stored hash turns away almost every other name without looking at it
+        if(dir_entry_inum(dblock, curr_pos)!=0 && dir_entry_hash(dblock, curr_pos)==hash &&
+           dir_entry_name_length(dblock, curr_pos)==name_length &&
+           strncmp(dir_entry_name(dblock, curr_pos), name, name_length)==0){
+            return curr_pos;
         }
-        remove_double_indirect(inode->double_indirect);
-        inode->double_indirect = 0;
-        if(curr_blocks <= DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT+DOUBLE_INDIRECT_BLOCK_COUNT){
-            return true;
+        ssize_t rec_len = dir_entry_rec_len(dblock, curr_pos);
+        if(rec_len<=0){
+            printf("next_entry_offset: %ld\n", rec_len);
+            return -2;
         }
-        remove_double_indirect(inode->triple_indirect);
-        inode->triple_indirect = 0;
+        *prev_entry = curr_pos;
+        curr_pos += rec_len;
     }
-    // remove single indirect blocks
-    else if(fblock_num <= DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT){
-        ssize_t* single_indirect_buff = (ssize_t*) read_dblock(inode->single_indirect);
-        ssize_t single_indirect_offset = fblock_num - DIRECT_B_COUNT;
-        ssize_t single_indirect_total = curr_blocks - DIRECT_B_COUNT;
-        ssize_t blocks_to_free = SINGLE_INDIRECT_BLOCK_COUNT - single_indirect_offset;
-        if(single_indirect_total < blocks_to_free){
-            blocks_to_free = single_indirect_total - single_indirect_offset;
+    return -1;
+}
+
+// adds an entry to a directory block if some record has room for it after its name, or is an empty one
+static bool insert_entry_in_block(char* dblock, ssize_t inum, unsigned char type, const char* name, unsigned short name_length){
+    ssize_t new_entry_size = DIR_ENTRY_SIZE(name_length);
+    ssize_t curr_pos = 0;
+    while(curr_pos<BLOCK_SIZE){
+        ssize_t rec_len = dir_entry_rec_len(dblock, curr_pos);
+        if(rec_len<=0){
+            printf("Could be a bug, check this\n");
+            return false;
         }
-        for(ssize_t i=single_indirect_offset; i<single_indirect_offset+blocks_to_free; i++){
-            free_dblock(single_indirect_buff[i]);
-            single_indirect_buff[i] = 0;
+        if(dir_entry_inum(dblock, curr_pos)==0 && rec_len>=new_entry_size){
+            write_dir_entry(dblock, curr_pos, inum, rec_len, type, name, name_length);
+            return true;
         }
-        free_memory(single_indirect_buff);
-        if(curr_blocks <= DIRECT_B_COUNT+SINGLE_INDIRECT_BLOCK_COUNT){
+        ssize_t used = DIR_ENTRY_SIZE(dir_entry_name_length(dblock, curr_pos));
+        if(dir_entry_inum(dblock, curr_pos)!=0 && rec_len-used>=new_entry_size){
+            // the record keeps its own length and the new one takes the rest of the space
+            set_dir_entry_rec_len(dblock, curr_pos, used);
+            write_dir_entry(dblock, curr_pos+used, inum, rec_len-used, type, name, name_length);
             return true;
         }
-        remove_double_indirect(inode->double_indirect);
-        inode->double_indirect = 0;
-    }
-    // remove double indirect blocks
-    else if (fblock_num <= DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT){
-        ssize_t* double_indirect_buff = (ssize_t*) read_dblock(inode->double_indirect);
-        ssize_t double_indirect_offset = (fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT) / SINGLE_INDIRECT_BLOCK_COUNT;
-        ssize_t single_indirect_offset = (fblock_num - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT) % SINGLE_INDIRECT_BLOCK_COUNT;
-        // either single or partial single indirect to be removed
-        if(single_indirect_offset==0){
-            remove_single_indirect(double_indirect_buff[double_indirect_offset]);
-            double_indirect_buff[double_indirect_offset] = 0;
-        } else{
-            ssize_t* single_indirect_buff = (ssize_t*) read_dblock(double_indirect_buff[double_indirect_offset]);
-            for(ssize_t i=single_indirect_offset; i<SINGLE_INDIRECT_BLOCK_COUNT; i++){
-                free_dblock(single_indirect_buff[i]);
-                single_indirect_buff[i] = 0;
-            }
-            free_memory(single_indirect_buff);
+        curr_pos += rec_len;
+    }
+    return false;
+}
+
+// an entry lifted out of a directory block while the entries are redistributed
+struct dir_record{
+    ssize_t inum;
+    uint32_t hash;
+    unsigned char type;
+    unsigned short name_length;
+    char name[MAX_NAME_LENGTH+1];
+};
+
+static bool append_dir_record(struct dir_record** records, ssize_t* count, ssize_t* capacity, const char* dblock, ssize_t pos){
+    if(*count==*capacity){
+        ssize_t new_capacity = *capacity==0 ? 64 : 2 * *capacity;
+        struct dir_record* grown = (struct dir_record*) realloc(*records, new_capacity * sizeof(struct dir_record));
+        if(grown==NULL){
+            return false;
         }
-        // removing remaining single indirect
-        // TODO : Can simplify this
-        ssize_t double_indirect_total = curr_blocks - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT;
-        ssize_t single_blocks_to_free = SINGLE_INDIRECT_BLOCK_COUNT - double_indirect_offset;
-        if(double_indirect_total/SINGLE_INDIRECT_BLOCK_COUNT < single_blocks_to_free){
-            single_blocks_to_free = double_indirect_total - double_indirect_offset;
+        *records = grown;
+        *capacity = new_capacity;
+    }
+    struct dir_record* record = &(*records)[(*count)++];
+    record->inum = dir_entry_inum(dblock, pos);
+    record->type = dir_entry_type(dblock, pos);
+    record->name_length = dir_entry_name_length(dblock, pos);
+    memcpy(record->name, dir_entry_name(dblock, pos), record->name_length);
+    record->name[record->name_length] = '\0';
+    record->hash = dir_entry_hash(dblock, pos);
+    return true;
+}
+
+static int compare_dir_records(const void* a, const void* b){
+    uint32_t hash_a = ((const struct dir_record*) a)->hash;
+    uint32_t hash_b = ((const struct dir_record*) b)->hash;
+    return hash_a < hash_b ? -1 : (hash_a > hash_b ? 1 : 0);
+}
+
+// lays records [from, to) out in a fresh block, a block without records gets one empty entry spanning it
+static void pack_dir_records(char* dblock, const struct dir_record* records, ssize_t from, ssize_t to){
+    memset(dblock, 0, BLOCK_SIZE);
+    if(from==to){
+        write_dir_entry(dblock, 0, 0, BLOCK_SIZE, DIR_TYPE_UNKNOWN, "", 0);
+        return;
+    }
+    ssize_t pos = 0;
+    for(ssize_t i=from; i<to; i++){
+        ssize_t size = DIR_ENTRY_SIZE(records[i].name_length);
+        write_dir_entry(dblock, pos, records[i].inum, i==to-1 ? BLOCK_SIZE-pos : size, records[i].type,
+                        records[i].name, records[i].name_length);
+        pos += size;
+    }
+}
+
+// room for the largest entry that still fits in a directory block
+static ssize_t largest_free_record(const char* dblock){
+    ssize_t largest = 0;
+    for(ssize_t pos=0; pos<BLOCK_SIZE; pos+=dir_entry_rec_len(dblock, pos)){
+        ssize_t rec_len = dir_entry_rec_len(dblock, pos);
+        if(rec_len<=0){
+            return 0;
         }
-        for(ssize_t i=double_indirect_offset+1; i<double_indirect_offset+single_blocks_to_free; i++){
-            remove_single_indirect(double_indirect_buff[i]);
-            double_indirect_buff[i] = 0;
+        ssize_t free_space = dir_entry_inum(dblock, pos)==0 ? rec_len : rec_len - DIR_ENTRY_SIZE(dir_entry_name_length(dblock, pos));
+        if(free_space>largest){
+            largest = free_space;
         }
-        free_memory(double_indirect_buff);
     }
-    // remove triple indirect blocks
+    return largest;
+}
+
+static void set_dir_space(ssize_t dblock_num, ssize_t space){
+    char key[24];
+    sprintf(key, "%ld", dblock_num);
+    pthread_mutex_lock(&dir_space_lock);
+    if(space<0){
+        pop_cache(&dir_space_cache, key);
+    }
     else{
-        ssize_t* triple_indirect_buff = (ssize_t*) read_dblock(inode->triple_indirect);
-        ssize_t triple_fblock_num = fblock_num - (DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + DOUBLE_INDIRECT_BLOCK_COUNT);
-        ssize_t triple_indirect_offset = triple_fblock_num / DOUBLE_INDIRECT_BLOCK_COUNT;
-        ssize_t double_indirect_offset = (triple_fblock_num / SINGLE_INDIRECT_BLOCK_COUNT) % SINGLE_INDIRECT_BLOCK_COUNT;
-        ssize_t single_indirect_offset = triple_fblock_num % SINGLE_INDIRECT_BLOCK_COUNT;
-        if(single_indirect_offset==0 && double_indirect_offset==0){
-            remove_double_indirect(triple_indirect_buff[triple_indirect_offset]);
-            triple_indirect_buff[triple_indirect_offset] = 0;
-        } else if(single_indirect_offset==0){
-            ssize_t* double_indirect_buff = (ssize_t*) read_dblock(triple_indirect_buff[triple_indirect_offset]);
-            for(ssize_t i=double_indirect_offset; i<SINGLE_INDIRECT_BLOCK_COUNT; i++){
-                remove_single_indirect(double_indirect_buff[i]);
-                double_indirect_buff[i] = 0;
-            }
-            free_memory(double_indirect_buff);
-        } else{
-            ssize_t* double_indirect_buff = (ssize_t*) read_dblock(triple_indirect_buff[triple_indirect_offset]);
-            ssize_t* single_indirect_buff = (ssize_t*) read_dblock(double_indirect_buff[double_indirect_offset]);
-            for(ssize_t i=single_indirect_offset; i<SINGLE_INDIRECT_BLOCK_COUNT; i++){
-                free_dblock(single_indirect_buff[i]);
-                single_indirect_buff[i] = 0;
-            }
-            for(ssize_t i=double_indirect_offset+1; i<SINGLE_INDIRECT_BLOCK_COUNT; i++){
-                remove_single_indirect(double_indirect_buff[i]);
-                double_indirect_buff[i] = 0;
-            }
-            free_memory(double_indirect_buff);
-            free_memory(single_indirect_buff);
-        }
-        ssize_t triple_indirect_total = curr_blocks - DIRECT_B_COUNT - SINGLE_INDIRECT_BLOCK_COUNT - DOUBLE_INDIRECT_BLOCK_COUNT;
-        ssize_t double_blocks_to_free = SINGLE_INDIRECT_BLOCK_COUNT - triple_indirect_offset;
-        if(triple_indirect_total < double_blocks_to_free){
-            double_blocks_to_free = triple_indirect_total - triple_indirect_offset;
-        }
-        for(ssize_t i=triple_indirect_offset+1; i<triple_indirect_offset+double_blocks_to_free; i++){
-            remove_double_indirect(triple_indirect_buff[i]);
-            triple_indirect_buff[i] = 0;
-        }
-        free_memory(triple_indirect_buff);
+        set_cache(&dir_space_cache, key, space);
     }
-    return true;
+    pthread_mutex_unlock(&dir_space_lock);
 }
 
-ssize_t get_inode_num_from_path(const char* const path){
-    ssize_t path_len = strlen(path);
-    if(path_len==1 && path[0]=='/'){
-        return ROOT_INODE;
+// records the free space of a directory block that was just read or written, inline blocks have no dblock
+static void note_dir_space(ssize_t dblock_num, const char* dblock){
+    if(dblock_num>0){
+        set_dir_space(dblock_num, largest_free_record(dblock));
+    }
+}
+
+// free space of a directory block, read from the block only when the map has no entry for it
+static ssize_t dir_block_space(const struct iNode* const inode, ssize_t fblock_num){
+    ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+    if(dblock_num<=0){
+        return 0;
     }
-    // check if present in cache
-    ssize_t cached_inode_num = get_cache(&iname_cache, path);
-    if(cached_inode_num>0){
-        return cached_inode_num;
+    char key[24];
+    sprintf(key, "%ld", dblock_num);
+    pthread_mutex_lock(&dir_space_lock);
+    ssize_t space = get_cache(&dir_space_cache, key);
+    pthread_mutex_unlock(&dir_space_lock);
+    if(space!=-1){
+        return space;
     }
-    // otherwise compute using recursive validation
-    // get parent path
-    char parent_path[path_len+1];
-    if(!get_parent_path(parent_path, path, path_len)){
-        return -1;
+    char* dblock = read_dblock(dblock_num);
+    if(dblock==NULL){
+        return 0;
     }
-    ssize_t parent_inode_num = get_inode_num_from_path(parent_path);
-    if(parent_inode_num==-1){
+    space = largest_free_record(dblock);
+    free_memory(dblock);
+    set_dir_space(dblock_num, space);
+    return space;
+}
+
+// adds a block at the end of a directory, returns its fblock number or -1
+static ssize_t append_dir_block(struct iNode* inode, char* dblock){
+    ssize_t dblock_num = create_new_dblock_for_inode(inode);
+    if(dblock_num<=0){
         return -1;
     }
-    struct iNode* inode = read_inode(parent_inode_num);
-    char child_name[path_len+1];
-    if(!get_child_name(child_name, path, path_len)){
-        free_memory(inode);
+    if(!write_dblock(dblock_num, dblock)){
+        printf("Could be a bug, check this\n");
         return -1;
     }
-    // find the file
-    struct file_pos_in_dir file = find_file(child_name, inode);
-    if(file.start_pos==-1){
-        free_memory(inode);
+    if(!add_dblock_to_inode(inode, dblock_num)){
+        printf("couldn't add dblock to inode\n");
         return -1;
     }
-    ssize_t inode_num = ((ssize_t*) (file.dblock + file.start_pos))[0];
-    free_memory(file.dblock);
-    free_memory(inode);
-    set_cache(&iname_cache, path, inode_num);
-    return inode_num;
+    note_dir_space(dblock_num, dblock);
+    inode->file_size += BLOCK_SIZE;
+    return inode->num_blocks-1;
 }
 
-ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode){
-    // getting parent path
-    ssize_t path_len = strlen(path);
-    char parent_path[path_len+1];
-    if(!get_parent_path(parent_path, path, path_len)){
-        // no parent path
-        printf("No parent path exists\n");
-        return -ENOENT;
-    }
-    ssize_t parent_inode_num = get_inode_num_from_path(parent_path);
-    if(parent_inode_num==-1){
-        printf("Invalid parent path : %s\n", parent_path);
-        return -ENOENT;
+// an index block on the way from the root to a leaf
+struct dx_frame{
+    ssize_t dblock_num;
+    char* dblock;
+    struct dx_header* header;
+    struct dx_entry* at; // entry the lookup followed
+};
+
+static struct dx_header* dx_header_of(char* dblock, ssize_t fblock_num){
+    return (struct dx_header*) (dblock + (fblock_num==0 ? DX_ROOT_OFFSET : DX_NODE_OFFSET));
+}
+
+static struct dx_entry* dx_entries(struct dx_header* header){
+    return (struct dx_entry*) (header+1);
+}
+
+static uint32_t dx_limit(ssize_t fblock_num){
+    ssize_t offset = fblock_num==0 ? DX_ROOT_OFFSET : DX_NODE_OFFSET;
+    return (BLOCK_SIZE - offset - sizeof(struct dx_header)) / sizeof(struct dx_entry);
+}
+
+// a new index block holding count entries
+static void init_dx_node(char* dblock, const struct dx_entry* entries, ssize_t count){
+    memset(dblock, 0, BLOCK_SIZE);
+    write_dir_entry(dblock, 0, 0, BLOCK_SIZE, DIR_TYPE_UNKNOWN, "", 0);
+    struct dx_header* header = dx_header_of(dblock, 1);
+    header->count = count;
+    header->limit = dx_limit(1);
+    memcpy(dx_entries(header), entries, count * sizeof(struct dx_entry));
+}
+
+static void dx_release(struct dx_frame* frames, ssize_t levels){
+    for(ssize_t level=0; level<levels; level++){
+        free_memory(frames[level].dblock);
     }
-    ssize_t child_inode_num = get_inode_num_from_path(path);
+}
+
+// walks the index down to the leaf for hash, frames gets one entry per level read and levels their count
+static ssize_t dx_probe(const struct iNode* const inode, uint32_t hash, struct dx_frame* frames, ssize_t* levels){
+    *levels = 0;
+    ssize_t fblock_num = 0;
+    ssize_t root_levels = 1;
+    for(ssize_t level=0; level<root_levels; level++){
+        struct dx_frame* frame = &frames[level];
+        frame->dblock = read_dir_block(inode, fblock_num, &frame->dblock_num);
+        if(frame->dblock==NULL){
+            return -1;
+        }
+        (*levels)++;
+        frame->header = dx_header_of(frame->dblock, fblock_num);
+        if(level==0){
+            root_levels = frame->header->levels;
+            if(root_levels<1 || root_levels>DX_MAX_LEVELS){
+                printf("Broken directory index with %ld levels\n", root_levels);
+                return -1;
+            }
+        }
+        if(frame->header->count==0 || frame->header->count>frame->header->limit){
+            printf("Broken directory index block %ld\n", fblock_num);
+            return -1;
+        }
+        // the last entry whose hash is not above the one looked for
+        struct dx_entry* entries = dx_entries(frame->header);
+        ssize_t low = 1;
+        ssize_t high = frame->header->count-1;
+        ssize_t found = 0;
+        while(low<=high){
+            ssize_t mid = (low+high)/2;
+            if(entries[mid].hash<=hash){
+                found = mid;
+                low = mid+1;
+            }
+            else{
+                high = mid-1;
+            }
+        }
+        frame->at = &entries[found];
+        fblock_num = frame->at->fblock_num;
+    }
+    return fblock_num;
+}
+
+// adds an index entry right after the one the frame followed, the block has to have room
+static bool dx_insert(struct iNode* inode, struct dx_frame* frame, uint32_t hash, ssize_t fblock_num){
+    struct dx_entry* entries = dx_entries(frame->header);
+    ssize_t index = frame->at - entries + 1;
+    memmove(&entries[index+1], &entries[index], (frame->header->count - index) * sizeof(struct dx_entry));
+    entries[index].hash = hash;
+    entries[index].fblock_num = fblock_num;
+    frame->header->count++;
+    return write_dir_block(inode, frame->dblock_num, frame->dblock);
+}
+
+// moves the upper half of the hashes of a full leaf to a new leaf
+static bool dx_split_leaf(struct iNode* inode, struct dx_frame* parent, ssize_t leaf_dblock_num, char* leaf){
+    struct dir_record* records = NULL;
+    ssize_t count = 0;
+    ssize_t capacity = 0;
+    for(ssize_t pos=0; pos<BLOCK_SIZE; pos+=dir_entry_rec_len(leaf, pos)){
+        if(dir_entry_rec_len(leaf, pos)<=0){
+            free_memory(records);
+            return false;
+        }
+        if(dir_entry_inum(leaf, pos)!=0 && !append_dir_record(&records, &count, &capacity, leaf, pos)){
+            free_memory(records);
+            return false;
+        }
+    }
+    qsort(records, count, sizeof(struct dir_record), compare_dir_records);
+    // names with the same hash have to stay in one leaf
+    ssize_t split = count/2;
+    while(split<count && split>0 && records[split].hash==records[split-1].hash){
+        split++;
+    }
+    if(split==count){
+        split = count/2;
+        while(split>0 && records[split].hash==records[split-1].hash){
+            split--;
+        }
+    }
+    if(split==0){
+        printf("Too many names with the same hash in one directory block\n");
+        free_memory(records);
+        return false;
+    }
+    char new_leaf[BLOCK_SIZE];
+    pack_dir_records(new_leaf, records, split, count);
+    pack_dir_records(leaf, records, 0, split);
+    ssize_t new_fblock_num = append_dir_block(inode, new_leaf);
+    bool status = new_fblock_num!=-1 && dx_insert(inode, parent, records[split].hash, new_fblock_num) &&
+                  write_dir_block(inode, leaf_dblock_num, leaf);
+    free_memory(records);
+    return status;
+}
+
+// a full root moves its entries to a new index block and points at it, adding a level
+static bool dx_grow_root(struct iNode* inode, struct dx_frame* root){
+    char node[BLOCK_SIZE];
+    init_dx_node(node, dx_entries(root->header), root->header->count);
+    ssize_t node_fblock_num = append_dir_block(inode, node);
+    if(node_fblock_num==-1){
+        return false;
+    }
+    root->header->levels++;
+    root->header->count = 1;
+    dx_entries(root->header)[0].hash = 0;
+    dx_entries(root->header)[0].fblock_num = node_fblock_num;
+    return write_dir_block(inode, root->dblock_num, root->dblock);
+}
+
+// moves the upper half of a full index block to a new one, the root gets an entry for it
+static bool dx_split_node(struct iNode* inode, struct dx_frame* root, struct dx_frame* node){
+    ssize_t half = node->header->count/2;
+    char new_node[BLOCK_SIZE];
+    struct dx_entry* entries = dx_entries(node->header);
+    init_dx_node(new_node, &entries[half], node->header->count-half);
+    node->header->count = half;
+    ssize_t new_fblock_num = append_dir_block(inode, new_node);
+    return new_fblock_num!=-1 && dx_insert(inode, root, entries[half].hash, new_fblock_num) &&
+           write_dir_block(inode, node->dblock_num, node->dblock);
+}
+
+// splits the leaf the lookup ended in, or the index block above it when that has no room for one more leaf
+static bool dx_make_room(struct iNode* inode, struct dx_frame* frames, ssize_t levels, ssize_t leaf_dblock_num, char* leaf){
+    struct dx_frame* parent = &frames[levels-1];
+    if(parent->header->count < parent->header->limit){
+        return dx_split_leaf(inode, parent, leaf_dblock_num, leaf);
+    }
+    if(levels < DX_MAX_LEVELS){
+        return dx_grow_root(inode, &frames[0]);
+    }
+    if(frames[0].header->count == frames[0].header->limit){
+        printf("Directory index is full\n");
+        return false;
+    }
+    return dx_split_node(inode, &frames[0], parent);
+}
+
+// finds the index entry pointing at fblock_num, frame->at is set to it. The block is a leaf when the entry
+// is in the lowest index level, levels gets the number of index levels
+static bool dx_find_ref(const struct iNode* const inode, ssize_t fblock_num, struct dx_frame* frame, bool* leaf,
+                        ssize_t* levels){
+    struct dx_frame root;
+    root.dblock = read_dir_block(inode, 0, &root.dblock_num);
+    if(root.dblock==NULL){
+        return false;
+    }
+    root.header = dx_header_of(root.dblock, 0);
+    *levels = root.header->levels;
+    struct dx_entry* entries = dx_entries(root.header);
+    for(ssize_t i=0; i<root.header->count; i++){
+        if(entries[i].fblock_num==fblock_num){
+            root.at = &entries[i];
+            *frame = root;
+            *leaf = *levels==1;
+            return true;
+        }
+    }
+    // with two levels the leaves hang off the index blocks, there are few of them
+    for(ssize_t i=0; i<root.header->count && root.header->levels==DX_MAX_LEVELS; i++){
+        struct dx_frame node;
+        node.dblock = read_dir_block(inode, entries[i].fblock_num, &node.dblock_num);
+        if(node.dblock==NULL){
+            break;
+        }
+        node.header = dx_header_of(node.dblock, entries[i].fblock_num);
+        struct dx_entry* node_entries = dx_entries(node.header);
+        for(ssize_t j=0; j<node.header->count; j++){
+            if(node_entries[j].fblock_num==fblock_num){
+                node.at = &node_entries[j];
+                *frame = node;
+                *leaf = true;
+                free_memory(root.dblock);
+                return true;
+            }
+        }
+        free_memory(node.dblock);
+    }
+    free_memory(root.dblock);
+    return false;
+}
+
+// frees a directory block nothing refers to any more, the last block moves into its place
+static bool release_dir_fblock(struct iNode* inode, ssize_t fblock_num){
+    ssize_t last_fblock_num = inode->num_blocks-1;
+    ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+    ssize_t last_dblock_num = fblock_num_to_dblock_num(inode, last_fblock_num);
+    if(dblock_num<=0 || last_dblock_num<=0){
+        return false;
+    }
+    if(fblock_num!=last_fblock_num){
+        struct dx_frame frame;
+        bool leaf;
+        ssize_t levels;
+        if(inode->is_indexed){
+            if(!dx_find_ref(inode, last_fblock_num, &frame, &leaf, &levels)){
+                return false;
+            }
+            frame.at->fblock_num = fblock_num;
+            bool status = write_dblock(frame.dblock_num, frame.dblock);
+            free_memory(frame.dblock);
+            if(!status){
+                return false;
+            }
+        }
+        if(!write_dblock_to_inode(inode, fblock_num, last_dblock_num)){
+            return false;
+        }
+    }
+    // the entry past the new end has to be cleared
+    if(!write_dblock_to_inode(inode, last_fblock_num, 0)){
+        return false;
+    }
+    inode->num_blocks--;
+    inode->alloc_blocks--;
+    inode->file_size -= BLOCK_SIZE;
+    set_dir_space(dblock_num, -1);
+    return free_dblock(dblock_num);
+}
+
+// unhooks an emptied leaf from the index and frees it, its hash range goes to a neighbour.
+// Returns the blocks freed, a block that is no leaf or the only one below its index block is kept
+static ssize_t dx_free_leaf(struct iNode* inode, ssize_t leaf_fblock_num){
+    struct dx_frame parent;
+    bool leaf;
+    ssize_t levels;
+    if(!dx_find_ref(inode, leaf_fblock_num, &parent, &leaf, &levels)){
+        return -1;
+    }
+    if(!leaf || parent.header->count==1){
+        free_memory(parent.dblock);
+        return 0;
+    }
+    struct dx_entry* entries = dx_entries(parent.header);
+    ssize_t index = parent.at - entries;
+    if(index==0){
+        // the next leaf takes over from the lowest hash of the block
+        entries[1].hash = entries[0].hash;
+    }
+    memmove(&entries[index], &entries[index+1], (parent.header->count - index - 1) * sizeof(struct dx_entry));
+    parent.header->count--;
+    bool status = write_dblock(parent.dblock_num, parent.dblock);
+    free_memory(parent.dblock);
+    if(!status || !release_dir_fblock(inode, leaf_fblock_num)){
+        return -1;
+    }
+    return 1;
+}
+
+// live entries of a directory in block order, "." and ".." come first
+static bool collect_dir_records(const struct iNode* const inode, struct dir_record** records, ssize_t* count){
+    ssize_t capacity = 0;
+    *records = NULL;
+    *count = 0;
+    for(ssize_t fblock_num=0; fblock_num<dir_block_count(inode); fblock_num++){
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, fblock_num, &dblock_num);
+        if(dblock==NULL){
+            return false;
+        }
+        for(ssize_t pos=0; pos<BLOCK_SIZE; pos+=dir_entry_rec_len(dblock, pos)){
+            if(dir_entry_rec_len(dblock, pos)<=0 ||
+               (dir_entry_inum(dblock, pos)!=0 && !append_dir_record(records, count, &capacity, dblock, pos))){
+                free_memory(dblock);
+                return false;
+            }
+        }
+        free_memory(dblock);
+    }
+    return true;
+}
+
+// end of the records that fill the linear block starting with records[from]
+static ssize_t linear_block_end(const struct dir_record* records, ssize_t from, ssize_t count){
+    ssize_t used = 0;
+    ssize_t to = from;
+    while(to<count && used+DIR_ENTRY_SIZE(records[to].name_length)<=BLOCK_SIZE){
+        used += DIR_ENTRY_SIZE(records[to].name_length);
+        to++;
+    }
+    return to;
+}
+
+// lays the records out densely in the first blocks of the directory and frees the rest, any index is dropped
+static bool rewrite_linear_dir(struct iNode* inode, const struct dir_record* records, ssize_t count){
+    ssize_t fblock_num = 0;
+    for(ssize_t from=0; from<count; fblock_num++){
+        ssize_t to = linear_block_end(records, from, count);
+        ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+        char dblock[BLOCK_SIZE];
+        pack_dir_records(dblock, records, from, to);
+        if(dblock_num<=0 || !write_dblock(dblock_num, dblock)){
+            return false;
+        }
+        note_dir_space(dblock_num, dblock);
+        from = to;
+    }
+    for(ssize_t i=fblock_num; i<inode->num_blocks; i++){
+        set_dir_space(fblock_num_to_dblock_num(inode, i), -1);
+    }
+    if(fblock_num<inode->num_blocks && !remove_dblocks_from_inode(inode, fblock_num)){
+        return false;
+    }
+    inode->is_indexed = false;
+    inode->file_size = inode->num_blocks * BLOCK_SIZE;
+    return true;
+}
+
+/*
+Shrinks a directory after deletes. Emptied leaves of an index are freed, and the entries are
+packed into fewer linear blocks when that saves a block, an index is dropped once its entries
+fit in less than DIR_INDEX_THRESHOLD blocks. Returns the blocks freed or -1.
+*/
+static ssize_t compact_dir(struct iNode* inode){
+    if(inode->is_inline){
+        return 0;
+    }
+    ssize_t num_blocks = inode->num_blocks;
+    // from the end down, a freed block takes the last one which has been looked at already
+    for(ssize_t fblock_num=inode->num_blocks-1; fblock_num>0 && inode->is_indexed; fblock_num--){
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, fblock_num, &dblock_num);
+        if(dblock==NULL){
+            return -1;
+        }
+        bool empty = dir_entry_inum(dblock, 0)==0 && dir_entry_rec_len(dblock, 0)==BLOCK_SIZE;
+        free_memory(dblock);
+        if(empty && dx_free_leaf(inode, fblock_num)==-1){
+            return -1;
+        }
+    }
+    // the entries of a big index are not gathered, they would not fit a linear directory anyway
+    if(inode->is_indexed && inode->num_blocks>2*DIR_INDEX_THRESHOLD){
+        return num_blocks - inode->num_blocks;
+    }
+    struct dir_record* records;
+    ssize_t count;
+    if(!collect_dir_records(inode, &records, &count)){
+        free_memory(records);
+        return -1;
+    }
+    ssize_t needed = 0;
+    for(ssize_t from=0; from<count; needed++){
+        from = linear_block_end(records, from, count);
+    }
+    bool status = true;
+    if(inode->is_indexed ? needed<DIR_INDEX_THRESHOLD : needed<inode->num_blocks){
+        status = rewrite_linear_dir(inode, records, count);
+    }
+    free_memory(records);
+    return status ? num_blocks - inode->num_blocks : -1;
+}
+
+
+static bool add_indexed_entry(struct iNode* inode, ssize_t child_inode_num, unsigned char type, const char* name,
+                              unsigned short name_length){
+    uint32_t hash = dir_hash(name, name_length);
+    // a pass either adds the entry or splits one block on its path, so a few passes are enough
+    for(ssize_t pass=0; pass<=DX_MAX_LEVELS+1; pass++){
+        struct dx_frame frames[DX_MAX_LEVELS];
+        ssize_t levels;
+        ssize_t leaf_fblock_num = dx_probe(inode, hash, frames, &levels);
+        bool status = leaf_fblock_num!=-1;
+        bool added = false;
+        if(status){
+            ssize_t leaf_dblock_num;
+            char* leaf = read_dir_block(inode, leaf_fblock_num, &leaf_dblock_num);
+            status = leaf!=NULL;
+            if(status && insert_entry_in_block(leaf, child_inode_num, type, name, name_length)){
+                added = true;
+                status = write_dir_block(inode, leaf_dblock_num, leaf);
+            }
+            else if(status){
+                status = dx_make_room(inode, frames, levels, leaf_dblock_num, leaf);
+            }
+            free_memory(leaf);
+        }
+        dx_release(frames, levels);
+        if(!status || added){
+            return status;
+        }
+    }
+    printf("Could not make room for %s in the directory index\n", name);
+    return false;
+}
+
+/*
+Gives a linear directory a hashed index. Block 0 is cut down to "." and ".." with the
+root after them and every other entry is added again through the index.
+*/
+static bool convert_to_indexed(struct iNode* inode){
+    struct dir_record* records = NULL;
+    ssize_t count = 0;
+    ssize_t capacity = 0;
+    ssize_t self_inum = 0;
+    ssize_t parent_inum = 0;
+    bool status = true;
+    for(ssize_t fblock_num=0; fblock_num<inode->num_blocks && status; fblock_num++){
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, fblock_num, &dblock_num);
+        if(dblock==NULL){
+            status = false;
+            break;
+        }
+        for(ssize_t pos=0; pos<BLOCK_SIZE && status; pos+=dir_entry_rec_len(dblock, pos)){
+            if(dir_entry_rec_len(dblock, pos)<=0){
+                status = false;
+                break;
+            }
+            ssize_t inum = dir_entry_inum(dblock, pos);
+            unsigned short name_length = dir_entry_name_length(dblock, pos);
+            if(inum==0){
+                continue;
+            }
+            if(is_dot_entry(dir_entry_name(dblock, pos), name_length)){
+                *(name_length==1 ? &self_inum : &parent_inum) = inum;
+                continue;
+            }
+            status = append_dir_record(&records, &count, &capacity, dblock, pos);
+        }
+        free_memory(dblock);
+    }
+    ssize_t root_dblock_num = status ? fblock_num_to_dblock_num(inode, 0) : -1;
+    if(root_dblock_num<=0 || !remove_dblocks_from_inode(inode, 1)){
+        free_memory(records);
+        return false;
+    }
+    char root[BLOCK_SIZE];
+    memset(root, 0, BLOCK_SIZE);
+    write_dir_entry(root, 0, self_inum, DIR_ENTRY_SIZE(1), DIR_ENTRY_TYPE(S_IFDIR), ".", 1);
+    write_dir_entry(root, DIR_ENTRY_SIZE(1), parent_inum, BLOCK_SIZE-DIR_ENTRY_SIZE(1), DIR_ENTRY_TYPE(S_IFDIR), "..", 2);
+    struct dx_header* header = dx_header_of(root, 0);
+    header->levels = 1;
+    header->count = 1;
+    header->limit = dx_limit(0);
+    dx_entries(header)[0].hash = 0;
+    dx_entries(header)[0].fblock_num = 1;
+    char leaf[BLOCK_SIZE];
+    pack_dir_records(leaf, NULL, 0, 0);
+    inode->file_size = BLOCK_SIZE;
+    inode->is_indexed = true;
+    status = write_dblock(root_dblock_num, root) && append_dir_block(inode, leaf)==1;
+    for(ssize_t i=0; i<count && status; i++){
+        status = add_indexed_entry(inode, records[i].inum, records[i].type, records[i].name, records[i].name_length);
+    }
+    free_memory(records);
+    return status;
+}
+
+// TODO: VERIFY// Done
+struct file_pos_in_dir find_file(const char* const name, const struct iNode* const parent_inode){
+    /*
+    Each file entry in the directory is a struct dir_entry header followed by the name,
+    see file_layer.h. Only the FILE_NAME size is variable based on len.
+    */
+    struct file_pos_in_dir file;
+    /*
+    This data structure is what is returned.
+    It will hold the datablock containing the file_record, corresponding dBlock_num, fblock_num,
+    pointer to the inode_num for the file (1st field of record) and a pointer to the record
+    previous to the file to be found. This is sent for the sake of manipulation wrt to records during deletion.
+    */
+    // if the file is found, the pointer to the inode is present in file.start_pos
+    // file.prev_entry holds the starting point of the preceding entry the file entry in question.
+    file.prev_entry = -1;
+    file.dblock = NULL;
+    //if not a directory, return
+    // printf("Inside find_file(), checking is this a dir\n");
+    // printf("%ld\n",S_ISDIR(parent_inode->mode));
+    if(!S_ISDIR(parent_inode->mode)){
+        file.start_pos = -1;
+        return file;
+    }
+    // TODO : Check if name is in bounds, else return garbage
+    ssize_t name_length = strlen(name);
+    uint32_t hash = dir_hash(name, name_length);
+    ssize_t first_block = 0;
+    ssize_t end_block = dir_block_count(parent_inode);
+    if(parent_inode->is_indexed && !is_dot_entry(name, name_length)){
+        // only the leaf for the hash of the name can hold it, "." and ".." stay in block 0
+        struct dx_frame frames[DX_MAX_LEVELS];
+        ssize_t levels;
+        first_block = dx_probe(parent_inode, hash, frames, &levels);
+        dx_release(frames, levels);
+        end_block = first_block+1;
+        if(first_block==-1){
+            file.start_pos = -1;
+            return file;
+        }
+    }
+    // traverse through the datablocks in parent directory to find the entry for the file.
+    for(ssize_t i=first_block; i<end_block; i++){
+        file.fblock_num = i;
+        // dblock_num is 0 for an inline directory
+        file.dblock = read_dir_block(parent_inode, i, &file.dblock_num);
+        if(file.dblock==NULL){
+            file.start_pos = -1;
+            printf("file.dblock_num<=0\n");
+            return file;
+        }
+        // prev_entry holds the record before the match, -1 when it is the first one of the block
+        file.start_pos = find_in_block(file.dblock, name, name_length, hash, &file.prev_entry);
+        if(file.start_pos>=0){
+            return file;
+        }
+        free_memory(file.dblock);
+        file.dblock = NULL;
+        if(file.start_pos==-2){
+            break;
+        }
+    }
+    //record not found
+    file.start_pos = -1; // -1 is set to start_pos when the record is not found.
+    file.prev_entry = -1;
+    return file;
+}
+
+ssize_t create_new_dblock_for_inode(struct iNode* inode){
+    ssize_t dblock_num = create_new_dblock_near(inode->alloc_goal);
+    if(dblock_num>0){
+        inode->alloc_goal = dblock_num + 1;
+        inode->alloc_blocks++;
+    }
+    return dblock_num;
+}
+
+// allocates a dblock for block addresses, it has to start out zeroed as freed blocks are not cleared
+ssize_t create_new_indirect_dblock(struct iNode* inode){
+    ssize_t dblock_num = create_new_dblock_for_inode(inode);
+    if(dblock_num==-1){
+        return -1;
+    }
+    char buff[BLOCK_SIZE];
+    memset(buff, 0, BLOCK_SIZE);
+    if(!write_dblock(dblock_num, buff)){
+        return -1;
+    }
+    return dblock_num;
+}
+
+bool add_dblock_to_inode(struct iNode* inode, const ssize_t dblock_num){
+    // the new block goes right after the last one, entries past num_blocks are always 0
+    // so a hole needs no change of the block map
+    inode->num_blocks++;
+    if(dblock_num!=0 && !write_dblock_to_inode(inode, inode->num_blocks-1, dblock_num)){
+        inode->num_blocks--;
+        return false;
+    }
+    return true;
+}
+
+void steer_goal_to_run(struct iNode* inode, ssize_t first_fblock, ssize_t end_fblock){
+    if(first_fblock < inode->num_blocks){
+        first_fblock = inode->num_blocks;
+    }
+    ssize_t count = end_fblock - first_fblock;
+    if(count < 2){
+        return;
+    }
+    // room for the indirect blocks that get allocated in between the data
+    if(end_fblock > DIRECT_B_COUNT){
+        count += count / SINGLE_INDIRECT_BLOCK_COUNT + 1;
+    }
+    ssize_t run_start = find_dblock_run(inode->alloc_goal, count);
+    if(run_start!=-1){
+        inode->alloc_goal = run_start;
+    }
+}
+
+void extend_with_holes(struct iNode* inode, ssize_t num_blocks){
+    if(inode->num_blocks < num_blocks){
+        inode->num_blocks = num_blocks;
+    }
+}
+
+bool remove_dblocks_from_inode(struct iNode* inode, ssize_t fblock_num){
+    // remove blocks from fblock_num to num_blocks from inode
+    if(fblock_num >= inode->num_blocks){
+        printf("Can't remove block that doesn't exist");
+        return false;
+    }
+    inode->num_blocks = fblock_num;
+    // the removed blocks are gathered and released in a single batch
+    struct dblock_list freed = {NULL, 0, 0};
+    bool status = true;
+    // remove direct blocks
+    for(ssize_t i=fblock_num; i<DIRECT_B_COUNT && status; i++){
+        if(inode->direct_blocks[i]!=0){
+            status = append_dblock(&freed, DBLOCK_NUM(inode->direct_blocks[i]));
+            inode->direct_blocks[i] = 0;
+        }
+    }
+    // remove single, double and triple indirect blocks, partially kept ones are written back
+    ssize_t* indirect_blocks[3] = {&inode->single_indirect, &inode->double_indirect, &inode->triple_indirect};
+    ssize_t start = DIRECT_B_COUNT;
+    ssize_t span = SINGLE_INDIRECT_BLOCK_COUNT;
+    for(ssize_t depth=1; depth<=3 && status; depth++){
+        if(*indirect_blocks[depth-1]!=0 && fblock_num < start+span){
+            ssize_t from = fblock_num > start ? fblock_num-start : 0;
+            status = release_indirect(*indirect_blocks[depth-1], depth, from, &freed);
+            if(from==0){
+                *indirect_blocks[depth-1] = 0;
+            }
+        }
+        start += span;
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    if(status){
+        status = free_dblocks(freed.dblock_nums, freed.count);
+        inode->alloc_blocks -= freed.count;
+    }
+    free_memory(freed.dblock_nums);
+    return status;
+}
+
+// only paths without "." or ".." get cached, so every cached entry has exactly one path to drop it by
+static bool is_canonical_path(const char* path, ssize_t path_len){
+    ssize_t start = 0;
+    while(start<path_len){
+        while(start<path_len && path[start]=='/'){
+            start++;
+        }
+        ssize_t end = start;
+        while(end<path_len && path[end]!='/'){
+            end++;
+        }
+        if((end-start==1 && path[start]=='.') || (end-start==2 && path[start]=='.' && path[start+1]=='.')){
+            return false;
+        }
+        start = end;
+    }
+    return true;
+}
+
+ssize_t lookup_dentry(const char* path){
+    ssize_t matched;
+    pthread_mutex_lock(&dentry_lock);
+    ssize_t inode_num = get_path_cache(&dentry_cache, path, &matched);
+    pthread_mutex_unlock(&dentry_lock);
+    // only a match of the whole path counts, trailing slashes aside
+    ssize_t path_len = strlen(path);
+    while(matched<path_len && path[matched]=='/'){
+        matched++;
+    }
+    return matched==path_len ? inode_num : -1;
+}
+
+void cache_dentry(const char* path, ssize_t path_len, ssize_t inode_num){
+    if(!is_canonical_path(path, path_len)){
+        return;
+    }
+    pthread_mutex_lock(&dentry_lock);
+    set_path_cache(&dentry_cache, path, path_len, inode_num);
+    pthread_mutex_unlock(&dentry_lock);
+}
+
+static ssize_t dir_generation(ssize_t dir_inum){
+    pthread_mutex_lock(&dentry_lock);
+    ssize_t generation = dir_generations[dir_inum % INODE_LOCK_COUNT];
+    pthread_mutex_unlock(&dentry_lock);
+    return generation;
+}
+
+// to be called after the entries of the directory changed on disk and before the names are cached or dropped
+static void dir_entries_changed(ssize_t dir_inum){
+    pthread_mutex_lock(&dentry_lock);
+    dir_generations[dir_inum % INODE_LOCK_COUNT]++;
+    pthread_mutex_unlock(&dentry_lock);
+}
+
+// caches what a lookup in dir_inum found, unless the directory changed since the lookup started
+static void cache_lookup(const char* path, ssize_t path_len, ssize_t inode_num, ssize_t dir_inum, ssize_t generation){
+    if(!is_canonical_path(path, path_len)){
+        return;
+    }
+    pthread_mutex_lock(&dentry_lock);
+    if(dir_generations[dir_inum % INODE_LOCK_COUNT]==generation){
+        set_path_cache(&dentry_cache, path, path_len, inode_num);
+    }
+    pthread_mutex_unlock(&dentry_lock);
+}
+
+void drop_dentry(const char* path){
+    pthread_mutex_lock(&dentry_lock);
+    // a path with "." or ".." can't say which cached path it is, so everything goes
+    pop_path_cache(&dentry_cache, is_canonical_path(path, strlen(path)) ? path : "/");
+    pthread_mutex_unlock(&dentry_lock);
+}
+
+ssize_t get_inode_num_from_path(const char* const path){
+    ssize_t path_len = strlen(path);
+    if(path_len==0 || path[0]!='/'){
+        return -1;
+    }
+    // the longest cached prefix of the path is found in one walk down the dentry cache,
+    // the rest is looked up one component at a time in the directories
+    ssize_t start;
+    pthread_mutex_lock(&dentry_lock);
+    ssize_t inode_num = get_path_cache(&dentry_cache, path, &start);
+    pthread_mutex_unlock(&dentry_lock);
+    if(inode_num==NEGATIVE_DENTRY){
+        // looked up before and not there
+        return -1;
+    }
+    if(inode_num==-1){
+        inode_num = ROOT_INODE;
+    }
+    char name[MAX_NAME_LENGTH+1];
+    while(start<path_len){
+        while(start<path_len && path[start]=='/'){
+            start++;
+        }
+        ssize_t end = start;
+        while(end<path_len && path[end]!='/'){
+            end++;
+        }
+        if(end==start){
+            break;
+        }
+        if(end-start > MAX_NAME_LENGTH){
+            return -1;
+        }
+        memcpy(name, path+start, end-start);
+        name[end-start] = '\0';
+        start = end;
+        // taken before the directory is read, a name created or removed meanwhile isn't cached stale
+        ssize_t generation = dir_generation(inode_num);
+        struct iNode* inode = read_inode(inode_num);
+        if(inode==NULL){
+            return -1;
+        }
+        struct file_pos_in_dir file = find_file(name, inode);
+        bool is_dir = S_ISDIR(inode->mode);
+        free_memory(inode);
+        if(file.start_pos==-1){
+            // a miss is remembered, only names looked up in a directory can get created later
+            if(is_dir){
+                cache_lookup(path, end, NEGATIVE_DENTRY, inode_num, generation);
+            }
+            return -1;
+        }
+        ssize_t dir_inum = inode_num;
+        inode_num = dir_entry_inum(file.dblock, file.start_pos);
+        free_memory(file.dblock);
+        cache_lookup(path, end, inode_num, dir_inum, generation);
+    }
+    return inode_num;
+}
+
+ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode){
+    // getting parent path
+    ssize_t path_len = strlen(path);
+    char parent_path[path_len+1];
+    if(!get_parent_path(parent_path, path, path_len)){
+        // no parent path
+        printf("No parent path exists\n");
+        return -ENOENT;
+    }
+    ssize_t parent_inode_num = get_inode_num_from_path(parent_path);
+    if(parent_inode_num==-1){
+        printf("Invalid parent path : %s\n", parent_path);
+        return -ENOENT;
+    }
+    ssize_t child_inode_num = get_inode_num_from_path(path);
     if(child_inode_num!=-1){
         // file already exists
         printf("File already exists\n");
@@ -599,18 +1341,23 @@ ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode
     if(!get_child_name(child_name, path, path_len)){
         return -1;
     }
-    // create new inode
-    child_inode_num = create_new_inode();
+    // create new inode, files stay in the group of their directory and
+    // directories go to the group with the most room to spread the tree out
+    ssize_t group = S_ISDIR(mode) ? least_used_group() : inode_group(parent_inode_num);
+    child_inode_num = create_new_inode_in_group(group);
     if(child_inode_num==-1){
         free_memory(parent_inode);
         return -EDQUOT;
     }
-    if(!add_new_entry(parent_inode, child_inode_num, child_name)){
+    if(!add_new_entry(parent_inode, child_inode_num, child_name, mode)){
         free_inode(child_inode_num);
         free_memory(parent_inode);
         return -EDQUOT;
     }
-    time_t curr_time = time(NULL);
+    // replaces the negative entry left by the lookup above
+    dir_entries_changed(parent_inode_num);
+    cache_dentry(path, path_len, child_inode_num);
+    struct timespec curr_time = current_time();
     parent_inode->modification_time = curr_time;
     parent_inode->status_change_time = curr_time;
     // TODO: Check this
@@ -620,10 +1367,15 @@ ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode
         return -1;
     }
     *buff = read_inode(child_inode_num);
+    (*buff)->allocated = true;
     (*buff)->link_count++;
     (*buff)->mode = mode;
     (*buff)->num_blocks = 0;
     (*buff)->file_size = 0;
+    // small files and directories keep their data in the inode until it outgrows inline_data
+    (*buff)->is_inline = S_ISREG(mode) || S_ISDIR(mode);
+    // data starts out in the block group of the inode
+    (*buff)->alloc_goal = group_first_dblock(inode_group(child_inode_num));
     (*buff)->access_time = curr_time;
     (*buff)->modification_time = curr_time;
     (*buff)->creation_time = curr_time;
@@ -635,21 +1387,220 @@ ssize_t create_new_file(const char* const path, struct iNode** buff, mode_t mode
 
 bool is_empty_dir(struct iNode* inode){
     printf("checking if dir is empty\n");
-    if(inode->num_blocks>1){
-        printf("No of dblocks %ld\n", inode->num_blocks);
+    // any entry besides "." and ".." counts, indexed directories keep their emptied leaves
+    for(ssize_t fblock_num=0; fblock_num<dir_block_count(inode); fblock_num++){
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, fblock_num, &dblock_num);
+        if(dblock==NULL){
+            return false;
+        }
+        for(ssize_t pos=0; pos<BLOCK_SIZE; pos+=dir_entry_rec_len(dblock, pos)){
+            if(dir_entry_rec_len(dblock, pos)<=0 ||
+               (dir_entry_inum(dblock, pos)!=0 && !is_dot_entry(dir_entry_name(dblock, pos), dir_entry_name_length(dblock, pos)))){
+                free_memory(dblock);
+                return false;
+            }
+        }
+        free_memory(dblock);
+    }
+    return true;
+}
+
+// a live entry of the directory blocks being listed
+struct listed_entry{
+    const char* dblock;
+    ssize_t pos;
+    ssize_t cookie; // a walk resumed with it starts at this entry
+};
+
+// "." and ".." first, then by hash and names with the same hash by name
+static int compare_listed_entries(const void* a, const void* b){
+    const struct listed_entry* entry_a = (const struct listed_entry*) a;
+    const struct listed_entry* entry_b = (const struct listed_entry*) b;
+    const char* name_a = dir_entry_name(entry_a->dblock, entry_a->pos);
+    const char* name_b = dir_entry_name(entry_b->dblock, entry_b->pos);
+    ssize_t length_a = dir_entry_name_length(entry_a->dblock, entry_a->pos);
+    ssize_t length_b = dir_entry_name_length(entry_b->dblock, entry_b->pos);
+    bool dot_a = is_dot_entry(name_a, length_a);
+    bool dot_b = is_dot_entry(name_b, length_b);
+    if(dot_a || dot_b){
+        return dot_a && dot_b ? (int) (length_a - length_b) : (dot_a ? -1 : 1);
+    }
+    uint32_t hash_a = dir_entry_hash(entry_a->dblock, entry_a->pos);
+    uint32_t hash_b = dir_entry_hash(entry_b->dblock, entry_b->pos);
+    if(hash_a!=hash_b){
+        return hash_a < hash_b ? -1 : 1;
+    }
+    int order = memcmp(name_a, name_b, length_a < length_b ? length_a : length_b);
+    return order!=0 ? order : (int) (length_a - length_b);
+}
+
+/*
+Live entries of the blocks in listing order, with their cookies. A cookie depends on the name alone and
+not on where the entry sits, so splits, conversion to an index and compaction leave it valid. Names with
+one hash are always in the same block group, their rank among each other is counted there.
+Returns the entries or NULL on a broken block or out of memory
+*/
+static struct listed_entry* list_dir_entries(char** dblocks, ssize_t block_count, ssize_t* count){
+    struct listed_entry* entries = (struct listed_entry*) malloc((block_count * (BLOCK_SIZE/DIR_ENTRY_SIZE(1)) + 1) *
+                                                                 sizeof(struct listed_entry));
+    if(entries==NULL){
+        return NULL;
+    }
+    *count = 0;
+    for(ssize_t i=0; i<block_count; i++){
+        for(ssize_t pos=0; pos<BLOCK_SIZE; pos+=dir_entry_rec_len(dblocks[i], pos)){
+            if(dir_entry_rec_len(dblocks[i], pos)<=0){
+                free_memory(entries);
+                return NULL;
+            }
+            // index nodes and emptied leaves of an indexed directory only hold an entry without inode
+            if(dir_entry_inum(dblocks[i], pos)!=0){
+                entries[*count].dblock = dblocks[i];
+                entries[(*count)++].pos = pos;
+            }
+        }
+    }
+    qsort(entries, *count, sizeof(struct listed_entry), compare_listed_entries);
+    ssize_t rank = 0;
+    for(ssize_t i=0; i<*count; i++){
+        const char* dblock = entries[i].dblock;
+        ssize_t name_length = dir_entry_name_length(dblock, entries[i].pos);
+        if(is_dot_entry(dir_entry_name(dblock, entries[i].pos), name_length)){
+            entries[i].cookie = name_length-1;
+            continue;
+        }
+        uint32_t hash = dir_entry_hash(dblock, entries[i].pos);
+        bool same_hash = i>0 && entries[i-1].cookie>=DIR_COOKIE_FIRST &&
+                         dir_entry_hash(entries[i-1].dblock, entries[i-1].pos)==hash;
+        rank = same_hash ? rank+1 : 0;
+        entries[i].cookie = DIR_COOKIE_FIRST + (((ssize_t) hash << DIR_COOKIE_RANK_BITS) | rank);
+    }
+    return entries;
+}
+
+// visits the entries of the blocks whose cookie is offset or above, stopped is set when the visitor stops the walk
+static bool visit_dir_blocks(char** dblocks, ssize_t block_count, ssize_t offset, bool load_inodes, dir_entry_visitor visit,
+                             void* arg, bool* stopped){
+    ssize_t count;
+    struct listed_entry* entries = list_dir_entries(dblocks, block_count, &count);
+    if(entries==NULL){
         return false;
     }
-    // should be the last entry if empty
-    struct file_pos_in_dir parent_ref = find_file("..", inode);
-    if(parent_ref.start_pos==-1){
-        printf("Did not find the location of .. for the dir to check if its empty\n");
+    ssize_t first = 0;
+    while(first<count && entries[first].cookie<offset){
+        first++;
+    }
+    ssize_t* inode_nums = (ssize_t*) malloc((count-first+1) * sizeof(ssize_t));
+    struct iNode** inodes = load_inodes ? (struct iNode**) malloc((count-first+1) * sizeof(struct iNode*)) : NULL;
+    bool status = inode_nums!=NULL && (!load_inodes || inodes!=NULL);
+    for(ssize_t i=first; i<count && status; i++){
+        inode_nums[i-first] = dir_entry_inum(entries[i].dblock, entries[i].pos);
+    }
+    if(status && first<count){
+        // the inodes sharing an inode block cost one read. A listing without them is commonly
+        // followed by a stat of each name, their inode blocks start loading now
+        if(load_inodes){
+            status = read_inodes(inode_nums, count-first, inodes);
+        }
+        else{
+            prefetch_inodes(inode_nums, count-first);
+        }
+    }
+    for(ssize_t i=first; i<count && status && !*stopped; i++){
+        const char* dblock = entries[i].dblock;
+        unsigned short name_length = dir_entry_name_length(dblock, entries[i].pos);
+        char name[name_length+1];
+        memcpy(name, dir_entry_name(dblock, entries[i].pos), name_length);
+        name[name_length] = '\0';
+        *stopped = !visit(name, inode_nums[i-first], dir_entry_type(dblock, entries[i].pos),
+                          load_inodes ? inodes[i-first] : NULL, entries[i].cookie+1, arg);
+    }
+    for(ssize_t i=first; i<count && load_inodes && status; i++){
+        free_memory(inodes[i-first]);
+    }
+    free_memory(inodes);
+    free_memory(inode_nums);
+    free_memory(entries);
+    return status;
+}
+
+// moves the frames on to the leaf after the one they lead to in hash order.
+// Returns its fblock number, 0 past the last leaf and -1 when an index block could not be read
+static ssize_t dx_next_leaf(const struct iNode* const inode, struct dx_frame* frames, ssize_t levels){
+    ssize_t level = levels-1;
+    // the lowest index block with an entry after the one followed
+    while(level>=0 && frames[level].at==&dx_entries(frames[level].header)[frames[level].header->count-1]){
+        level--;
+    }
+    if(level<0){
+        return 0;
+    }
+    frames[level].at++;
+    // and down its first entries to a leaf
+    for(; level<levels-1; level++){
+        ssize_t fblock_num = frames[level].at->fblock_num;
+        struct dx_frame* child = &frames[level+1];
+        free_memory(child->dblock);
+        child->dblock = read_dir_block(inode, fblock_num, &child->dblock_num);
+        if(child->dblock==NULL){
+            return -1;
+        }
+        child->header = dx_header_of(child->dblock, fblock_num);
+        child->at = dx_entries(child->header);
+    }
+    return frames[levels-1].at->fblock_num;
+}
+
+bool walk_dir_entries(const struct iNode* const inode, ssize_t offset, bool load_inodes, dir_entry_visitor visit, void* arg){
+    if(offset<0){
         return false;
     }
-    ssize_t next_entry = ((ssize_t*)(parent_ref.dblock+parent_ref.start_pos+INODE_SZ))[0];
-    return parent_ref.start_pos+next_entry == BLOCK_SIZE;
+    // a linear directory has a few blocks, they are listed together. An indexed one lists block 0 with
+    // "." and ".." first and then one leaf at a time in hash order, from the leaf of the cookie's hash on
+    ssize_t block_count = inode->is_indexed ? 1 : dir_block_count(inode);
+    char* dblocks[block_count+1];
+    bool status = true;
+    ssize_t read_count = 0;
+    for(; read_count<block_count && status; read_count++){
+        ssize_t dblock_num;
+        dblocks[read_count] = read_dir_block(inode, read_count, &dblock_num);
+        status = dblocks[read_count]!=NULL;
+    }
+    bool stopped = false;
+    status = status && visit_dir_blocks(dblocks, block_count, offset, load_inodes, visit, arg, &stopped);
+    for(ssize_t i=0; i<read_count; i++){
+        free_memory(dblocks[i]);
+    }
+    if(!status || stopped || !inode->is_indexed){
+        return status;
+    }
+    uint32_t hash = offset>=DIR_COOKIE_FIRST ? (uint32_t) ((offset-DIR_COOKIE_FIRST) >> DIR_COOKIE_RANK_BITS) : 0;
+    struct dx_frame frames[DX_MAX_LEVELS];
+    ssize_t levels;
+    ssize_t leaf_fblock_num = dx_probe(inode, hash, frames, &levels);
+    status = leaf_fblock_num!=-1;
+    while(status && !stopped && leaf_fblock_num>0){
+        ssize_t dblock_num;
+        char* leaf = read_dir_block(inode, leaf_fblock_num, &dblock_num);
+        status = leaf!=NULL && visit_dir_blocks(&leaf, 1, offset, load_inodes, visit, arg, &stopped);
+        free_memory(leaf);
+        if(status && !stopped){
+            leaf_fblock_num = dx_next_leaf(inode, frames, levels);
+            status = leaf_fblock_num!=-1;
+        }
+    }
+    dx_release(frames, levels);
+    return status;
 }
 
 bool custom_mkdir(const char* path, mode_t mode){
+    ssize_t path_len = strlen(path);
+    char parent_path[path_len+1];
+    if(!get_parent_path(parent_path, path, path_len)){
+        return false;
+    }
+    ssize_t parent_inode_num = get_inode_num_from_path(parent_path);
     struct iNode* child_inode = NULL;
     ssize_t child_inode_num = create_new_file(path, &child_inode, S_IFDIR|mode);
     printf("Inode Num : %ld assigned for the new dir : %s\n", child_inode_num, path);
@@ -658,12 +1609,13 @@ bool custom_mkdir(const char* path, mode_t mode){
         return false;
     }
     char* name = ".";
-    if(!add_new_entry(child_inode, child_inode_num, name)){
+    if(!add_new_entry(child_inode, child_inode_num, name, S_IFDIR)){
         free_memory(child_inode);
         return false;
     }
+    // ".." leads back to the parent, rename follows it to keep a directory out of its own subtree
     name = "..";
-    if(!add_new_entry(child_inode, child_inode_num, name)){
+    if(!add_new_entry(child_inode, parent_inode_num, name, S_IFDIR)){
         free_memory(child_inode);
         return false;
     }
@@ -697,39 +1649,190 @@ bool custom_mknod(const char* path, mode_t mode, dev_t dev){
     return true;
 }
 
-ssize_t custom_truncate(const char* path, size_t offset){
-    ssize_t inode_num = get_inode_num_from_path(path);
-    if(inode_num==-1){
-        return -1;
-    }
+static ssize_t truncate_locked(ssize_t inode_num, size_t offset){
     struct iNode* inode = read_inode(inode_num);
     if(offset>inode->file_size){
+        // growing only changes metadata, the new range is a hole
+        bool status = true;
+        if(inode->is_inline && offset > INLINE_DATA_SIZE){
+            status = move_inline_data_to_block(inode, NULL);
+        }
+        if(!inode->is_inline){
+            extend_with_holes(inode, (offset + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        inode->file_size = offset;
+        struct timespec curr_time = current_time();
+        inode->modification_time = curr_time;
+        inode->status_change_time = curr_time;
+        status = status && write_inode(inode_num, inode);
         free_memory(inode);
-        return -1;
+        return status ? 0 : -1;
+    }
+    if(offset==0 && inode->file_size==0 && inode->num_blocks==0){
+        free_memory(inode);
+        return 0;
     }
-    if(offset==0 && inode->file_size==0){
+    if(inode->is_inline){
+        // offset is within the file here, so it is within inline_data as well
+        memset(inode->inline_data+offset, 0, INLINE_DATA_SIZE-offset);
+        inode->file_size = offset;
+        write_inode(inode_num, inode);
         free_memory(inode);
         return 0;
     }
     ssize_t curr_block = offset/BLOCK_SIZE;
     if(inode->num_blocks > curr_block+1){
-        // this removes everything from curr_block+1
+        // this removes everything from curr_block+1, preallocated blocks past the end included
         remove_dblocks_from_inode(inode, curr_block+1);
     }
     // get_curr_block
-    ssize_t dblock_num = fblock_num_to_dblock_num(inode, curr_block);
-    if(dblock_num<=0){
+    ssize_t dblock_num = curr_block < inode->num_blocks ? fblock_num_to_dblock_num(inode, curr_block) : 0;
+    if(dblock_num<0){
+        free_memory(inode);
         return -1;
     }
-    char* dblock_buff = read_dblock(dblock_num);
-    ssize_t block_offset = offset % BLOCK_SIZE;
-    memset(dblock_buff+block_offset, 0, BLOCK_SIZE-block_offset);
-    write_dblock(dblock_num, dblock_buff);
-    free_memory(dblock_buff);
-    inode->file_size = offset;
-    write_inode(inode_num, inode);
+    // holes and unwritten blocks already read as zeros
+    if(dblock_num!=0 && !IS_UNWRITTEN(dblock_num)){
+        char* dblock_buff = read_dblock(dblock_num);
+        ssize_t block_offset = offset % BLOCK_SIZE;
+        memset(dblock_buff+block_offset, 0, BLOCK_SIZE-block_offset);
+        write_dblock(dblock_num, dblock_buff);
+        free_memory(dblock_buff);
+    }
+    inode->file_size = offset;
+    write_inode(inode_num, inode);
+    free_memory(inode);
+    return 0;
+}
+
+ssize_t custom_truncate(const char* path, size_t offset){
+    if(offset > MAX_FILE_SIZE){
+        return -EFBIG;
+    }
+    ssize_t inode_num = get_inode_num_from_path(path);
+    if(inode_num==-1){
+        return -1;
+    }
+    begin_inode_write(inode_num);
+    ssize_t status = truncate_locked(inode_num, offset);
+    unlock_inode(inode_num);
+    return status;
+}
+
+// frees the emptied blocks at the end of a directory, the blocks before them keep their place
+static bool trim_dir_blocks(struct iNode* inode){
+    while(inode->num_blocks>1){
+        ssize_t last_fblock_num = inode->num_blocks-1;
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, last_fblock_num, &dblock_num);
+        if(dblock==NULL){
+            return false;
+        }
+        bool empty = dir_entry_inum(dblock, 0)==0 && dir_entry_rec_len(dblock, 0)==BLOCK_SIZE;
+        free_memory(dblock);
+        if(!empty){
+            return true;
+        }
+        if(inode->is_indexed){
+            // an index block, or the only leaf below one, stays
+            ssize_t freed = dx_free_leaf(inode, last_fblock_num);
+            if(freed==0 && inode->num_blocks==2){
+                // the root's only leaf is empty, "." and ".." are all that is left for a linear block
+                return compact_dir(inode)!=-1;
+            }
+            if(freed!=1){
+                return freed==0;
+            }
+        }
+        else if(!release_dir_fblock(inode, last_fblock_num)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+takes the entry find_file located out of its directory block and frees file->dblock. No other entry
+moves, only emptied blocks at the end are freed, custom_compact_dir repacks the rest
+*/
+static bool remove_dir_entry(struct iNode* parent_inode, struct file_pos_in_dir* file){
+    bool status = true;
+    ssize_t rec_len = dir_entry_rec_len(file->dblock, file->start_pos);
+    if(file->prev_entry!=-1){
+        // the preceding record takes over the space, so this one is never traversed again
+        set_dir_entry_rec_len(file->dblock, file->prev_entry, dir_entry_rec_len(file->dblock, file->prev_entry) + rec_len);
+    }
+    else{
+        // the first record of a block is left as an empty entry in front of the ones that follow
+        write_dir_entry(file->dblock, 0, 0, rec_len, DIR_TYPE_UNKNOWN, "", 0);
+    }
+    bool emptied = dir_entry_inum(file->dblock, 0)==0 && dir_entry_rec_len(file->dblock, 0)==BLOCK_SIZE;
+    if(emptied && parent_inode->is_inline){
+        // the only entry of an inline directory
+        memset(parent_inode->inline_data, 0, INLINE_DATA_SIZE);
+        parent_inode->file_size = 0;
+    }
+    else{
+        status = write_dir_block(parent_inode, file->dblock_num, file->dblock);
+        note_dir_space(file->dblock_num, file->dblock);
+        if(status && emptied && file->fblock_num==parent_inode->num_blocks-1){
+            status = trim_dir_blocks(parent_inode);
+        }
+    }
+    free_memory(file->dblock);
+    file->dblock = NULL;
+    return status;
+}
+
+// points the entry find_file located at another inode of the given mode and frees file->dblock
+static bool set_dir_entry_inum(struct iNode* parent_inode, struct file_pos_in_dir* file, ssize_t inode_num, mode_t mode){
+    dir_entry_at(file->dblock, file->start_pos)->inum = inode_num;
+    dir_entry_at(file->dblock, file->start_pos)->type = DIR_ENTRY_TYPE(mode);
+    bool status = write_dir_block(parent_inode, file->dblock_num, file->dblock);
+    free_memory(file->dblock);
+    file->dblock = NULL;
+    return status;
+}
+
+// adds delta to the link count of an inode and sets its change time, on a fresh copy read under the inode lock
+static bool change_link_count(ssize_t inum, ssize_t delta, struct timespec curr_time){
+    lock_inode(inum);
+    struct iNode* inode = read_inode(inum);
+    bool status = inode!=NULL;
+    if(status){
+        inode->link_count += delta;
+        inode->status_change_time = curr_time;
+        status = write_inode(inum, inode);
+    }
+    free_memory(inode);
+    unlock_inode(inum);
+    return status;
+}
+
+// drops one link of an inode, after the last one it goes on the orphan list for the reclaim thread
+static void release_link(ssize_t inum, struct timespec curr_time){
+    // the blocks are on their way out, a defrag of the file has to notice
+    begin_inode_write(inum);
+    struct iNode* inode = read_inode(inum);
+    if(inode==NULL){
+        unlock_inode(inum);
+        return;
+    }
+    inode->link_count--;
+    if(inode->link_count==0){
+        pthread_mutex_lock(&orphan_lock);
+        if(!push_orphan(inum, inode)){
+            printf("Could not add inode %ld to the orphan list\n", inum);
+        }
+        pthread_cond_signal(&orphan_cond);
+        pthread_mutex_unlock(&orphan_lock);
+    }
+    else{
+        inode->status_change_time = curr_time;
+        write_inode(inum, inode);
+    }
     free_memory(inode);
-    return 0;
+    unlock_inode(inum);
 }
 
 ssize_t custom_unlink(const char* path){
@@ -785,58 +1888,18 @@ ssize_t custom_unlink(const char* path){
         return -1;
     }
 
-    ssize_t next_entry_offset_from_curr = ((ssize_t *)(file.dblock + file.start_pos + INODE_SZ))[0];
-    if(file.prev_entry!=-1){
-        // There is a preceeding record to the curr record entry
-        // Need to increment its pointer by this pointer
-        // so we dont traverse that record in the future.
-        // this means F1, F2, F3 and now we delete F3 and free it up or delete F2 and then point from F1 to F3
-        ((ssize_t *)(file.dblock + file.prev_entry + INODE_SZ))[0]+= next_entry_offset_from_curr;
-        write_dblock(file.dblock_num, file.dblock);
-    }  
-    else if(file.start_pos == 0 && next_entry_offset_from_curr != BLOCK_SIZE){
-        // this is the first entry in the directory and it is followed by other entries
-        // Move next entry to the start of block
-        // F1, F2, F3 and if you delete F1, F2 will be moved to F1 while also updating offset
-        unsigned short next_entry_name_len = ((unsigned short *)(file.dblock + next_entry_offset_from_curr + INODE_SZ + ADDRESS_PTR_SZ))[0];//next entry namestr len
-        ssize_t next_entry_len = INODE_SZ + ADDRESS_PTR_SZ + STRING_LENGTH_SZ + next_entry_name_len;
-        memcpy(file.dblock, file.dblock+ next_entry_offset_from_curr, next_entry_len); //2nd entry is copied to 1st entry
-        ((ssize_t *)(file.dblock + INODE_SZ))[0] += next_entry_offset_from_curr;//record size is updated to include both entries.
-        write_dblock(file.dblock_num, file.dblock);
-    }
-    else if(file.start_pos==0){
-        //Remove Datablock
-        ssize_t end_dblock_num = fblock_num_to_dblock_num(parent_inode, parent_inode->num_blocks-1);
-        ssize_t curr_dblock_num = fblock_num_to_dblock_num(parent_inode, file.fblock_num);
-        if(curr_dblock_num <=0){
-            return -1;
-        }
-        if(end_dblock_num <=0){
-            return -1;
-        }
-        free_dblock(curr_dblock_num);
-        // replace the removed block num with the end block
-        write_dblock_to_inode(parent_inode, file.fblock_num, end_dblock_num);
-        parent_inode->num_blocks--;
-    }
-    free_memory(file.dblock);
+    remove_dir_entry(parent_inode, &file);
+    dir_entries_changed(parent_inode_num);
+    drop_dentry(path);
 
-    time_t curr_time = time(NULL);
+    struct timespec curr_time = current_time();
     parent_inode->access_time = curr_time;
     parent_inode->modification_time = curr_time;
     parent_inode->status_change_time = curr_time;
 
-    //decrementing the link count
-    inode->link_count--;
-    if(inode->link_count==0){
-        //if link_count is 0, the file has to be deleted.
-        pop_cache(&iname_cache, path);
-        free_inode(inum);
-    }
-    else{
-        inode->status_change_time = curr_time;
-        write_inode(inum, inode);
-    }
+    //decrementing the link count, if it drops to 0 the file has to be deleted.
+    // The inode is parked on the orphan list and its blocks are released by the reclaim thread
+    release_link(inum, curr_time);
     //updating parent inode
     write_inode(parent_inode_num, parent_inode);
     free_memory(parent_inode);
@@ -844,6 +1907,307 @@ ssize_t custom_unlink(const char* path){
     return 0;
 }
 
+// true when ancestor is the directory itself or one above it, found by following ".."
+static bool is_ancestor(ssize_t ancestor, ssize_t inode_num){
+    for(ssize_t depth=0; depth<get_inode_count(); depth++){
+        if(inode_num==ancestor){
+            return true;
+        }
+        if(inode_num==ROOT_INODE){
+            return false;
+        }
+        struct iNode* inode = read_inode(inode_num);
+        if(inode==NULL){
+            return false;
+        }
+        struct file_pos_in_dir file = find_file("..", inode);
+        free_memory(inode);
+        if(file.start_pos==-1){
+            return false;
+        }
+        inode_num = dir_entry_inum(file.dblock, file.start_pos);
+        free_memory(file.dblock);
+    }
+    return false;
+}
+
+// points ".." of a moved directory at its new parent
+static bool set_dotdot(ssize_t dir_inode_num, ssize_t parent_inode_num){
+    struct iNode* dir_inode = read_inode(dir_inode_num);
+    if(dir_inode==NULL){
+        return false;
+    }
+    struct file_pos_in_dir file = find_file("..", dir_inode);
+    bool status = file.start_pos!=-1 && set_dir_entry_inum(dir_inode, &file, parent_inode_num, S_IFDIR) &&
+                  write_inode(dir_inode_num, dir_inode);
+    free_memory(dir_inode);
+    return status;
+}
+
+// checks a rename against the file it replaces, 0 when it may go ahead
+static ssize_t check_rename_target(const struct iNode* const inode, const struct iNode* const target){
+    if(S_ISDIR(inode->mode) && !S_ISDIR(target->mode)){
+        return -ENOTDIR;
+    }
+    if(!S_ISDIR(inode->mode) && S_ISDIR(target->mode)){
+        return -EISDIR;
+    }
+    if(S_ISDIR(target->mode) && !is_empty_dir((struct iNode*) target)){
+        return -ENOTEMPTY;
+    }
+    return 0;
+}
+
+ssize_t custom_rename(const char* from, const char* to, unsigned int flags){
+    if((flags & ~(RENAME_NOREPLACE|RENAME_EXCHANGE)) || ((flags & RENAME_NOREPLACE) && (flags & RENAME_EXCHANGE))){
+        return -EINVAL;
+    }
+    ssize_t from_len = strlen(from);
+    ssize_t to_len = strlen(to);
+    char from_parent_path[from_len+1];
+    char from_name[from_len+1];
+    char to_parent_path[to_len+1];
+    char to_name[to_len+1];
+    if(!get_parent_path(from_parent_path, from, from_len) || !get_child_name(from_name, from, from_len) ||
+       !get_parent_path(to_parent_path, to, to_len) || !get_child_name(to_name, to, to_len)){
+        return -EINVAL;
+    }
+    if((ssize_t) strlen(to_name) > MAX_NAME_LENGTH){
+        return -ENAMETOOLONG;
+    }
+    ssize_t inum = get_inode_num_from_path(from);
+    ssize_t from_parent_num = get_inode_num_from_path(from_parent_path);
+    ssize_t to_parent_num = get_inode_num_from_path(to_parent_path);
+    if(inum==-1 || from_parent_num==-1 || to_parent_num==-1){
+        return -ENOENT;
+    }
+    ssize_t target_inum = get_inode_num_from_path(to);
+    if(target_inum==inum){
+        // both names already refer to the same file
+        return 0;
+    }
+    if((flags & RENAME_NOREPLACE) && target_inum!=-1){
+        return -EEXIST;
+    }
+    if((flags & RENAME_EXCHANGE) && target_inum==-1){
+        return -ENOENT;
+    }
+    struct iNode* inode = read_inode(inum);
+    struct iNode* target = target_inum!=-1 ? read_inode(target_inum) : NULL;
+    // the same inode serves both sides of a rename inside one directory
+    struct iNode* from_parent = read_inode(from_parent_num);
+    struct iNode* to_parent = to_parent_num==from_parent_num ? from_parent : read_inode(to_parent_num);
+    ssize_t status = 0;
+    if(!S_ISDIR(to_parent->mode)){
+        status = -ENOTDIR;
+    }
+    // a directory can't be moved into its own subtree
+    else if((S_ISDIR(inode->mode) && is_ancestor(inum, to_parent_num)) ||
+            ((flags & RENAME_EXCHANGE) && S_ISDIR(target->mode) && is_ancestor(target_inum, from_parent_num))){
+        status = -EINVAL;
+    }
+    else if(target!=NULL && !(flags & RENAME_EXCHANGE)){
+        status = check_rename_target(inode, target);
+    }
+    if(status==0){
+        // the new name is in place before the old one goes, a failure in between leaves an extra link rather than none
+        bool done;
+        if(target!=NULL){
+            struct file_pos_in_dir file = find_file(to_name, to_parent);
+            done = file.start_pos!=-1 && set_dir_entry_inum(to_parent, &file, inum, inode->mode);
+        }
+        else{
+            done = add_new_entry(to_parent, inum, to_name, inode->mode);
+        }
+        if(done){
+            struct file_pos_in_dir file = find_file(from_name, from_parent);
+            if(flags & RENAME_EXCHANGE){
+                done = file.start_pos!=-1 && set_dir_entry_inum(from_parent, &file, target_inum, target->mode);
+            }
+            else{
+                done = file.start_pos!=-1 && remove_dir_entry(from_parent, &file);
+            }
+        }
+        struct timespec curr_time = current_time();
+        from_parent->modification_time = curr_time;
+        from_parent->status_change_time = curr_time;
+        to_parent->modification_time = curr_time;
+        to_parent->status_change_time = curr_time;
+        done = write_inode(from_parent_num, from_parent) && done;
+        if(to_parent!=from_parent){
+            done = write_inode(to_parent_num, to_parent) && done;
+        }
+        done = change_link_count(inum, 0, curr_time) && done;
+        dir_entries_changed(from_parent_num);
+        dir_entries_changed(to_parent_num);
+        // a moved directory takes everything cached under its old path along, a replaced one too
+        drop_dentry(from);
+        drop_dentry(to);
+        cache_dentry(to, strlen(to), inum);
+        if(flags & RENAME_EXCHANGE){
+            cache_dentry(from, strlen(from), target_inum);
+            done = change_link_count(target_inum, 0, curr_time) && done;
+        }
+        else if(target!=NULL){
+            // the replaced file loses the link its name held
+            release_link(target_inum, curr_time);
+        }
+        // directories that changed parent take ".." along
+        if(from_parent_num!=to_parent_num){
+            if(S_ISDIR(inode->mode)){
+                done = set_dotdot(inum, to_parent_num) && done;
+            }
+            if((flags & RENAME_EXCHANGE) && S_ISDIR(target->mode)){
+                done = set_dotdot(target_inum, from_parent_num) && done;
+            }
+        }
+        status = done ? 0 : -EIO;
+    }
+    if(to_parent!=from_parent){
+        free_memory(to_parent);
+    }
+    free_memory(from_parent);
+    free_memory(target);
+    free_memory(inode);
+    return status;
+}
+
+ssize_t custom_link(const char* from, const char* to){
+    ssize_t to_len = strlen(to);
+    char to_parent_path[to_len+1];
+    char to_name[to_len+1];
+    if(!get_parent_path(to_parent_path, to, to_len) || !get_child_name(to_name, to, to_len)){
+        return -EINVAL;
+    }
+    if((ssize_t) strlen(to_name) > MAX_NAME_LENGTH){
+        return -ENAMETOOLONG;
+    }
+    ssize_t inum = get_inode_num_from_path(from);
+    ssize_t to_parent_num = get_inode_num_from_path(to_parent_path);
+    if(inum==-1 || to_parent_num==-1){
+        return -ENOENT;
+    }
+    if(get_inode_num_from_path(to)!=-1){
+        return -EEXIST;
+    }
+    struct iNode* inode = read_inode(inum);
+    struct iNode* to_parent = read_inode(to_parent_num);
+    ssize_t status = 0;
+    // directories keep a single name, their ".." could not follow a second one
+    if(S_ISDIR(inode->mode)){
+        status = -EPERM;
+    }
+    else if(!S_ISDIR(to_parent->mode)){
+        status = -ENOTDIR;
+    }
+    else if(!add_new_entry(to_parent, inum, to_name, inode->mode)){
+        status = -ENOSPC;
+    }
+    else{
+        struct timespec curr_time = current_time();
+        to_parent->modification_time = curr_time;
+        to_parent->status_change_time = curr_time;
+        if(!write_inode(to_parent_num, to_parent) || !change_link_count(inum, 1, curr_time)){
+            status = -EIO;
+        }
+        dir_entries_changed(to_parent_num);
+        cache_dentry(to, to_len, inum);
+    }
+    free_memory(to_parent);
+    free_memory(inode);
+    return status;
+}
+
+ssize_t custom_symlink(const char* target, const char* path){
+    ssize_t target_len = strlen(target);
+    if(target_len>=BLOCK_SIZE){
+        return -ENAMETOOLONG;
+    }
+    struct iNode* inode = NULL;
+    ssize_t inode_num = create_new_file(path, &inode, S_IFLNK|S_IRWXU|S_IRWXG|S_IRWXO);
+    if(inode_num<0){
+        return inode_num;
+    }
+    inode->file_size = target_len;
+    // short targets stay in the inode, resolving them costs no dblock read
+    inode->is_inline = target_len<=INLINE_DATA_SIZE;
+    if(inode->is_inline){
+        memcpy(inode->inline_data, target, target_len);
+        ssize_t status = write_inode(inode_num, inode) ? 0 : -EIO;
+        free_memory(inode);
+        return status;
+    }
+    char dblock[BLOCK_SIZE] = {0};
+    memcpy(dblock, target, target_len);
+    ssize_t dblock_num = create_new_dblock_for_inode(inode);
+    bool done = dblock_num!=-1 && write_dblock(dblock_num, dblock) && add_dblock_to_inode(inode, dblock_num);
+    if(!done && dblock_num!=-1){
+        free_dblock(dblock_num);
+        inode->alloc_blocks--;
+    }
+    if(!done){
+        inode->file_size = 0;
+    }
+    done = write_inode(inode_num, inode) && done;
+    free_memory(inode);
+    if(!done){
+        // the name was already added, take it back rather than leave a link without a target
+        custom_unlink(path);
+        return -ENOSPC;
+    }
+    return 0;
+}
+
+ssize_t custom_readlink(const char* path, char* buff, size_t size){
+    ssize_t inode_num = get_inode_num_from_path(path);
+    if(inode_num==-1){
+        return -ENOENT;
+    }
+    struct iNode* inode = read_inode(inode_num);
+    if(!S_ISLNK(inode->mode)){
+        free_memory(inode);
+        return -EINVAL;
+    }
+    ssize_t nbytes = inode->file_size < (ssize_t) size ? inode->file_size : (ssize_t) size;
+    if(inode->is_inline){
+        memcpy(buff, inode->inline_data, nbytes);
+    }
+    else{
+        ssize_t dblock_num = fblock_num_to_dblock_num(inode, 0);
+        char* dblock = dblock_num>0 ? read_dblock(dblock_num) : NULL;
+        if(dblock==NULL){
+            free_memory(inode);
+            return -EIO;
+        }
+        memcpy(buff, dblock, nbytes);
+        free_memory(dblock);
+    }
+    free_memory(inode);
+    return nbytes;
+}
+
+ssize_t custom_compact_dir(const char* path){
+    ssize_t inode_num = get_inode_num_from_path(path);
+    if(inode_num==-1){
+        return -ENOENT;
+    }
+    struct iNode* inode = read_inode(inode_num);
+    if(!S_ISDIR(inode->mode)){
+        free_memory(inode);
+        return -ENOTDIR;
+    }
+    ssize_t freed = compact_dir(inode);
+    if(freed>0){
+        inode->status_change_time = current_time();
+    }
+    // a failed pass may still have freed blocks, the inode is written either way
+    if(!write_inode(inode_num, inode) || freed==-1){
+        freed = -EIO;
+    }
+    free_memory(inode);
+    return freed;
+}
+
 ssize_t custom_open(const char* path, ssize_t oflag){
     // open a file, if not there create one, else existing one by scraping everything if asked
     ssize_t inode_num = get_inode_num_from_path(path);
@@ -874,26 +2238,31 @@ ssize_t custom_close(ssize_t file_descriptor){
 
 //shouldn't the return type be int as we are returning number of bytes read?
 //TO VERIFY
-ssize_t custom_read(const char* path, void* buff, size_t nbytes, size_t offset){
-    memset(buff, 0, nbytes);
-    // fetch inum from path
-    ssize_t inum = get_inode_num_from_path(path);
-    if (inum == -1) {
-        printf("ERROR: Inode file %s not found\n", path);
-        return -1;
-    }
+static ssize_t read_locked(ssize_t inum, const char* path, void* buff, size_t nbytes, size_t offset){
     struct iNode *inode= read_inode(inum);
     if (inode->file_size == 0) {
+        free_memory(inode);
         return 0;
     }
     if (offset > inode->file_size) {
         printf("ERROR: Offset %zu for read is greater than size of the file %ld\n", offset, inode->file_size);
+        free_memory(inode);
         return -1;
     }
     //update nbytes when read_len from offset exceeds file_size. 
     if (offset + nbytes > inode->file_size){
         nbytes = inode->file_size - offset;
     }
+    if (inode->is_inline) {
+        // the data came in with the inode, no block to read
+        memcpy(buff, inode->inline_data+offset, nbytes);
+        inode->access_time = current_time();
+        if(!write_inode(inum, inode)){
+            printf("Error: INODE update during file read failed for file %s\n",path);
+        }
+        free_memory(inode);
+        return nbytes;
+    }
 
     ssize_t start_block = offset / BLOCK_SIZE;
     ssize_t start_block_top_ceil = offset % BLOCK_SIZE;
@@ -903,205 +2272,746 @@ ssize_t custom_read(const char* path, void* buff, size_t nbytes, size_t offset){
 
     ssize_t nblocks_read = end_block - start_block + 1;
 
-    // printf("start_block %ld, start_block_start %ld, end_block %ld, end_block_end %ld, blocks_to_read %ld\n",
-    //         start_block, start_block_top_ceil, end_block, BLOCK_SIZE-end_block_bottom_floor, nblocks_read);
-
     DEBUG_PRINTF("Total number of blocks to read: %ld\n", nblocks_read);
 
     size_t bytes_read = 0;
-    ssize_t dblock_num;
-    char *buf_read = NULL;
+    for(ssize_t i=0; i<nblocks_read; i++){
+        // for the 1st block, read only the contents after the start ceil.
+        // for the last block, read contents only till the bottom floor.
+        ssize_t block_start = (i==0) ? start_block_top_ceil : 0;
+        ssize_t block_end = (i==nblocks_read-1) ? BLOCK_SIZE-end_block_bottom_floor : BLOCK_SIZE;
+        if(block_end<=block_start){
+            continue;
+        }
+        ssize_t dblock_num = fblock_num_to_dblock_num(inode, start_block+i);
+        if(dblock_num<0){
+            printf("Error fetching dblock_num %ld from fblock_num during the read. Max Blocks:%ld \n",start_block+i,inode->num_blocks);
+            free_memory(inode);
+            return -1;
+        }
+        // holes and preallocated blocks that were never written read as zeros without any io
+        if(dblock_num!=0 && !IS_UNWRITTEN(dblock_num)){
+            char* buf_read = read_dblock(dblock_num);
+            if(buf_read == NULL){
+                printf("Error fetching dblock_num %ld during the read operation for %s\n",dblock_num,path);
+                free_memory(inode);
+                return -1;
+            }
+            memcpy(buff+bytes_read, buf_read+block_start, block_end-block_start);
+            free_memory(buf_read);
+        }
+        bytes_read += block_end-block_start;
+    }
+    // DEBUG_PRINTF("FILE_LAYER: Read Successful for the file %s\n Bytes read: %zu\n",path, bytes_read);
+    struct timespec curr_time = current_time();
+    inode->access_time = curr_time;
+
+    if(!write_inode(inum, inode)){
+        printf("Error: INODE update during file read failed for file %s\n",path);
+    }
+    free_memory(inode);
+    return bytes_read; 
+}
+
+ssize_t custom_read(const char* path, void* buff, size_t nbytes, size_t offset){
+    memset(buff, 0, nbytes);
+    // fetch inum from path
+    ssize_t inum = get_inode_num_from_path(path);
+    if (inum == -1) {
+        printf("ERROR: Inode file %s not found\n", path);
+        return -1;
+    }
+    // the access time is written back, so a read holds the inode too
+    lock_inode(inum);
+    ssize_t bytes_read = read_locked(inum, path, buff, nbytes, offset);
+    unlock_inode(inum);
+    return bytes_read;
+}
+
+/*
+Returns the buffer a write into file block fblock_num starts from and the dblock backing it.
+Holes get a block allocated here and blocks that are preallocated or never written
+start out as zeros instead of being read
+*/
+char* load_dblock_for_write(struct iNode* inode, ssize_t fblock_num, ssize_t* dblock_num){
+    *dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+    if(*dblock_num<0){
+        return NULL;
+    }
+    if(*dblock_num==0){
+        *dblock_num = create_new_dblock_for_inode(inode);
+        if(*dblock_num<=0 || !write_dblock_to_inode(inode, fblock_num, *dblock_num)){
+            return NULL;
+        }
+        return (char*) calloc(1, BLOCK_SIZE);
+    }
+    if(IS_UNWRITTEN(*dblock_num)){
+        // the block now holds data, drop the unwritten mark from the mapping
+        *dblock_num = DBLOCK_NUM(*dblock_num);
+        if(!write_dblock_to_inode(inode, fblock_num, *dblock_num)){
+            return NULL;
+        }
+        return (char*) calloc(1, BLOCK_SIZE);
+    }
+    return read_dblock(*dblock_num);
+}
+
+//TO VERIFY 
+// on failure what to return?
+static ssize_t write_locked(ssize_t inum, const char* path, void* buff, size_t nbytes, size_t offset){
+    struct iNode *inode = read_inode(inum);
+    if(inode->is_inline && offset + nbytes <= INLINE_DATA_SIZE){
+        memcpy(inode->inline_data+offset, buff, nbytes);
+        if(offset + nbytes > inode->file_size){
+            inode->file_size = offset + nbytes;
+        }
+        struct timespec curr_time = current_time();
+        inode->access_time = curr_time;
+        inode->modification_time = curr_time;
+        inode->status_change_time = curr_time;
+        bool status = write_inode(inum, inode);
+        free_memory(inode);
+        return status ? (ssize_t) nbytes : -1;
+    }
+    // the file outgrows the inode, its bytes so far move to the first block
+    if(inode->is_inline && !move_inline_data_to_block(inode, NULL)){
+        printf("Could not move the inline data of %s to a block\n", path);
+        free_memory(inode);
+        return -1;
+    }
+    steer_goal_to_run(inode, offset / BLOCK_SIZE, (offset + nbytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    // blocks past the end are added as holes, only the ones the write touches get a dblock below
+    // and blocks skipped over by the write stay holes that read back as zeros
+    extend_with_holes(inode, (offset + nbytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    ssize_t start_block = offset / BLOCK_SIZE;
+    ssize_t start_block_top_ceil = offset % BLOCK_SIZE;
 
-    if(nblocks_read==1){
-        //only 1 block to be read;
-        dblock_num=fblock_num_to_dblock_num(inode,start_block);
+    ssize_t end_block = (offset + nbytes) / BLOCK_SIZE;
+    ssize_t end_block_bottom_floor = BLOCK_SIZE - (offset + nbytes)% BLOCK_SIZE;
+
+    ssize_t nblocks_write = end_block - start_block + 1;
+
+    DEBUG_PRINTF("writing %ld blocks to file\n", nblocks_write);
+
+    size_t bytes_written=0;
+    for(ssize_t i=0; i<nblocks_write; i++){
+        // for the 1st block, start only after start_block_top_ceil
+        // for the last block, stop at the bottom floor
+        ssize_t block_start = (i==0) ? start_block_top_ceil : 0;
+        ssize_t block_end = (i==nblocks_write-1) ? BLOCK_SIZE-end_block_bottom_floor : BLOCK_SIZE;
+        if(block_end<=block_start){
+            continue;
+        }
+        ssize_t dblock_num;
+        char* buf_read = load_dblock_for_write(inode, start_block+i, &dblock_num);
+        if(buf_read == NULL){
+            printf("Error reading fblock_num %ld during the write of file %s\n", start_block+i, path);
+            free_memory(inode);
+            return -1;
+        }
+        memcpy(buf_read + block_start, buff + bytes_written, block_end-block_start);
+        bytes_written += block_end-block_start;
+        if(!write_dblock(dblock_num, buf_read)){
+            printf("Error in writing to %ld dblock_num during the write of %s\n", dblock_num, path);
+            free_memory(buf_read);
+            free_memory(inode);
+            return -1;
+        }
+        free_memory(buf_read);
+    }
+    if(offset + nbytes > inode->file_size){
+        inode->file_size = offset + nbytes;
+    }
+    struct timespec curr_time = current_time();
+    inode->access_time = curr_time;
+    inode->modification_time = curr_time;
+    inode->status_change_time = curr_time;
+    if(!write_inode(inum, inode)){
+        printf("Updating inode %ld for the file %s during the write operation failed\n",inum, path);
+        free_memory(inode);
+        return -1;
+    }
+    free_memory(inode);
+    return nbytes;
+}
+
+ssize_t custom_write(const char* path, void* buff, size_t nbytes, size_t offset){
+    // like linux, a write crossing the limit is cut short and one starting at it fails
+    if(nbytes>0 && offset >= MAX_FILE_SIZE){
+        return -EFBIG;
+    }
+    if(nbytes > MAX_FILE_SIZE - offset){
+        nbytes = MAX_FILE_SIZE - offset;
+    }
+    ssize_t inum = get_inode_num_from_path(path);
+    if (inum == -1) {
+        printf("ERROR in FILE_LAYER: Unable to find Inode for file %s\n", path);
+        return -1;
+    }
+    begin_inode_write(inum);
+    ssize_t written = write_locked(inum, path, buff, nbytes, offset);
+    unlock_inode(inum);
+    return written;
+}
+
+// zeros the bytes [from, to) of a file block that holds data
+bool zero_fblock_range(struct iNode* inode, ssize_t fblock_num, ssize_t from, ssize_t to){
+    if(fblock_num >= inode->num_blocks){
+        return true;
+    }
+    ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
+    if(dblock_num<0){
+        return false;
+    }
+    if(dblock_num==0 || IS_UNWRITTEN(dblock_num)){
+        return true;
+    }
+    char* dblock_buff = read_dblock(dblock_num);
+    if(dblock_buff==NULL){
+        return false;
+    }
+    memset(dblock_buff+from, 0, to-from);
+    bool status = write_dblock(dblock_num, dblock_buff);
+    free_memory(dblock_buff);
+    return status;
+}
+
+// releases the blocks fully covered by [offset, offset+len) and zeros the partial ones around
+bool punch_hole(struct iNode* inode, size_t offset, size_t len){
+    size_t end = offset + len;
+    if(end > inode->file_size){
+        end = inode->file_size;
+    }
+    if(offset >= end){
+        return true;
+    }
+    ssize_t first_block = offset / BLOCK_SIZE;
+    ssize_t last_block = (end - 1) / BLOCK_SIZE;
+    if(first_block==last_block){
+        return zero_fblock_range(inode, first_block, offset % BLOCK_SIZE, (end - 1) % BLOCK_SIZE + 1);
+    }
+    ssize_t first_full = first_block;
+    ssize_t end_full = last_block + 1;
+    if(offset % BLOCK_SIZE != 0){
+        if(!zero_fblock_range(inode, first_block, offset % BLOCK_SIZE, BLOCK_SIZE)){
+            return false;
+        }
+        first_full++;
+    }
+    if(end % BLOCK_SIZE != 0){
+        if(!zero_fblock_range(inode, last_block, 0, end % BLOCK_SIZE)){
+            return false;
+        }
+        end_full--;
+    }
+    if(end_full > inode->num_blocks){
+        end_full = inode->num_blocks;
+    }
+    struct dblock_list freed = {NULL, 0, 0};
+    bool status = true;
+    for(ssize_t fblock_num=first_full; fblock_num<end_full && status; fblock_num++){
+        ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
         if(dblock_num<=0){
-            printf("Error fetching dblock_num %ld from fblock_num during the read. Max Blocks:%ld \n",start_block,inode->num_blocks);
-            return -1;
+            continue;
         }
+        // a zero entry is a hole, reads of it produce zeros
+        status = append_dblock(&freed, DBLOCK_NUM(dblock_num)) && write_dblock_to_inode(inode, fblock_num, 0);
+    }
+    if(status){
+        status = free_dblocks(freed.dblock_nums, freed.count);
+        inode->alloc_blocks -= freed.count;
+    }
+    free_memory(freed.dblock_nums);
+    return status;
+}
 
-        buf_read=read_dblock(dblock_num);
-        if(buf_read==NULL){
-            printf("Error fetching dblock_num %ld during the read operation for %s\n",dblock_num,path);
+// last level indirect block holding the entry of fblock_num, 0 when it is missing. index is the entry in it
+static ssize_t leaf_indirect_dblock(struct iNode* inode, ssize_t fblock_num, ssize_t* index){
+    ssize_t* root;
+    ssize_t rel_fblock_num;
+    ssize_t depth = indirect_root(inode, fblock_num, &root, &rel_fblock_num);
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    ssize_t dblock_num = *root;
+    for(; depth>1 && dblock_num!=0; depth--){
+        ssize_t* indirect_buff = (ssize_t*) read_dblock(dblock_num);
+        if(indirect_buff==NULL){
             return -1;
         }
-        memcpy(buff, buf_read+start_block_top_ceil, nbytes);
-        bytes_read=nbytes;
+        dblock_num = indirect_buff[rel_fblock_num/span];
+        free_memory(indirect_buff);
+        rel_fblock_num %= span;
+        span /= SINGLE_INDIRECT_BLOCK_COUNT;
     }
-    else{
-        //when there are multiple blocks to read
-        for(ssize_t i=0; i<nblocks_read;i++){
-            dblock_num=fblock_num_to_dblock_num(inode, start_block+i);
-            if(dblock_num<=0){
-                printf("Error fetching dblock_num %ld from fblock_num during the read. Max Blocks:%ld \n",start_block+i,inode->num_blocks);
-                free_memory(inode);
-                return -1;
-            }
-
-            buf_read=read_dblock(dblock_num);
+    *index = rel_fblock_num;
+    return dblock_num;
+}
 
-            if(buf_read == NULL){
-                printf("Error fetching dblock_num %ld during the read operation for %s\n",dblock_num,path);
-                free_memory(inode);
-                return -1;
+// maps count consecutive dblocks from dblock_num at fblock_num on, each indirect block is written once
+static bool map_dblock_run(struct iNode* inode, ssize_t fblock_num, ssize_t dblock_num, ssize_t count, ssize_t flags){
+    ssize_t end_fblock = fblock_num + count;
+    for(; fblock_num<end_fblock && fblock_num<DIRECT_B_COUNT; fblock_num++, dblock_num++){
+        inode->direct_blocks[fblock_num] = dblock_num | flags;
+    }
+    while(fblock_num<end_fblock){
+        // the first entry creates the indirect blocks on its path, the rest of the leaf is filled in after it
+        if(!write_dblock_to_inode(inode, fblock_num, dblock_num | flags)){
+            return false;
+        }
+        ssize_t index;
+        ssize_t leaf_dblock_num = leaf_indirect_dblock(inode, fblock_num, &index);
+        if(leaf_dblock_num<=0){
+            return false;
+        }
+        ssize_t fill = SINGLE_INDIRECT_BLOCK_COUNT - index;
+        if(fill > end_fblock - fblock_num){
+            fill = end_fblock - fblock_num;
+        }
+        if(fill>1){
+            ssize_t* indirect_buff = (ssize_t*) read_dblock(leaf_dblock_num);
+            if(indirect_buff==NULL){
+                return false;
             }
-            // for the 1st block, read only the contents after the start ceil.
-            if(i==0){
-                memcpy(buff, buf_read+start_block_top_ceil, BLOCK_SIZE-start_block_top_ceil);
-                bytes_read+=BLOCK_SIZE-start_block_top_ceil;
+            for(ssize_t i=1; i<fill; i++){
+                indirect_buff[index+i] = (dblock_num + i) | flags;
             }
-            else if(i== nblocks_read-1){
-                // for the last block, read contents only till the bottom floor.
-                memcpy(buff+bytes_read, buf_read, BLOCK_SIZE-end_block_bottom_floor);
-                bytes_read+=BLOCK_SIZE-end_block_bottom_floor;
+            bool status = write_dblock(leaf_dblock_num, (char*) indirect_buff);
+            free_memory(indirect_buff);
+            if(!status){
+                return false;
             }
-            else{
-                memcpy(buff+bytes_read, buf_read, BLOCK_SIZE);
-                bytes_read+=BLOCK_SIZE;
+        }
+        fblock_num += fill;
+        dblock_num += fill;
+    }
+    return true;
+}
+
+// allocates the missing blocks of [offset, offset+len) and marks them unwritten
+bool preallocate_blocks(struct iNode* inode, size_t offset, size_t len){
+    ssize_t first_block = offset / BLOCK_SIZE;
+    ssize_t end_block = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    steer_goal_to_run(inode, first_block, end_block);
+    ssize_t fblock_num = first_block;
+    while(fblock_num<end_block){
+        // the holes from here on are filled from one run, blocks past the mapped ones are all holes
+        ssize_t missing = 0;
+        while(fblock_num+missing<end_block){
+            if(fblock_num+missing >= inode->num_blocks){
+                missing = end_block - fblock_num;
+                break;
             }
+            ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num+missing);
+            if(dblock_num<0){
+                return false;
+            }
+            if(dblock_num!=0){
+                break;
+            }
+            missing++;
+        }
+        if(missing==0){
+            fblock_num++;
+            continue;
+        }
+        // a shorter run is taken when free space is too fragmented for all of it
+        ssize_t count = missing;
+        ssize_t run_start = -1;
+        while(count>0 && (run_start = create_new_dblock_run(inode->alloc_goal, count))==-1){
+            count /= 2;
+        }
+        if(run_start==-1){
+            return false;
+        }
+        inode->alloc_goal = run_start + count;
+        inode->alloc_blocks += count;
+        // the range may start past the mapped blocks, the gap is left as holes
+        extend_with_holes(inode, fblock_num + count);
+        if(!map_dblock_run(inode, fblock_num, run_start, count, UNWRITTEN_FLAG)){
+            return false;
         }
+        fblock_num += count;
     }
-    free_memory(buf_read);
-    // DEBUG_PRINTF("FILE_LAYER: Read Successful for the file %s\n Bytes read: %zu\n",path, bytes_read);
-    time_t curr_time = time(NULL);
-    inode->access_time = curr_time;
+    return true;
+}
+
+static ssize_t fallocate_locked(ssize_t inum, int mode, size_t offset, size_t len);
+
+ssize_t custom_fallocate(const char* path, int mode, size_t offset, size_t len){
+    if(len==0){
+        return -EINVAL;
+    }
+    if(mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)){
+        return -EOPNOTSUPP;
+    }
+    // like linux, punching a hole never changes the size
+    if((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE)){
+        return -EOPNOTSUPP;
+    }
+    if(!(mode & FALLOC_FL_PUNCH_HOLE) && (offset > MAX_FILE_SIZE || len > MAX_FILE_SIZE - offset)){
+        return -EFBIG;
+    }
+    ssize_t inum = get_inode_num_from_path(path);
+    if(inum==-1){
+        return -ENOENT;
+    }
+    begin_inode_write(inum);
+    ssize_t status = fallocate_locked(inum, mode, offset, len);
+    unlock_inode(inum);
+    return status;
+}
 
+static ssize_t fallocate_locked(ssize_t inum, int mode, size_t offset, size_t len){
+    struct iNode* inode = read_inode(inum);
+    if(inode==NULL){
+        return -EIO;
+    }
+    if(!S_ISREG(inode->mode)){
+        free_memory(inode);
+        return -ENODEV;
+    }
+    bool status = true;
+    // space is managed in blocks, an inline file gets its first block here
+    if(inode->is_inline && !move_inline_data_to_block(inode, NULL)){
+        free_memory(inode);
+        return -ENOSPC;
+    }
+    if(mode & FALLOC_FL_PUNCH_HOLE){
+        status = punch_hole(inode, offset, len);
+    }
+    else{
+        status = preallocate_blocks(inode, offset, len);
+        if(status && !(mode & FALLOC_FL_KEEP_SIZE) && offset + len > inode->file_size){
+            inode->file_size = offset + len;
+        }
+    }
+    struct timespec curr_time = current_time();
+    inode->modification_time = curr_time;
+    inode->status_change_time = curr_time;
+    // whatever got allocated before a failure stays mapped, so the inode is written either way
     if(!write_inode(inum, inode)){
-        printf("Error: INODE update during file read failed for file %s\n",path);
+        status = false;
     }
     free_memory(inode);
-    return bytes_read; 
+    return status ? 0 : -ENOSPC;
 }
 
-//TO VERIFY 
-// on failure what to return?
-ssize_t custom_write(const char* path, void* buff, size_t nbytes, size_t offset){
-    ssize_t inum = get_inode_num_from_path(path);
-    if (inum == -1) {
-        printf("ERROR in FILE_LAYER: Unable to find Inode for file %s\n", path);
+// looks for data or a hole in an indirect tree, from is relative to the tree. -1 when there is none
+static ssize_t scan_indirect(ssize_t dblock_num, ssize_t depth, ssize_t from, bool data){
+    if(dblock_num==0){
+        // nothing mapped under a missing indirect block
+        return data ? -1 : from;
+    }
+    ssize_t* entries = (ssize_t*) read_dblock(dblock_num);
+    if(entries==NULL){
         return -1;
     }
-
-    struct iNode *inode = read_inode(inum);
-    ssize_t bytes_to_add=0;
-
-    if(offset + nbytes > inode->file_size){
-        //add new blocks; 
-        bytes_to_add = (offset + nbytes) - inode->file_size;
-        ssize_t new_blocks_to_be_added = ((offset + nbytes) / BLOCK_SIZE) - inode->num_blocks + 1;
-        // printf("Creating %ld new blocks for writing %ld bytes with %ld offset to inode %ld\n",
-        //        new_blocks_to_be_added, nbytes, offset, inum);
-        // DEBUG_PRINTF("Total new blocks being added to the file is %ld\n", new_blocks_to_be_added);
-        ssize_t new_block_id;
-        for(ssize_t i=0; i<new_blocks_to_be_added; i++){
-            new_block_id = create_new_dblock();
-            if(new_block_id<=0){
-                printf("Failed to allocated new Data_Block for the write operation for the file %s\n", path);
-                free_memory(inode);
-                return -1;
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    ssize_t found = -1;
+    for(ssize_t i=from/span; i<SINGLE_INDIRECT_BLOCK_COUNT && found==-1; i++){
+        if(depth==1){
+            bool is_data = entries[i]!=0 && !IS_UNWRITTEN(entries[i]);
+            if(is_data==data){
+                found = i;
             }
-            if(!add_dblock_to_inode(inode, new_block_id)){
-                printf("New Data Block addition to inode failed for file %s\n", path);
-                free_memory(inode);
-                return -1;
+            continue;
+        }
+        ssize_t entry_from = (i==from/span) ? from%span : 0;
+        ssize_t rel = scan_indirect(entries[i], depth-1, entry_from, data);
+        if(rel!=-1){
+            found = i*span + rel;
+        }
+    }
+    free_memory(entries);
+    return found;
+}
+
+ssize_t find_fblock(const struct iNode* const inode, ssize_t fblock_num, bool data){
+    ssize_t found = -1;
+    for(ssize_t i=fblock_num; i<DIRECT_B_COUNT && i<inode->num_blocks && found==-1; i++){
+        bool is_data = inode->direct_blocks[i]!=0 && !IS_UNWRITTEN(inode->direct_blocks[i]);
+        if(is_data==data){
+            found = i;
+        }
+    }
+    const ssize_t indirect_blocks[3] = {inode->single_indirect, inode->double_indirect, inode->triple_indirect};
+    ssize_t start = DIRECT_B_COUNT;
+    ssize_t span = SINGLE_INDIRECT_BLOCK_COUNT;
+    for(ssize_t depth=1; depth<=3 && found==-1 && start<inode->num_blocks; depth++){
+        if(fblock_num < start+span){
+            ssize_t rel = scan_indirect(indirect_blocks[depth-1], depth, fblock_num > start ? fblock_num-start : 0, data);
+            if(rel!=-1){
+                found = start + rel;
             }
         }
+        start += span;
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    // everything past the last block is a hole
+    if(data){
+        return found < inode->num_blocks ? found : -1;
     }
+    if(found==-1 || found > inode->num_blocks){
+        found = inode->num_blocks;
+    }
+    return found < fblock_num ? fblock_num : found;
+}
 
-    ssize_t start_block = offset / BLOCK_SIZE;
-    ssize_t start_block_top_ceil = offset % BLOCK_SIZE;
+ssize_t custom_lseek(const char* path, ssize_t offset, int whence){
+    if(whence!=SEEK_DATA && whence!=SEEK_HOLE){
+        return -EINVAL;
+    }
+    ssize_t inum = get_inode_num_from_path(path);
+    if(inum==-1){
+        return -ENOENT;
+    }
+    struct iNode* inode = read_inode(inum);
+    if(inode==NULL){
+        return -EIO;
+    }
+    ssize_t file_size = inode->file_size;
+    if(offset<0 || offset>=file_size){
+        free_memory(inode);
+        return -ENXIO;
+    }
+    if(inode->is_inline){
+        free_memory(inode);
+        // all of an inline file is data
+        return whence==SEEK_DATA ? offset : file_size;
+    }
+    ssize_t fblock_num = find_fblock(inode, offset/BLOCK_SIZE, whence==SEEK_DATA);
+    free_memory(inode);
+    if(fblock_num==-1){
+        return -ENXIO;
+    }
+    ssize_t found = fblock_num*BLOCK_SIZE > offset ? fblock_num*BLOCK_SIZE : offset;
+    if(whence==SEEK_HOLE){
+        // the end of file is a hole as well
+        return found < file_size ? found : file_size;
+    }
+    return found < file_size ? found : -ENXIO;
+}
 
-    ssize_t end_block = (offset + nbytes) / BLOCK_SIZE;
-    ssize_t end_block_bottom_floor = BLOCK_SIZE - (offset + nbytes)% BLOCK_SIZE;
+// calls visit for every non-zero entry under an indirect block, in file block order
+static bool walk_indirect(ssize_t dblock_num, ssize_t depth, ssize_t start, fblock_visitor visit, void* arg){
+    ssize_t* entries = (ssize_t*) read_dblock(dblock_num);
+    if(entries==NULL){
+        return false;
+    }
+    ssize_t span = 1;
+    for(ssize_t i=1; i<depth; i++){
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    bool status = true;
+    for(ssize_t i=0; i<SINGLE_INDIRECT_BLOCK_COUNT && status; i++){
+        if(entries[i]==0){
+            continue;
+        }
+        if(depth==1){
+            status = visit(start+i, entries[i], arg);
+        }
+        else{
+            status = walk_indirect(entries[i], depth-1, start+i*span, visit, arg);
+        }
+    }
+    free_memory(entries);
+    return status;
+}
 
-    ssize_t nblocks_write = end_block - start_block + 1;
+bool walk_file_blocks(const struct iNode* const inode, fblock_visitor visit, void* arg){
+    if(inode->is_inline){
+        return true;
+    }
+    for(ssize_t i=0; i<DIRECT_B_COUNT; i++){
+        if(inode->direct_blocks[i]!=0 && !visit(i, inode->direct_blocks[i], arg)){
+            return false;
+        }
+    }
+    const ssize_t indirect_blocks[3] = {inode->single_indirect, inode->double_indirect, inode->triple_indirect};
+    ssize_t start = DIRECT_B_COUNT;
+    ssize_t span = SINGLE_INDIRECT_BLOCK_COUNT;
+    for(ssize_t depth=1; depth<=3; depth++){
+        if(indirect_blocks[depth-1]!=0 && !walk_indirect(indirect_blocks[depth-1], depth, start, visit, arg)){
+            return false;
+        }
+        start += span;
+        span *= SINGLE_INDIRECT_BLOCK_COUNT;
+    }
+    return true;
+}
 
-    // printf("start_block %ld, start_block_start %ld, end_block %ld, end_block_end %ld, blocks_to_write %ld\n",
-    //         start_block, start_block_top_ceil, end_block, BLOCK_SIZE-end_block_bottom_floor, nblocks_write);
+static bool count_extent(ssize_t fblock_num, ssize_t entry, void* arg){
+    struct frag_stats* stats = (struct frag_stats*) arg;
+    // holes in the file do not break an extent, only a jump on the device does
+    if(stats->mapped_blocks==0 || DBLOCK_NUM(entry)!=stats->last_dblock+1){
+        stats->extents++;
+    }
+    stats->last_dblock = DBLOCK_NUM(entry);
+    stats->mapped_blocks++;
+    return true;
+}
 
-    DEBUG_PRINTF("writing %ld blocks to file\n", nblocks_write);
+bool get_frag_stats(const struct iNode* const inode, struct frag_stats* stats){
+    memset(stats, 0, sizeof(struct frag_stats));
+    if(!walk_file_blocks(inode, count_extent, stats)){
+        return false;
+    }
+    // 0 when the blocks form one run, 100 when no two of them are next to each other
+    if(stats->extents > 1){
+        stats->score = (stats->extents - 1) * 100 / (stats->mapped_blocks - 1);
+    }
+    return true;
+}
 
-    size_t bytes_written=0;
-    char *buf_read = NULL;
+ssize_t custom_frag_score(const char* path){
+    ssize_t inum = get_inode_num_from_path(path);
+    if(inum==-1){
+        return -ENOENT;
+    }
+    struct iNode* inode = read_inode(inum);
+    if(inode==NULL){
+        return -EIO;
+    }
+    struct frag_stats stats;
+    bool status = get_frag_stats(inode, &stats);
+    free_memory(inode);
+    return status ? stats.score : -EIO;
+}
 
-    // if there is only 1 block to write
-    if(nblocks_write==1){
-        ssize_t dblock_num = fblock_num_to_dblock_num(inode, start_block);
-        if(dblock_num<=0){
-            printf("Error getting dblocknum from Fblock_num during %ld block write for %s\n",start_block, path);
-            free_memory(inode);
-            return -1;
-        }
+// state of the copy of a file into a new run of blocks
+struct defrag_state{
+    struct iNode* new_inode;
+    ssize_t run_start;
+    ssize_t moved;
+};
+
+static bool move_fblock(ssize_t fblock_num, ssize_t entry, void* arg){
+    struct defrag_state* state = (struct defrag_state*) arg;
+    ssize_t dblock_num = state->run_start + state->moved;
+    // an unwritten block keeps its flag and has nothing to copy
+    ssize_t new_entry = IS_UNWRITTEN(entry) ? (dblock_num | UNWRITTEN_FLAG) : dblock_num;
+    if(!write_dblock_to_inode(state->new_inode, fblock_num, new_entry)){
+        return false;
+    }
+    state->moved++;
+    if(IS_UNWRITTEN(entry)){
+        return true;
+    }
+    char* buff = read_dblock(DBLOCK_NUM(entry));
+    if(buff==NULL){
+        return false;
+    }
+    bool status = write_dblock(dblock_num, buff);
+    free_memory(buff);
+    return status;
+}
 
-        buf_read = read_dblock(dblock_num);
-        if(buf_read == NULL){
-            printf("Error encountered reading dblocknum %ld during %s write\n", dblock_num, path);
-            free_memory(inode);
-            return -1;
-        }
-        memcpy(buf_read+start_block_top_ceil, buff, nbytes);
-        if(!write_dblock(dblock_num, buf_read)){
-            printf("Error writing to dblock_num %ld during %s write", dblock_num, path);
-            free_memory(buf_read);
-            free_memory(inode);
-            return -1;
+// gives back the blocks of a new map that was not swapped in, with the part of the run it does not map yet
+static void drop_defrag_copy(struct defrag_state* state, ssize_t run_length){
+    free_dblocks_from_inode(state->new_inode);
+    struct dblock_list unused = {NULL, 0, 0};
+    for(ssize_t i=state->moved; i<run_length; i++){
+        if(!append_dblock(&unused, state->run_start+i)){
+            break;
         }
     }
-    else{
-        for(ssize_t i=0; i<nblocks_write; i++){
-            ssize_t dblock_num = fblock_num_to_dblock_num(inode, start_block+i);
-            if(dblock_num<=0){
-                printf("Error in fetching the dblock_num from fblock_num %ld for %s\n", start_block+i, path);
-                free_memory(inode);
-                return -1;
-            }
-            buf_read=read_dblock(dblock_num);
-            if(buf_read == NULL){
-                printf("Error reading dblock_num %ld during the write of file %s\n",dblock_num, path);
-                free_memory(inode);
-                return -1;
-            }
-            // for the 1st block, start only after start_block_top_ceil
-            if(i==0){
-                memcpy(buf_read + start_block_top_ceil, buff, BLOCK_SIZE - (start_block_top_ceil));
-                // printf("Added - %s\n", buf_read+start_block_top_ceil);
-                bytes_written += BLOCK_SIZE-start_block_top_ceil;
-            }
-            else if(i==nblocks_write-1){
-                //last block to be written
-                memcpy(buf_read, buff + bytes_written, BLOCK_SIZE-end_block_bottom_floor);
-                // printf("Added - %s\n", buf_read);
-                bytes_written+= BLOCK_SIZE - end_block_bottom_floor;
-            }
-            else{
-                memcpy(buf_read, buff + bytes_written, BLOCK_SIZE);
-                // printf("Added - %s\n", buf_read);
-                bytes_written += BLOCK_SIZE;
-            }
-            if(!write_dblock(dblock_num, buf_read)){
-                printf("Error in writing to %ld dblock_num during the write of %s\n", dblock_num, path);
-                free_memory(buf_read);
-                free_memory(inode);
-                return -1;
-            }
-            // printf("Bytes written %ld, Dblock %ld, Fblock %ld\n", bytes_written, dblock_num, start_block+i);
-        }
+    free_dblocks(unused.dblock_nums, unused.count);
+    free_memory(unused.dblock_nums);
+}
+
+ssize_t custom_defrag(const char* path){
+    ssize_t inum = get_inode_num_from_path(path);
+    if(inum==-1){
+        return -ENOENT;
     }
-    free_memory(buf_read);
-    inode->file_size += bytes_to_add;
-    time_t curr_time= time(NULL);
-    inode->access_time = curr_time;
-    inode->modification_time = curr_time;
-    inode->status_change_time = curr_time;
-    if(!write_inode(inum, inode)){
-        printf("Updating inode %ld for the file %s during the write operation failed\n",inum, path);
-        return -1;
+    // the copy runs without the lock, a write in the meantime shows up as a new generation
+    lock_inode(inum);
+    ssize_t generation = inode_generations[inum % INODE_LOCK_COUNT];
+    struct iNode* inode = read_inode(inum);
+    unlock_inode(inum);
+    if(inode==NULL){
+        return -EIO;
+    }
+    // directory blocks change under the directory operations, which don't take the inode lock.
+    // An unlinked file belongs to the reclaim thread
+    if(!S_ISREG(inode->mode) || inode->link_count==0){
+        ssize_t error = S_ISREG(inode->mode) ? -ENOENT : -EINVAL;
+        free_memory(inode);
+        return error;
+    }
+    struct frag_stats stats;
+    if(!get_frag_stats(inode, &stats)){
+        free_memory(inode);
+        return -EIO;
+    }
+    if(stats.extents<=1){
+        // already in one run, or inline
+        free_memory(inode);
+        return 0;
+    }
+    ssize_t run_start = create_new_dblock_run(inode->alloc_goal, stats.mapped_blocks);
+    if(run_start==-1){
+        free_memory(inode);
+        return -ENOSPC;
+    }
+    // the new map is built next to the old one, indirect blocks go right after the run
+    struct iNode new_inode;
+    memcpy(&new_inode, inode, sizeof(struct iNode));
+    clear_block_map(&new_inode);
+    new_inode.alloc_goal = run_start + stats.mapped_blocks;
+    new_inode.alloc_blocks = stats.mapped_blocks;
+    struct defrag_state state = {&new_inode, run_start, 0};
+    bool status = walk_file_blocks(inode, move_fblock, &state);
+    // held through the swap and the release of the old blocks, no reader or writer sees either half-done
+    lock_inode(inum);
+    bool changed = inode_generations[inum % INODE_LOCK_COUNT]!=generation;
+    struct iNode* current = status && !changed ? read_inode(inum) : NULL;
+    if(current==NULL){
+        // failed, or the file was written to during the copy, the old map stays
+        drop_defrag_copy(&state, stats.mapped_blocks);
+        unlock_inode(inum);
+        free_memory(inode);
+        return status ? -EAGAIN : -EIO;
+    }
+    // only the map is swapped, times and link count changed since the copy are kept
+    copy_block_map(current, &new_inode);
+    current->alloc_goal = new_inode.alloc_goal;
+    // one inode write swaps in the whole new map, the old blocks are released after it
+    if(!write_inode(inum, current)){
+        drop_defrag_copy(&state, stats.mapped_blocks);
+        unlock_inode(inum);
+        free_memory(current);
+        free_memory(inode);
+        return -EIO;
     }
+    status = free_dblocks_from_inode(inode);
+    unlock_inode(inum);
+    free_memory(current);
     free_memory(inode);
-    return nbytes;
+    return status ? 0 : -EIO;
+}
+
+bool custom_statfs(struct statvfs* stat_buff){
+    memset(stat_buff, 0, sizeof(struct statvfs));
+    stat_buff->f_bsize = BLOCK_SIZE;
+    stat_buff->f_frsize = BLOCK_SIZE;
+    stat_buff->f_blocks = DATA_B_COUNT;
+    stat_buff->f_bfree = get_free_dblock_count();
+    stat_buff->f_bavail = stat_buff->f_bfree;
+    stat_buff->f_files = get_inode_count();
+    stat_buff->f_ffree = get_free_inode_count();
+    stat_buff->f_favail = stat_buff->f_ffree;
+    stat_buff->f_namemax = MAX_NAME_LENGTH;
+    return true;
 }
 
-bool add_new_entry(struct iNode* inode, ssize_t child_inode_num, char* child_name){
+bool add_new_entry(struct iNode* inode, ssize_t child_inode_num, char* child_name, mode_t child_mode){
     if(!S_ISDIR(inode->mode)){
         printf("not a directory\n");
         return false;
@@ -1112,113 +3022,172 @@ bool add_new_entry(struct iNode* inode, ssize_t child_inode_num, char* child_nam
         return false;
     }
     unsigned short short_name_length = name_length; // TODO : Play using int
-    // 8 + 8 + 2 + name_len
-    ssize_t new_entry_size = INODE_SZ + ADDRESS_PTR_SZ + STRING_LENGTH_SZ + short_name_length;
-    //if there is already a datablock for the dir file, we will add entry to it if it has space
-    if(inode->num_blocks!=0){
-        ssize_t dblock_num = fblock_num_to_dblock_num(inode, inode->num_blocks-1);
-        if(dblock_num<=0){
+    unsigned char type = DIR_ENTRY_TYPE(child_mode);
+    if(inode->is_indexed){
+        return add_indexed_entry(inode, child_inode_num, type, child_name, short_name_length);
+    }
+    /*
+    INUM(8) | RECORD_LEN/ADDR_PTR(8 - either record len / space left) | FILE_STR_LEN | FILE_NAME
+    addr_ptr for earlier records holds the len/size of record.
+    However, for the last record it holds the BLOCKSIZE-(sum of all prev records len)
+    For example, when the 1st entry is made to the block, the add_ptr holds the block size 4096
+    when a 2nd entry is made, the add_ptr of the 1st entry holds rec_len while the add_ptr of 2nd entry hols 4096-(sum of prev record len)
+    Hence, if BLOCK is able to accomodate more entries, it will be indicated in the add_ptr field of last entry.
+    */
+    // the entry goes in the first block with room for it, the space map skips the full ones without a read
+    // so holes left by unlinks anywhere in the directory are reused
+    ssize_t new_entry_size = DIR_ENTRY_SIZE(short_name_length);
+    for(ssize_t fblock_num=0; fblock_num<dir_block_count(inode); fblock_num++){
+        if(!inode->is_inline && dir_block_space(inode, fblock_num)<new_entry_size){
+            continue;
+        }
+        ssize_t dblock_num;
+        char* dblock = read_dir_block(inode, fblock_num, &dblock_num);
+        if(dblock==NULL){
             return false;
         }
-        char* dblock = read_dblock(dblock_num);
-        ssize_t curr_pos = 0;
-        while(curr_pos < BLOCK_SIZE){
-            /*
-            INUM(8) | RECORD_LEN/ADDR_PTR(8 - either record len / space left) | FILE_STR_LEN | FILE_NAME
-            addr_ptr for earlier records holds the len/size of record.
-            However, for the last record it holds the BLOCKSIZE-(sum of all prev records len)
-            this is fetched in next_entry. 
-            For example, when the 1st entry is made to the block, the add_ptr holds the block size 4096
-            when a 2nd entry is made, the add_ptr of the 1st entry holds rec_len while the add_ptr of 2nd entry hols 4096-(sum of prev record len)
-            Hence, if BLOCK is able to accomodate more entries, it will be indicated in the add_ptr field of last entry.
-            */      
-            ssize_t next_entry_offset_from_curr = ((ssize_t*)(dblock+curr_pos+INODE_SZ))[0]; // this gives record_len or space_left
-            unsigned short curr_entry_name_length = ((unsigned short* )(dblock+curr_pos+INODE_SZ+ADDRESS_PTR_SZ))[0];//len of filename/iname pointed by curr_pos
-            ssize_t curr_ptr_entry_length = INODE_SZ + ADDRESS_PTR_SZ + STRING_LENGTH_SZ + curr_entry_name_length;
-            // the following condition holds true only for the last entry of the dir and if the block is able to accomodate new entry. Until the we move the curr_pos
-            if(next_entry_offset_from_curr - curr_ptr_entry_length >= new_entry_size){
-                // updating curr entry addr with size of entry
-                ((ssize_t* )(dblock+curr_pos+INODE_SZ))[0] = curr_ptr_entry_length;
-                if(curr_ptr_entry_length<=0){
-                    // again just to be sure
-                    return false;
-                }
-                ssize_t addr_ptr = next_entry_offset_from_curr - curr_ptr_entry_length; // this is essentially 4096-(sum of all prev record len)
-                // This will even handle the padding.
-                curr_pos += curr_ptr_entry_length;
-                // add new entry
-                ((ssize_t*) (dblock+curr_pos))[0] = child_inode_num;
-                ((ssize_t*) (dblock+curr_pos+INODE_SZ))[0] = addr_ptr;
-                ((unsigned short*) (dblock+curr_pos+INODE_SZ+ADDRESS_PTR_SZ))[0] = short_name_length;
-                strncpy((char*) (dblock+curr_pos+INODE_SZ+ADDRESS_PTR_SZ+STRING_LENGTH_SZ), child_name, name_length);
-                if(!write_dblock(dblock_num, dblock)){
-                    printf("Writing new entry of dir to dblock failed\n");
-                    return false;
-                }
-                return true;
-            }
-            if(next_entry_offset_from_curr<=0){ // this will never be true unless there is a bug
-                printf("Could be a bug, check this\n");
-                return false;
+        bool added = insert_entry_in_block(dblock, child_inode_num, type, child_name, short_name_length);
+        bool status = !added || write_dir_block(inode, dblock_num, dblock);
+        note_dir_space(dblock_num, dblock);
+        free_memory(dblock);
+        if(added){
+            if(!status){
+                printf("Writing new entry of dir to dblock failed\n");
             }
-            // this will come here if diff is 0 or we can't accomodate in the current block
-            curr_pos += next_entry_offset_from_curr;
+            return status;
         }
-        free_memory(dblock);
     }
-    ssize_t dblock_num = create_new_dblock();
-    if(dblock_num<=0){
-        return false;
+    // a directory that keeps growing gets a hashed index instead of one more block to scan
+    if(!inode->is_inline && dir_block_count(inode) >= DIR_INDEX_THRESHOLD){
+        return convert_to_indexed(inode) && add_indexed_entry(inode, child_inode_num, type, child_name, short_name_length);
     }
     char dblock[BLOCK_SIZE];
     memset(dblock, 0, BLOCK_SIZE);
-    ((ssize_t*) dblock)[0] = child_inode_num;
-    ssize_t addr_ptr = BLOCK_SIZE;
-    ((ssize_t*) (dblock+INODE_SZ))[0] = addr_ptr;
-    ((unsigned short*) (dblock+INODE_SZ+ADDRESS_PTR_SZ))[0] = short_name_length;
-    strncpy((char*)(dblock+INODE_SZ+ADDRESS_PTR_SZ+STRING_LENGTH_SZ), child_name, name_length);
-    if(!write_dblock(dblock_num, dblock)){
-        printf("Could be a bug, check this\n");
+    write_dir_entry(dblock, 0, child_inode_num, BLOCK_SIZE, type, child_name, short_name_length);
+    if(inode->is_inline){
+        // first entry of an inline directory, it counts as one block
+        inode->file_size = BLOCK_SIZE;
+        return write_dir_block(inode, 0, dblock);
+    }
+    return append_dir_block(inode, dblock)!=-1;
+}
+
+
+// one throttled step of reclaim, orphan_lock has to be held
+static bool reclaim_orphan_step_locked(ssize_t max_blocks){
+    ssize_t inode_num = get_orphan_head();
+    if(inode_num==0){
         return false;
     }
-    //this part is modified. TODO: verify
-    if(!add_dblock_to_inode(inode, dblock_num)){
-        printf("couldn't add dblock to inode\n");
+    struct iNode* inode = read_inode(inode_num);
+    if(inode==NULL){
         return false;
     }
-    
-    inode->file_size += BLOCK_SIZE;
-    return true;
+    bool status = true;
+    if(inode->num_blocks>0){
+        // trimmed from the end, the inode on disk always maps exactly the blocks still owned
+        ssize_t keep_blocks = inode->num_blocks > max_blocks ? inode->num_blocks - max_blocks : 0;
+        status = remove_dblocks_from_inode(inode, keep_blocks) && write_inode(inode_num, inode);
+    }
+    else{
+        status = pop_orphan(inode_num);
+        DEBUG_PRINTF("Orphan inode %ld reclaimed\n", inode_num);
+    }
+    free_memory(inode);
+    return status;
+}
+
+bool reclaim_orphan_step(ssize_t max_blocks){
+    pthread_mutex_lock(&orphan_lock);
+    bool status = reclaim_orphan_step_locked(max_blocks);
+    pthread_mutex_unlock(&orphan_lock);
+    return status;
+}
+
+static void* reclaim_worker(void* arg){
+    pthread_mutex_lock(&orphan_lock);
+    while(reclaim_running){
+        if(get_orphan_head()==0){
+            pthread_cond_wait(&orphan_cond, &orphan_lock);
+            continue;
+        }
+        if(!reclaim_orphan_step_locked(RECLAIM_BATCH_BLOCKS)){
+            printf("Reclaim of orphan inode %ld failed, retrying later\n", get_orphan_head());
+        }
+        // let the fuse threads in between two batches
+        pthread_mutex_unlock(&orphan_lock);
+        usleep(RECLAIM_INTERVAL_US);
+        pthread_mutex_lock(&orphan_lock);
+    }
+    pthread_mutex_unlock(&orphan_lock);
+    return NULL;
+}
+
+bool start_reclaim_thread(){
+    pthread_mutex_lock(&orphan_lock);
+    bool status = true;
+    if(!reclaim_running){
+        reclaim_running = true;
+        if(pthread_create(&reclaim_thread, NULL, reclaim_worker, NULL)!=0){
+            printf("Could not start the reclaim thread\n");
+            reclaim_running = false;
+            status = false;
+        }
+    }
+    pthread_mutex_unlock(&orphan_lock);
+    return status;
+}
+
+void stop_reclaim_thread(){
+    pthread_mutex_lock(&orphan_lock);
+    if(!reclaim_running){
+        pthread_mutex_unlock(&orphan_lock);
+        return;
+    }
+    reclaim_running = false;
+    pthread_cond_signal(&orphan_cond);
+    pthread_mutex_unlock(&orphan_lock);
+    pthread_join(reclaim_thread, NULL);
 }
 
+bool sync_file_layer(){
+    return sync_superblock();
+}
 
 bool init_file_layer(){
-    if(!make_fs()){
+    if(!mount_fs()){
         return false;
     }
     struct iNode* root = read_inode(ROOT_INODE);
     if(root==NULL){
         return false;
     }
-    // TODO: If already created and re-mounting, just read inode works
-    // you can verify it by looking at allocated is true already
+    create_path_cache(&dentry_cache, CACHE_SIZE);
+    create_cache(&dir_space_cache, DIR_SPACE_CACHE_SIZE);
+    if(root->allocated){
+        // re-mounting, orphans left behind by a crash are picked up once the reclaim thread starts
+        printf("root dir found, orphan list head : %ld\n", get_orphan_head());
+        free_memory(root);
+        return true;
+    }
     root->allocated = true;
     root->link_count++;
     root->mode = S_IFDIR | DEFAULT_PERMS;
     root->num_blocks = 0;
+    root->is_inline = true;
     root->file_size = 0;
-    time_t curr_time = time(NULL);
+    struct timespec curr_time = current_time();
     root->access_time = curr_time;
     root->creation_time = curr_time;
     root->modification_time = curr_time;
     root->status_change_time = curr_time;
 
     char* root_name = ".";
-    if(!add_new_entry(root, ROOT_INODE, root_name)){
+    if(!add_new_entry(root, ROOT_INODE, root_name, S_IFDIR)){
         return false;
     }
     root_name = "..";
-    if(!add_new_entry(root, ROOT_INODE, root_name)){
+    if(!add_new_entry(root, ROOT_INODE, root_name, S_IFDIR)){
         return false;
     }
     if(!write_inode(ROOT_INODE, root)){
@@ -1227,7 +3196,6 @@ bool init_file_layer(){
     printf("root dir created\n");
     printf("No of dblocks for root:%ld\n",root->num_blocks);
     free_memory(root);
-    create_cache(&iname_cache, CACHE_SIZE);
     DEBUG_PRINTF("File layer initialization done \n");
     return true;
 }
@@ -19,6 +19,14 @@ static const struct fuse_operations fuse_ops = {
     .write    = charm_write,
     .utimens  = charm_utimens,
     .rename   = charm_rename,
+    .link     = charm_link,
+    .symlink  = charm_symlink,
+    .readlink = charm_readlink,
+    .fallocate= charm_fallocate,
+    .statfs   = charm_statfs,
+    .ioctl    = charm_ioctl,
+    .init     = charm_init,
+    .destroy  = charm_destroy,
 };
 
 // struct stat {
@@ -42,11 +50,34 @@ static int inode_to_stdbuff(struct iNode* inode, struct stat* stdbuff){
     stdbuff->st_rdev = 0;
     stdbuff->st_size = inode->file_size;
     stdbuff->st_blksize = BLOCK_SIZE;
-    stdbuff->st_blocks = inode->num_blocks;
+    // 512 byte units of what is allocated, holes take no space
+    stdbuff->st_blocks = inode->alloc_blocks * (BLOCK_SIZE / 512);
     // setting times
-    stdbuff->st_atime = inode->access_time;
-    stdbuff->st_ctime = inode->status_change_time;
-    stdbuff->st_mtime = inode->modification_time;
+    stdbuff->st_atim = inode->access_time;
+    stdbuff->st_ctim = inode->status_change_time;
+    stdbuff->st_mtim = inode->modification_time;
+    return 0;
+}
+
+static void* charm_init(struct fuse_conn_info* conn){
+    // started here rather than in main as fuse forks into the background after main
+    if(!start_reclaim_thread()){
+        printf("FUSE LAYER : unlinked files won't be reclaimed\n");
+    }
+    return NULL;
+}
+
+static void charm_destroy(void* private_data){
+    stop_reclaim_thread();
+    if(!sync_file_layer()){
+        printf("FUSE LAYER : free counters not written back, they are rebuilt at the next mount\n");
+    }
+}
+
+static int charm_statfs(const char* path, struct statvfs* stat_buff){
+    if(!custom_statfs(stat_buff)){
+        return -EIO;
+    }
     return 0;
 }
 
@@ -123,9 +154,25 @@ static int charm_read(const char* path, char* buff, size_t size, off_t offset, s
     return nbytes_read;
 }
 
+struct readdir_state{
+    void* buff;
+    fuse_fill_dir_t filler;
+};
+
+static bool fill_dir_entry(const char* name, ssize_t inode_num, unsigned char type, const struct iNode* inode,
+                           ssize_t next_offset, void* arg){
+    struct readdir_state* state = arg;
+    // the high level api passes only st_ino and the type bits to the kernel, attributes come with getattr
+    struct stat stdbuff;
+    memset(&stdbuff, 0, sizeof(struct stat));
+    stdbuff.st_ino = inode_num;
+    stdbuff.st_mode = DIR_TYPE_TO_MODE(type);
+    // a full reply buffer stops the walk, the kernel comes back with the offset of the last entry it took
+    return state->filler(state->buff, name, &stdbuff, next_offset)==0;
+}
+
 static int charm_readdir(const char* path, void* buff, fuse_fill_dir_t filler,
                          off_t offset, struct fuse_file_info* file_info){
-    (void) offset;
     (void) file_info;
     ssize_t inode_num = get_inode_num_from_path(path);
     if(inode_num==-1){
@@ -133,48 +180,13 @@ static int charm_readdir(const char* path, void* buff, fuse_fill_dir_t filler,
     }
     struct iNode* inode = read_inode(inode_num);
     if(!S_ISDIR(inode->mode)){
+        free_memory(inode);
         return -ENOTDIR;
     }
-    ssize_t num_blocks = inode->num_blocks;
-    for(ssize_t fblock_num=0; fblock_num<num_blocks; fblock_num++){
-        ssize_t dblock_num = fblock_num_to_dblock_num(inode, fblock_num);
-        char* dblock = read_dblock(dblock_num);
-        ssize_t offset = 0;
-        ssize_t next_entry_loc = 0;
-        while(offset<BLOCK_SIZE){
-            // reading inode
-            ssize_t file_inode_num;
-            memcpy(&file_inode_num, dblock+offset, INODE_SZ);
-            offset += INODE_SZ;
-            // space left or length to move
-            ssize_t entry_size; // could be either size left or how much to move
-            memcpy(&entry_size, dblock+offset, ADDRESS_PTR_SZ);
-            next_entry_loc += entry_size;
-            offset += ADDRESS_PTR_SZ;
-            // file size
-            unsigned short file_name_size;
-            memcpy(&file_name_size, dblock+offset, STRING_LENGTH_SZ);
-            offset += STRING_LENGTH_SZ;
-            // file name
-            char file_name[file_name_size+1];
-            file_name[file_name_size] = '\0';
-            memcpy(file_name, dblock+offset, file_name_size);
-            offset += file_name_size;
-            // pull inode and send through filler
-            struct iNode* file_inode = read_inode(file_inode_num);
-            struct stat stdbuff_data;
-            memset(&stdbuff_data, 0, sizeof(struct stat));
-            struct stat *stdbuff = &stdbuff_data;
-            inode_to_stdbuff(file_inode, stdbuff);
-            stdbuff->st_ino = file_inode_num;
-            filler(buff, file_name, stdbuff, 0);
-            offset = next_entry_loc;
-            free_memory(file_inode);
-        }
-        free_memory(dblock);
-    }
+    struct readdir_state state = {buff, filler};
+    bool status = walk_dir_entries(inode, offset, false, fill_dir_entry, &state);
     free_memory(inode);
-    return 0;
+    return status ? 0 : -EIO;
 }
 
 static int charm_rmdir(const char* path){
@@ -211,9 +223,9 @@ static int charm_utimens(const char* path, const struct timespec time_spec[2]){
 
 static int charm_truncate(const char* path, off_t offset){
     ssize_t status = custom_truncate(path, offset);
-    if(status==-1){
+    if(status<0){
         printf("FUSE LAYER : truncate unsuccessful\n");
-        return -1;
+        return status;
     }
     return 0;
 }
@@ -232,45 +244,85 @@ static int charm_write(const char* path, const char* buff, size_t size, off_t of
     return nbytes_wrote;
 }
 
+static int charm_fallocate(const char* path, int mode, off_t offset, off_t len, struct fuse_file_info* file_info){
+    if(offset<0 || len<=0){
+        return -EINVAL;
+    }
+    ssize_t status = custom_fallocate(path, mode, offset, len);
+    if(status<0){
+        printf("FUSE LAYER : fallocate unsuccessful\n");
+    }
+    return status;
+}
+
+static int charm_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* file_info, unsigned int flags, void* data){
+    ssize_t status;
+    switch(cmd){
+        case CHARM_IOC_DEFRAG:
+            status = custom_defrag(path);
+            if(status<0){
+                printf("FUSE LAYER : defrag unsuccessful\n");
+            }
+            return status;
+        case CHARM_IOC_FRAG_SCORE:
+            status = custom_frag_score(path);
+            if(status<0){
+                return status;
+            }
+            *(int*) data = status;
+            return 0;
+        case CHARM_IOC_COMPACT_DIR:
+            status = custom_compact_dir(path);
+            if(status<0){
+                printf("FUSE LAYER : compaction unsuccessful\n");
+                return status;
+            }
+            *(int*) data = status;
+            return 0;
+        default:
+            return -ENOTTY;
+    }
+}
+
 static int charm_rename(const char *from, const char *to)
 {
-    // Hacky approach - copy file to the new location and remove the old one
-    // check if from exists
-    struct fuse_file_info to_fi;
-    memset(&to_fi, 0, sizeof(to_fi));
-    if(charm_access(from, O_RDONLY)!=0){
-        printf("FUSE LAYER : from file exists\n");
-        return -errno;
+    // the entry moves between the directories, fuse 2 passes no renameat2 flags
+    ssize_t status = custom_rename(from, to, 0);
+    if(status<0){
+        printf("FUSE LAYER : rename unsuccessful\n");
+        return status;
     }
-    // check if to doesn't exist
-    if(charm_access(to, O_WRONLY | O_CREAT | O_EXCL)==0){
-        printf("FUSE LAYER : to file doesn't exist\n");
-        return -errno;
+    return 0;
+}
+
+static int charm_link(const char* from, const char* to){
+    ssize_t status = custom_link(from, to);
+    if(status<0){
+        printf("FUSE LAYER : link unsuccessful\n");
+        return status;
     }
-    // create to
-    to_fi.flags = O_WRONLY | O_CREAT | O_TRUNC;
-    if(charm_open(to, &to_fi)!=0){
-        printf("FUSE LAYER : created to file\n");
-        return -errno;
+    return 0;
+}
+
+static int charm_symlink(const char* target, const char* path){
+    ssize_t status = custom_symlink(target, path);
+    if(status<0){
+        printf("FUSE LAYER : symlink unsuccessful\n");
+        return status;
     }
-    // copy data from -> to
-    size_t offset = 0;
-    char buffer[BLOCK_SIZE];
-    memset(buffer, 0, BLOCK_SIZE);
-    size_t bytes_read, bytes_written;
-    while((bytes_read=custom_read(from, buffer, BLOCK_SIZE, offset))>0){
-        bytes_written = custom_write(to, (void*)buffer, bytes_read, offset);
-        if(bytes_read!=bytes_written){
-            return -errno;
-        }
-        offset += bytes_read;
+    return 0;
+}
+
+static int charm_readlink(const char* path, char* buff, size_t size){
+    if(size==0){
+        return -EINVAL;
     }
-    // delete from
-    if(custom_unlink(from)==-1){
-        printf("FUSE LAYER : removing old path\n");
-        return -errno;
+    // fuse wants the target null terminated, truncated to fit
+    ssize_t nbytes = custom_readlink(path, buff, size-1);
+    if(nbytes<0){
+        return nbytes;
     }
-    printf("FUSE LAYER : rename successful\n");
+    buff[nbytes] = '\0';
     return 0;
 }
 
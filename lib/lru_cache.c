@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "../include/lru_cache.h"
 
 unsigned long djb2_hash(const char *str)
@@ -57,40 +58,72 @@ void free_cache(struct lru_cache* cache) {
     free(cache);
 }
 
-void delete_node(struct lru_cache* cache, struct node* node) {
-    if (node == cache->head) {
-        cache->head = node->next;
-    } else if (node == cache->tail) {
-        cache->tail = node->prev;
+// Bucket of the hash map the key belongs to
+struct node** bucket_of(struct lru_cache* cache, const char* key) {
+    return &cache->map[djb2_hash(key) % cache->capacity];
+}
+
+// Find the node with the given key in its bucket chain
+struct node* find_node(struct lru_cache* cache, const char* key) {
+    struct node* curr = *bucket_of(cache, key);
+    while (curr != NULL && strcmp(curr->key, key) != 0) {
+        curr = curr->chain;
     }
+    return curr;
+}
+
+// Take the node out of the recency list, it stays in its bucket
+void unlink_node(struct lru_cache* cache, struct node* node) {
     if (node->prev != NULL) {
         node->prev->next = node->next;
+    } else {
+        cache->head = node->next;
     }
     if (node->next != NULL) {
         node->next->prev = node->prev;
+    } else {
+        cache->tail = node->prev;
     }
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+// Put the node at the front of the recency list
+void push_front(struct lru_cache* cache, struct node* node) {
+    node->prev = NULL;
+    node->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = node;
+    }
+    cache->head = node;
+    if (cache->tail == NULL) {
+        cache->tail = node;
+    }
+}
+
+// Remove the node from both the recency list and its bucket, then free it
+void delete_node(struct lru_cache* cache, struct node* node) {
+    unlink_node(cache, node);
+    struct node** link = bucket_of(cache, node->key);
+    while (*link != node) {
+        link = &(*link)->chain;
+    }
+    *link = node->chain;
+    cache->size--;
     free_node(node);
 }
 
 bool pop_cache(struct lru_cache* cache, const char* key){
     // Check for null values
     if (cache == NULL || key == NULL) {
-        return -1;
+        return false;
     }
-    // Find the node with the given key
-    unsigned long hash = djb2_hash(key);
-    ssize_t hash_index = hash % cache->capacity;
-    struct node* curr = cache->map[hash_index];
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            // remove node from the cache
-            delete_node(cache, curr);
-            cache->map[hash_index] = NULL;
-            return true;
-        }
-        curr = curr->next;
+    struct node* node = find_node(cache, key);
+    if (node == NULL) {
+        return false; // If the key is not found in the cache
     }
-    return false; // If the key is not found in the cache
+    delete_node(cache, node);
+    return true;
 }
 
 void set_cache(struct lru_cache* cache, const char* key, ssize_t value) {
@@ -99,34 +132,93 @@ void set_cache(struct lru_cache* cache, const char* key, ssize_t value) {
         return;
     }
     // Check if key already exists in cache
-    unsigned long hash = djb2_hash(key);
-    ssize_t hash_index = hash % cache->capacity;
-    struct node* curr = cache->map[hash_index];
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            curr->value = value;
-            // Move the node to the front of the cache
-            if (curr != cache->head) {
-                curr->prev->next = curr->next;
-                if (curr == cache->tail) {
-                    cache->tail = curr->prev;
-                } else {
-                    curr->next->prev = curr->prev;
-                }
-                curr->prev = NULL;
-                curr->next = cache->head;
-                cache->head->prev = curr;
-                cache->head = curr;
-            }
-            return;
-        }
-        curr = curr->next;
+    struct node* curr = find_node(cache, key);
+    if (curr != NULL) {
+        curr->value = value;
+        // Move the node to the front of the cache
+        unlink_node(cache, curr);
+        push_front(cache, curr);
+        return;
+    }
+    // If the cache is full, remove the least recently used node
+    if (cache->size >= cache->capacity) {
+        delete_node(cache, cache->tail);
     }
-    // Create a new node and add it to the front of the cache
+    // Create a new node and add it to the front of the cache and of its bucket
     struct node* node = (struct node*) malloc(sizeof(struct node));
     node->key = (char*) malloc(strlen(key) + 1);
     strcpy(node->key, key);
     node->value = value;
+    push_front(cache, node);
+    struct node** bucket = bucket_of(cache, key);
+    node->chain = *bucket;
+    *bucket = node;
+    cache->size++;
+}
+
+ssize_t get_cache(struct lru_cache* cache, const char* key){
+    // Check for null values
+    if (cache == NULL || key == NULL) {
+        return -1;
+    }
+    struct node* curr = find_node(cache, key);
+    if (curr == NULL) {
+        return -1; // If the key is not found in the cache
+    }
+    // Move the node to the front of the cache
+    unlink_node(cache, curr);
+    push_front(cache, curr);
+    return curr->value;
+}
+
+// Bucket of the hash map a child of parent with the given name belongs to
+static struct path_node** path_bucket_of(struct path_cache* cache, const struct path_node* parent,
+                                         const char* name, ssize_t name_length) {
+    unsigned long hash = 5381 ^ (unsigned long) (uintptr_t) parent;
+    for (ssize_t i = 0; i < name_length; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char) name[i];
+    }
+    return &cache->map[hash % cache->capacity];
+}
+
+static struct path_node* find_path_child(struct path_cache* cache, const struct path_node* parent,
+                                         const char* name, ssize_t name_length) {
+    struct path_node* curr = *path_bucket_of(cache, parent, name, name_length);
+    while (curr != NULL && (curr->parent != parent || curr->name_length != name_length ||
+                            memcmp(curr->name, name, name_length) != 0)) {
+        curr = curr->chain;
+    }
+    return curr;
+}
+
+// Next component of the path from *pos on, *pos is moved past it. Returns its length, 0 at the end
+static ssize_t next_component(const char* path, ssize_t path_len, ssize_t* pos, const char** name) {
+    while (*pos < path_len && path[*pos] == '/') {
+        (*pos)++;
+    }
+    *name = path + *pos;
+    while (*pos < path_len && path[*pos] != '/') {
+        (*pos)++;
+    }
+    return path + *pos - *name;
+}
+
+static void unlink_path_node(struct path_cache* cache, struct path_node* node) {
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        cache->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        cache->tail = node->prev;
+    }
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+static void push_path_front(struct path_cache* cache, struct path_node* node) {
     node->prev = NULL;
     node->next = cache->head;
     if (cache->head != NULL) {
@@ -136,42 +228,180 @@ void set_cache(struct lru_cache* cache, const char* key, ssize_t value) {
     if (cache->tail == NULL) {
         cache->tail = node;
     }
+}
+
+// Moves the node and then each of its ancestors to the front, so no parent is ever behind its children
+static void touch_path(struct path_cache* cache, struct path_node* node) {
+    while (node != cache->root) {
+        unlink_path_node(cache, node);
+        push_path_front(cache, node);
+        node = node->parent;
+    }
+}
+
+static struct path_node* new_path_node(struct path_cache* cache, struct path_node* parent,
+                                       const char* name, ssize_t name_length, ssize_t value) {
+    struct path_node* node = (struct path_node*) malloc(sizeof(struct path_node) + name_length);
+    memcpy(node->name, name, name_length);
+    node->name_length = name_length;
+    node->value = value;
+    node->parent = parent;
+    node->first_child = NULL;
+    node->prev_sibling = NULL;
+    node->next_sibling = parent->first_child;
+    if (parent->first_child != NULL) {
+        parent->first_child->prev_sibling = node;
+    }
+    parent->first_child = node;
+    struct path_node** bucket = path_bucket_of(cache, parent, name, name_length);
+    node->chain = *bucket;
+    *bucket = node;
+    node->prev = NULL;
+    node->next = NULL;
+    push_path_front(cache, node);
     cache->size++;
-    // If the cache is full, remove the least recently used node
-    if (cache->size > cache->capacity) {
-        delete_node(cache, cache->tail);
-        cache->size--;
+    return node;
+}
+
+// Takes a node without children out of the recency list, its bucket and its parent, then frees it
+static void remove_path_node(struct path_cache* cache, struct path_node* node) {
+    unlink_path_node(cache, node);
+    struct path_node** link = path_bucket_of(cache, node->parent, node->name, node->name_length);
+    while (*link != node) {
+        link = &(*link)->chain;
     }
-    cache->map[hash_index] = node;
+    *link = node->chain;
+    if (node->prev_sibling != NULL) {
+        node->prev_sibling->next_sibling = node->next_sibling;
+    } else {
+        node->parent->first_child = node->next_sibling;
+    }
+    if (node->next_sibling != NULL) {
+        node->next_sibling->prev_sibling = node->prev_sibling;
+    }
+    cache->size--;
+    free(node);
 }
 
-ssize_t get_cache(struct lru_cache* cache, const char* key){
-    // Check for null values
-    if (cache == NULL || key == NULL) {
+// Removes everything under the node, and the node itself unless it is the root
+static ssize_t drop_path_subtree(struct path_cache* cache, struct path_node* node) {
+    ssize_t dropped = 0;
+    // leaves go first, no recursion so deep paths don't grow the stack
+    struct path_node* curr = node;
+    while (curr != node || node->first_child != NULL) {
+        while (curr->first_child != NULL) {
+            curr = curr->first_child;
+        }
+        struct path_node* parent = curr->parent;
+        remove_path_node(cache, curr);
+        dropped++;
+        curr = parent;
+    }
+    if (node != cache->root) {
+        remove_path_node(cache, node);
+        dropped++;
+    }
+    return dropped;
+}
+
+void create_path_cache(struct path_cache* cache, ssize_t capacity) {
+    cache->root = (struct path_node*) calloc(1, sizeof(struct path_node));
+    cache->root->value = -1;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->size = 0;
+    cache->capacity = capacity;
+    cache->map = (struct path_node**) calloc(capacity, sizeof(struct path_node*));
+}
+
+ssize_t get_path_cache(struct path_cache* cache, const char* path, ssize_t* matched) {
+    if (matched != NULL) {
+        *matched = 0;
+    }
+    if (cache == NULL || path == NULL) {
         return -1;
     }
-    // Find the node with the given key
-    unsigned long hash = djb2_hash(key);
-    ssize_t hash_index = hash % cache->capacity;
-    struct node* curr = cache->map[hash_index];
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            // Move the node to the front of the cache
-            if (curr != cache->head) {
-                curr->prev->next = curr->next;
-                if (curr == cache->tail) {
-                    cache->tail = curr->prev;
-                } else {
-                    curr->next->prev = curr->prev;
-                }
-                curr->prev = NULL;
-                curr->next = cache->head;
-                cache->head->prev = curr;
-                cache->head = curr;
+    ssize_t path_len = strlen(path);
+    ssize_t pos = 0;
+    const char* name;
+    ssize_t name_length;
+    struct path_node* node = cache->root;
+    while ((name_length = next_component(path, path_len, &pos, &name)) > 0) {
+        struct path_node* child = find_path_child(cache, node, name, name_length);
+        if (child == NULL) {
+            break;
+        }
+        node = child;
+        if (matched != NULL) {
+            *matched = pos;
+        }
+    }
+    if (node == cache->root) {
+        return -1;
+    }
+    touch_path(cache, node);
+    return node->value;
+}
+
+bool set_path_cache(struct path_cache* cache, const char* path, ssize_t path_len, ssize_t value) {
+    if (cache == NULL || path == NULL) {
+        return false;
+    }
+    ssize_t pos = 0;
+    const char* name;
+    ssize_t name_length;
+    struct path_node* node = cache->root;
+    while ((name_length = next_component(path, path_len, &pos, &name)) > 0) {
+        struct path_node* child = find_path_child(cache, node, name, name_length);
+        if (child == NULL) {
+            ssize_t rest = pos;
+            const char* next_name;
+            if (next_component(path, path_len, &rest, &next_name) > 0) {
+                return false; // an ancestor isn't cached
             }
-            return curr->value;
+            // the parent's chain goes to the front first so the eviction can't take it
+            touch_path(cache, node);
+            if (cache->size >= cache->capacity && cache->tail != NULL && cache->tail != node) {
+                drop_path_subtree(cache, cache->tail);
+            }
+            child = new_path_node(cache, node, name, name_length, value);
+        }
+        node = child;
+    }
+    if (node == cache->root) {
+        return false;
+    }
+    if (node->value != value) {
+        // whatever was cached under the old value doesn't belong to the new one
+        while (node->first_child != NULL) {
+            drop_path_subtree(cache, node->first_child);
+        }
+        node->value = value;
+    }
+    touch_path(cache, node);
+    return true;
+}
+
+ssize_t pop_path_cache(struct path_cache* cache, const char* path) {
+    if (cache == NULL || path == NULL) {
+        return 0;
+    }
+    ssize_t path_len = strlen(path);
+    ssize_t pos = 0;
+    const char* name;
+    ssize_t name_length;
+    struct path_node* node = cache->root;
+    while ((name_length = next_component(path, path_len, &pos, &name)) > 0) {
+        node = find_path_child(cache, node, name, name_length);
+        if (node == NULL) {
+            return 0;
         }
-        curr = curr->next;
     }
-    return -1; // If the key is not found in the cache
+    return drop_path_subtree(cache, node);
+}
+
+void free_path_cache(struct path_cache* cache) {
+    drop_path_subtree(cache, cache->root);
+    free(cache->root);
+    free(cache->map);
 }
@@ -18,8 +18,12 @@ int check_superblock_init()
     struct superBlock *sb = (struct superBlock *)buffer;
     if (sb->inode_count != (INODE_B_COUNT) * sb->inodes_per_block ||
         sb->latest_inum != 3 ||
-        sb->inodes_per_block != (BLOCK_SIZE) / sizeof(struct iNode) ||
-        sb->free_list_head != INODE_B_COUNT + 1)
+        sb->inodes_per_block != (BLOCK_SIZE) / sizeof(struct disk_inode) ||
+        sb->inode_version != INODE_VERSION ||
+        sb->block_group_count != BLOCK_GROUP_COUNT ||
+        sb->blocks_per_group != BLOCKS_PER_GROUP ||
+        sb->free_inode_count != sb->inode_count - 3 ||
+        sb->free_dblock_count != DATA_B_COUNT)
     {
         printf("ERROR: Failed to check the initialization values of superblock.\n");
         return -1;
@@ -50,8 +54,8 @@ int print_superblock()
     }
     struct superBlock *sb = (struct superBlock *)buffer;
     printf("\n=====SUPERBLOCK STARTS=====\n");
-    printf("\nILIST SIZE: %ld\nNEXT AVAILABLE INUM: %ld\nINODES PER BLOCK: %ld\nFREE LIST HEAD: %ld\n",
-           sb->inode_count, sb->latest_inum, sb->inodes_per_block, sb->free_list_head);
+    printf("\nILIST SIZE: %ld\nNEXT AVAILABLE INUM: %ld\nINODES PER BLOCK: %ld\nBLOCK GROUPS: %ld\nFREE INODES: %ld\nFREE DBLOCKS: %ld\n",
+           sb->inode_count, sb->latest_inum, sb->inodes_per_block, sb->block_group_count, sb->free_inode_count, sb->free_dblock_count);
     printf("\n=====SUPERBLOCK ENDS=====\n\n");
     return 0;
 }
@@ -60,32 +64,31 @@ int print_superblock()
 void print_constants()
 {
     printf("\n==== FILE SYSTEM CONSTANTS =====\n");
-    printf("FILE SYSTEM SIZE: %ld MB\nBLOCK SIZE: %ld\nBLOCK COUNT: %ld\nADDRESS SIZE: %ld\nINODE BLOCK COUNT: %ld\nDATA BLOCK COUNT: %ld\nDBLOCKS PER BLOCK: %ld\nFREE LIST BLOCKS: %ld\n",
-           (FS_SIZE / (1024 * 1024)), BLOCK_SIZE, BLOCK_COUNT, ADDRESS_SIZE, INODE_B_COUNT,
-           DATA_B_COUNT, DBLOCKS_PER_BLOCK, FREE_LIST_BLOCKS);
+    printf("FILE SYSTEM SIZE: %ld MB\nBLOCK SIZE: %ld\nBLOCK COUNT: %ld\nADDRESS SIZE: %ld\nINODE BLOCK COUNT: %ld\nINODE BITMAP BLOCKS: %ld\nBLOCK BITMAP BLOCKS: %ld\nDATA BLOCK COUNT: %ld\nDBLOCKS PER BLOCK: %ld\nBLOCK GROUPS: %ld\n",
+           (FS_SIZE / (1024 * 1024)), BLOCK_SIZE, BLOCK_COUNT, ADDRESS_SIZE, INODE_B_COUNT, INODE_BITMAP_BLOCKS,
+           BLOCK_BITMAP_BLOCKS, DATA_B_COUNT, DBLOCKS_PER_BLOCK, BLOCK_GROUP_COUNT);
     printf("\n==== FILE SYSTEM CONSTANTS =====\n");
 }
 
-// Print a free list block
-void print_free_list_block(ssize_t freelist_block_num)
+// Print the block bitmap bytes covering the first dblocks
+void print_block_bitmap_block(ssize_t bitmap_block)
 {
-    char *block_buff = (char *)malloc(BLOCK_SIZE);
-    if (!read_block(freelist_block_num, block_buff))
+    unsigned char *block_buff = (unsigned char *)malloc(BLOCK_SIZE);
+    if (!read_block(BLOCK_BITMAP_START + bitmap_block, (char *)block_buff))
     {
-        printf("ERROR: Failed to read free list block.\n");
+        printf("ERROR: Failed to read block bitmap block.\n");
         return;
     }
-    printf("\n=== DUMP OF THE FREELIST BLOCK START ====\n");
-    ssize_t *dblock_num_ptr = (ssize_t *)block_buff;
+    printf("\n=== DUMP OF THE BLOCK BITMAP BLOCK START ====\n");
     for (size_t i = 0; i < DBLOCKS_PER_BLOCK / 8; i++)
     {
         for (size_t j = 0; j < 8; j++)
         {
-            printf("%ld ", dblock_num_ptr[i * 8 + j]);
+            printf("%02x ", block_buff[i * 8 + j]);
         }
         printf("\n");
     }
-    printf("\n==== DUMP OF THE FREELIST BLOCK END =====\n");
+    printf("\n==== DUMP OF THE BLOCK BITMAP BLOCK END =====\n");
 }
 
 // Print inode details
@@ -151,17 +154,23 @@ int main()
         }
     }
     struct superBlock *super_block = get_superblock();
-    printf("Freelist head: %ld Expected head: %ld\n\n", super_block->free_list_head, INODE_B_COUNT + 1 + DBLOCKS_PER_BLOCK);
+    printf("Free dblocks in group %ld: %ld\n\n", dblock_group(DATA_B_START), group_free_dblocks(dblock_group(DATA_B_START)));
     printf("BLOCK_LAYER_TEST 3 INFO: Dblock allocation, read and write consistency check - Passed!\n\n");
     // printf("size - %ld", sizeof(int));
     // Free any allocated block (freeing a properly known last head in this case)
-    if (!free_dblock(INODE_B_COUNT + 1))
+    if (!free_dblock(DATA_B_START))
     {
         printf("BLOCK_LAYER_TEST 4 ERROR: Error during dblock deallocation\n\n");
         return -1;
     }
     super_block = get_superblock();
-    printf("Freelist head: %ld Expected head: %ld\n\n", super_block->free_list_head, INODE_B_COUNT + 1);
+    // the lowest free dblock is handed out first when there is no goal
+    ssize_t reused = create_new_dblock();
+    if (reused != DATA_B_START || !free_dblock(reused))
+    {
+        printf("BLOCK_LAYER_TEST 4 ERROR: Freed dblock %ld not reused, got %ld\n\n", DATA_B_START, reused);
+        return -1;
+    }
     printf("BLOCK_LAYER_TEST 4 INFO: Dblock deallocation check - Passed!\n\n");
     // Check inode related functions
     ssize_t inode_num = 0;
@@ -236,5 +245,223 @@ int main()
     }
     // Inform the user that the inode free check has passed
     printf("BLOCK_LAYER_TEST 7 INFO: Inode free check - Passed!\n\n");
+    // Exhaust the inode table, the allocator must report it as full straight away
+    // the free counters reach the on-disk superblock at sync only
+    if (!sync_superblock())
+    {
+        printf("BLOCK_LAYER_TEST 8 ERROR: Could not sync the superblock\n");
+        return -1;
+    }
+    super_block = get_superblock();
+    ssize_t free_inodes = super_block->free_inode_count;
+    for (ssize_t i = 0; i < free_inodes; i++)
+    {
+        if (!is_valid_inum(create_new_inode()))
+        {
+            printf("BLOCK_LAYER_TEST 8 ERROR: Ran out of inodes after %ld of %ld\n", i, free_inodes);
+            return -1;
+        }
+    }
+    if (!sync_superblock())
+    {
+        printf("BLOCK_LAYER_TEST 8 ERROR: Could not sync the superblock\n");
+        return -1;
+    }
+    super_block = get_superblock();
+    if (super_block->free_inode_count != 0 || create_new_inode() != -1)
+    {
+        printf("BLOCK_LAYER_TEST 8 ERROR: Full inode table not detected\n");
+        return -1;
+    }
+    // A freed inode is the only candidate left, so it has to be handed out next
+    if (!free_inode(inode_num) || create_new_inode() != inode_num)
+    {
+        printf("BLOCK_LAYER_TEST 8 ERROR: Freed inode %ld was not reused\n", inode_num);
+        return -1;
+    }
+    printf("BLOCK_LAYER_TEST 8 INFO: Inode bitmap exhaustion and reuse check - Passed!\n\n");
+    // Free a few thousand dblocks in one batch, they coalesce back into free extents that have to
+    // hand every one of them out again exactly once
+    ssize_t batch_count = 3 * DBLOCKS_PER_BLOCK;
+    ssize_t *batch = (ssize_t *)malloc(batch_count * sizeof(ssize_t));
+    char *in_batch = (char *)calloc(BLOCK_COUNT, 1);
+    for (ssize_t i = 0; i < batch_count; i++)
+    {
+        batch[i] = create_new_dblock();
+        if (batch[i] < DATA_B_START)
+        {
+            printf("BLOCK_LAYER_TEST 9 ERROR: Error during new dblock creation\n\n");
+            return -1;
+        }
+        in_batch[batch[i]] = 1;
+    }
+    if (!free_dblocks(batch, batch_count))
+    {
+        printf("BLOCK_LAYER_TEST 9 ERROR: Error during batched dblock deallocation\n\n");
+        return -1;
+    }
+    for (ssize_t i = 0; i < batch_count; i++)
+    {
+        ssize_t dblock_num = create_new_dblock();
+        if (dblock_num < DATA_B_START || !in_batch[dblock_num])
+        {
+            printf("BLOCK_LAYER_TEST 9 ERROR: Dblock %ld was not part of the freed batch\n\n", dblock_num);
+            return -1;
+        }
+        // every freed dblock has to come back exactly once
+        in_batch[dblock_num] = 0;
+    }
+    free(in_batch);
+    free(batch);
+    printf("BLOCK_LAYER_TEST 9 INFO: Batched dblock deallocation check - Passed!\n\n");
+    // Allocation with a goal stays in the goal's group and runs forward from the goal
+    ssize_t group = least_used_group();
+    ssize_t group_free = group_free_dblocks(group);
+    ssize_t goal = group_first_dblock(group) + 10;
+    ssize_t prev = 0;
+    for (ssize_t i = 0; i < 4; i++)
+    {
+        ssize_t dblock_num = create_new_dblock_near(goal);
+        if (dblock_group(dblock_num) != group || (prev != 0 && dblock_num != prev + 1) || (prev == 0 && dblock_num != goal))
+        {
+            printf("BLOCK_LAYER_TEST 10 ERROR: Dblock %ld placed away from goal %ld in group %ld\n\n", dblock_num, goal, group);
+            return -1;
+        }
+        prev = dblock_num;
+        goal = dblock_num + 1;
+    }
+    if (group_free_dblocks(group) != group_free - 4)
+    {
+        printf("BLOCK_LAYER_TEST 10 ERROR: Expected %ld free dblocks in group %ld, Actual: %ld\n\n", group_free - 4, group, group_free_dblocks(group));
+        return -1;
+    }
+    // a goal at the end of a group spills into the next one instead of the start of the device
+    ssize_t last_group_end = (group + 1) * BLOCKS_PER_GROUP;
+    if (last_group_end < BLOCK_COUNT)
+    {
+        ssize_t dblock_num = create_new_dblock_near(last_group_end - 1);
+        ssize_t next_num = create_new_dblock_near(last_group_end - 1);
+        if (dblock_num != last_group_end - 1 || next_num != last_group_end)
+        {
+            printf("BLOCK_LAYER_TEST 10 ERROR: Expected dblocks %ld and %ld, Actual: %ld and %ld\n\n", last_group_end - 1, last_group_end, dblock_num, next_num);
+            return -1;
+        }
+    }
+    // the inode table is full since test 8, a freed inode of the group is the one found from the group start
+    ssize_t group_inode = (group - FIRST_DATA_GROUP + 1) * super_block->inode_count / DATA_GROUP_COUNT - 1;
+    if (inode_group(group_inode) != group || !free_inode(group_inode))
+    {
+        printf("BLOCK_LAYER_TEST 10 ERROR: Could not free inode %ld of group %ld\n\n", group_inode, group);
+        return -1;
+    }
+    inode_num = create_new_inode_in_group(group);
+    if (inode_num != group_inode)
+    {
+        printf("BLOCK_LAYER_TEST 10 ERROR: Expected inode %ld of group %ld, Actual: %ld\n\n", group_inode, group, inode_num);
+        return -1;
+    }
+    // the metadata at the front of the device takes no share of the inodes
+    if (inode_group(0) != FIRST_DATA_GROUP || inode_group(super_block->inode_count - 1) != BLOCK_GROUP_COUNT - 1 ||
+        dblock_group(DATA_B_START) != FIRST_DATA_GROUP)
+    {
+        printf("BLOCK_LAYER_TEST 10 ERROR: Expected inodes in groups %ld to %ld, Actual: %ld to %ld\n\n", FIRST_DATA_GROUP,
+               BLOCK_GROUP_COUNT - 1, inode_group(0), inode_group(super_block->inode_count - 1));
+        return -1;
+    }
+    printf("BLOCK_LAYER_TEST 10 INFO: Block group placement check - Passed!\n\n");
+    // The compact on-disk inode keeps every field through a write and read back
+    struct iNode *compact = (struct iNode *)calloc(1, sizeof(struct iNode));
+    compact->allocated = true;
+    compact->mode = S_IFREG | 0644;
+    compact->link_count = 3;
+    compact->file_size = (ssize_t)5 << 32;
+    compact->num_blocks = DIRECT_B_COUNT + 1;
+    compact->direct_blocks[0] = DATA_B_START;
+    compact->direct_blocks[1] = (DATA_B_START + 1) | UNWRITTEN_FLAG;
+    compact->single_indirect = BLOCK_COUNT - 1;
+    // timestamps keep their nanoseconds through the disk inode
+    compact->modification_time.tv_sec = 1700000000;
+    compact->modification_time.tv_nsec = 123456789;
+    if (!write_inode(inode_num, compact))
+    {
+        printf("BLOCK_LAYER_TEST 11 ERROR: Unable to write inode %ld\n\n", inode_num);
+        return -1;
+    }
+    rd_inode = read_inode(inode_num);
+    if (!rd_inode->allocated || rd_inode->is_inline || rd_inode->mode != compact->mode || rd_inode->link_count != 3 ||
+        rd_inode->file_size != compact->file_size || rd_inode->num_blocks != compact->num_blocks ||
+        rd_inode->direct_blocks[0] != DATA_B_START || rd_inode->direct_blocks[1] != compact->direct_blocks[1] ||
+        rd_inode->single_indirect != BLOCK_COUNT - 1 || rd_inode->modification_time.tv_sec != 1700000000 ||
+        rd_inode->modification_time.tv_nsec != 123456789)
+    {
+        printf("BLOCK_LAYER_TEST 11 ERROR: Inode %ld changed through the on-disk layout\n\n", inode_num);
+        return -1;
+    }
+    if (INODES_PER_BLOCK != BLOCK_SIZE / DISK_INODE_SIZE)
+    {
+        printf("BLOCK_LAYER_TEST 11 ERROR: Expected %ld inodes per block, Actual: %ld\n\n", BLOCK_SIZE / DISK_INODE_SIZE, INODES_PER_BLOCK);
+        return -1;
+    }
+    printf("BLOCK_LAYER_TEST 11 INFO: Compact on-disk inode check - Passed!\n\n");
+    // The free extent index hands out the first extent of the smallest size class that fits and merges freed neighbours
+    ssize_t run = create_new_dblock_run(0, 20);
+    if (run == -1 || free_extent_length(run) != 0)
+    {
+        printf("BLOCK_LAYER_TEST 12 ERROR: Could not take a run of 20 dblocks\n\n");
+        return -1;
+    }
+    ssize_t small_hole[3] = {run + 2, run + 3, run + 4};
+    ssize_t large_hole[8];
+    for (ssize_t i = 0; i < 8; i++)
+    {
+        large_hole[i] = run + 10 + i;
+    }
+    if (!free_dblocks(large_hole, 8) || !free_dblocks(small_hole, 3) ||
+        free_extent_length(run + 2) != 3 || free_extent_length(run + 10) != 8)
+    {
+        printf("BLOCK_LAYER_TEST 12 ERROR: Expected free extents of 3 and 8, Actual: %ld and %ld\n\n",
+               free_extent_length(run + 2), free_extent_length(run + 10));
+        return -1;
+    }
+    // 2 blocks fit every extent of the 2-3 class, 3 blocks go to the first extent of a class starting at 4 or above
+    ssize_t fit = create_new_dblock_run(0, 2);
+    if (fit != run + 2 || free_extent_length(run + 4) != 1 || free_extent_length(run + 10) != 8)
+    {
+        printf("BLOCK_LAYER_TEST 12 ERROR: Expected the run of 2 at %ld, Actual: %ld\n\n", run + 2, fit);
+        return -1;
+    }
+    fit = create_new_dblock_run(0, 3);
+    if (fit != run + 10 || free_extent_length(run + 13) != 5)
+    {
+        printf("BLOCK_LAYER_TEST 12 ERROR: Expected the run of 3 at %ld, Actual: %ld\n\n", run + 10, fit);
+        return -1;
+    }
+    ssize_t middle[5] = {run + 5, run + 6, run + 7, run + 8, run + 9};
+    if (!free_dblocks(middle, 5) || free_extent_length(run + 4) != 6)
+    {
+        printf("BLOCK_LAYER_TEST 12 ERROR: Expected a merged free extent of 6, Actual: %ld\n\n", free_extent_length(run + 4));
+        return -1;
+    }
+    printf("BLOCK_LAYER_TEST 12 INFO: Size class free extent index check - Passed!\n\n");
+    // Only a device without the magic may be formatted, a file system of another version is left alone
+    char super_buff[BLOCK_SIZE];
+    char changed_buff[BLOCK_SIZE];
+    if (!read_block(0, super_buff))
+    {
+        printf("BLOCK_LAYER_TEST 13 ERROR: Could not read the superblock\n\n");
+        return -1;
+    }
+    memcpy(changed_buff, super_buff, BLOCK_SIZE);
+    ((struct superBlock *)changed_buff)->inode_version = INODE_VERSION + 1;
+    enum fs_load_status newer_status = write_block(0, changed_buff) ? load_fs() : FS_LOADED;
+    ((struct superBlock *)changed_buff)->magic = 0;
+    enum fs_load_status blank_status = write_block(0, changed_buff) ? load_fs() : FS_LOADED;
+    if (!write_block(0, super_buff) || newer_status != FS_UNUSABLE || blank_status != FS_NOT_FOUND ||
+        get_inode_count() != INODE_B_COUNT * INODES_PER_BLOCK)
+    {
+        printf("BLOCK_LAYER_TEST 13 ERROR: Expected unusable and not found, Actual: %d and %d\n\n", newer_status, blank_status);
+        return -1;
+    }
+    printf("BLOCK_LAYER_TEST 13 INFO: Superblock version check - Passed!\n\n");
     return 0;
 }
@@ -0,0 +1,264 @@
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../../include/file_layer.h"
+
+// Directory scaling benchmark on the in-memory file layer, run with make bench_dir.
+// Every size goes through create, lookup, stat, readdir and unlink, once with all the
+// entries in one directory and once spread over a wide tree of sqrt(N) directories.
+
+#define BENCH_MIN_ENTRIES ((ssize_t) 1000)
+#define READDIR_BATCH ((ssize_t) 128) // entries per readdir call, about what one fuse reply holds
+
+// the layers log to stdout on every call, the report goes to a copy of the original stdout
+static FILE *report;
+
+struct phase_stats
+{
+    double *latencies; // seconds per op
+    ssize_t count;
+    double elapsed;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_latencies(const void *a, const void *b)
+{
+    double latency_a = *(const double *)a;
+    double latency_b = *(const double *)b;
+    return latency_a < latency_b ? -1 : (latency_a > latency_b ? 1 : 0);
+}
+
+static double percentile(const struct phase_stats *stats, double fraction)
+{
+    ssize_t index = (ssize_t)(fraction * (stats->count - 1));
+    return stats->latencies[index] * 1e6;
+}
+
+static void print_phase(const char *layout, ssize_t num_entries, const char *phase, struct phase_stats *stats, ssize_t ops)
+{
+    qsort(stats->latencies, stats->count, sizeof(double), compare_latencies);
+    fprintf(report, "%-6s %8ld  %-8s %12.0f %10.2f %10.2f %10.2f %10.2f\n", layout, num_entries, phase, ops / stats->elapsed,
+            percentile(stats, 0.5), percentile(stats, 0.9), percentile(stats, 0.99), percentile(stats, 1.0));
+    fflush(report);
+}
+
+static void fail(const char *what, const char *path)
+{
+    fprintf(report, "FAILED: %s %s\n", what, path);
+    exit(-1);
+}
+
+// path of entry i, the tree puts it in directory i % num_dirs
+static void entry_path(char *path, const char *base, ssize_t num_dirs, ssize_t i)
+{
+    if (num_dirs == 0)
+    {
+        sprintf(path, "%s/entry_%ld", base, i);
+    }
+    else
+    {
+        sprintf(path, "%s/d_%ld/entry_%ld", base, i % num_dirs, i);
+    }
+}
+
+struct readdir_batch
+{
+    ssize_t seen;
+    ssize_t next_offset;
+};
+
+static bool count_dir_entry(const char *name, ssize_t inode_num, unsigned char type, const struct iNode *inode,
+                            ssize_t next_offset, void *arg)
+{
+    struct readdir_batch *batch = arg;
+    if (batch->seen == READDIR_BATCH)
+    {
+        return false;
+    }
+    batch->seen++;
+    batch->next_offset = next_offset;
+    return true;
+}
+
+// lists a directory the way the kernel does, in batches resumed from the last offset
+static ssize_t list_dir(const char *path, struct phase_stats *stats)
+{
+    struct iNode *inode = read_inode(get_inode_num_from_path(path));
+    struct readdir_batch batch = {0, 0};
+    ssize_t total = 0;
+    do
+    {
+        batch.seen = 0;
+        double start = now();
+        if (!walk_dir_entries(inode, batch.next_offset, false, count_dir_entry, &batch))
+        {
+            fail("readdir of", path);
+        }
+        stats->latencies[stats->count++] = now() - start;
+        total += batch.seen;
+    } while (batch.seen == READDIR_BATCH);
+    free_memory(inode);
+    return total;
+}
+
+static void run_size(const char *layout, ssize_t num_entries, ssize_t num_dirs, double *latencies)
+{
+    char base[32];
+    char path[96];
+    sprintf(base, "/%s_%ld", layout, num_entries);
+    if (!custom_mkdir(base, S_IRWXU))
+    {
+        fail("mkdir", base);
+    }
+    for (ssize_t dir = 0; dir < num_dirs; dir++)
+    {
+        sprintf(path, "%s/d_%ld", base, dir);
+        if (!custom_mkdir(path, S_IRWXU))
+        {
+            fail("mkdir", path);
+        }
+    }
+    struct phase_stats stats = {latencies, 0, 0};
+
+    double phase_start = now();
+    for (ssize_t i = 0; i < num_entries; i++)
+    {
+        entry_path(path, base, num_dirs, i);
+        double start = now();
+        if (!custom_mknod(path, S_IFREG | S_IRUSR | S_IWUSR, 0))
+        {
+            fail("create", path);
+        }
+        latencies[i] = now() - start;
+    }
+    stats.count = num_entries;
+    stats.elapsed = now() - phase_start;
+    print_phase(layout, num_entries, "create", &stats, num_entries);
+
+    // a stride through the names so consecutive lookups don't hit neighbouring entries
+    phase_start = now();
+    for (ssize_t i = 0; i < num_entries; i++)
+    {
+        entry_path(path, base, num_dirs, (i * 7919) % num_entries);
+        double start = now();
+        if (get_inode_num_from_path(path) == -1)
+        {
+            fail("lookup", path);
+        }
+        latencies[i] = now() - start;
+    }
+    stats.elapsed = now() - phase_start;
+    print_phase(layout, num_entries, "lookup", &stats, num_entries);
+
+    // what getattr does, the path walk and the inode read
+    phase_start = now();
+    for (ssize_t i = 0; i < num_entries; i++)
+    {
+        entry_path(path, base, num_dirs, (i * 7919) % num_entries);
+        double start = now();
+        ssize_t inode_num = get_inode_num_from_path(path);
+        struct iNode *inode = inode_num == -1 ? NULL : read_inode(inode_num);
+        if (inode == NULL)
+        {
+            fail("stat", path);
+        }
+        free_memory(inode);
+        latencies[i] = now() - start;
+    }
+    stats.elapsed = now() - phase_start;
+    print_phase(layout, num_entries, "stat", &stats, num_entries);
+
+    stats.count = 0;
+    ssize_t listed = 0;
+    phase_start = now();
+    if (num_dirs == 0)
+    {
+        listed = list_dir(base, &stats) - 2;
+    }
+    for (ssize_t dir = 0; dir < num_dirs; dir++)
+    {
+        sprintf(path, "%s/d_%ld", base, dir);
+        listed += list_dir(path, &stats) - 2;
+    }
+    stats.elapsed = now() - phase_start;
+    if (listed != num_entries)
+    {
+        fail("readdir missed entries under", base);
+    }
+    // ops are entries listed, the latencies are per readdir call
+    print_phase(layout, num_entries, "readdir", &stats, listed);
+
+    phase_start = now();
+    for (ssize_t i = 0; i < num_entries; i++)
+    {
+        entry_path(path, base, num_dirs, i);
+        double start = now();
+        if (custom_unlink(path) != 0)
+        {
+            fail("unlink", path);
+        }
+        latencies[i] = now() - start;
+    }
+    stats.count = num_entries;
+    stats.elapsed = now() - phase_start;
+    print_phase(layout, num_entries, "unlink", &stats, num_entries);
+
+    // untimed, the next size starts from an empty file system
+    for (ssize_t dir = 0; dir < num_dirs; dir++)
+    {
+        sprintf(path, "%s/d_%ld", base, dir);
+        custom_unlink(path);
+    }
+    custom_unlink(base);
+    while (reclaim_orphan_step(RECLAIM_BATCH_BLOCKS))
+        ;
+}
+
+int main(int argc, char *argv[])
+{
+    ssize_t max_entries = argc > 1 ? atol(argv[1]) : 1000000;
+    if (max_entries < BENCH_MIN_ENTRIES)
+    {
+        printf("usage: %s [max entries, at least %ld]\n", argv[0], BENCH_MIN_ENTRIES);
+        return -1;
+    }
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        printf("Failed to set up the benchmark output\n");
+        return -1;
+    }
+    if (!init_file_layer())
+    {
+        fprintf(report, "Failed: init_file_layer() returned false\n");
+        return -1;
+    }
+    double *latencies = (double *)malloc(max_entries * sizeof(double));
+    if (latencies == NULL)
+    {
+        fprintf(report, "Failed to allocate %ld latency samples\n", max_entries);
+        return -1;
+    }
+    fprintf(report, "%-6s %8s  %-8s %12s %10s %10s %10s %10s\n", "layout", "entries", "phase", "ops/sec", "p50 us",
+            "p90 us", "p99 us", "max us");
+    for (ssize_t num_entries = BENCH_MIN_ENTRIES; num_entries <= max_entries; num_entries *= 10)
+    {
+        run_size("flat", num_entries, 0, latencies);
+        // sqrt(N) directories of sqrt(N) entries each
+        ssize_t num_dirs = 1;
+        while (num_dirs * num_dirs < num_entries)
+        {
+            num_dirs++;
+        }
+        run_size("tree", num_entries, num_dirs, latencies);
+    }
+    free(latencies);
+    fprintf(report, "Directory benchmark done.\n");
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include "../../include/file_layer.h"
 
 void mkdir_test()
@@ -145,24 +146,24 @@ void mk_file_test()
         printf("Found file: %s, inode number: %ld\n", file_path, inode_num);
         // Read the inode of the file and check if its timestamps are accurate
         struct iNode *inode = read_inode(inode_num);
-        if (!(inode->creation_time >= previous_time && inode->creation_time <= after_time))
+        if (!(inode->creation_time.tv_sec >= previous_time && inode->creation_time.tv_sec <= after_time))
         {
-            printf("Failed on file %s: birth time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->creation_time);
+            printf("Failed on file %s: birth time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->creation_time.tv_sec);
             exit(-1);
         }
-        else if (!(inode->access_time >= previous_time && inode->access_time <= after_time))
+        else if (!(inode->access_time.tv_sec >= previous_time && inode->access_time.tv_sec <= after_time))
         {
-            printf("Failed on file %s: access time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->access_time);
+            printf("Failed on file %s: access time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->access_time.tv_sec);
             exit(-1);
         }
-        else if (!(inode->status_change_time >= previous_time && inode->status_change_time <= after_time))
+        else if (!(inode->status_change_time.tv_sec >= previous_time && inode->status_change_time.tv_sec <= after_time))
         {
-            printf("Failed on file %s: change time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->status_change_time);
+            printf("Failed on file %s: change time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->status_change_time.tv_sec);
             exit(-1);
         }
-        else if (!(inode->modification_time >= previous_time && inode->modification_time <= after_time))
+        else if (!(inode->modification_time.tv_sec >= previous_time && inode->modification_time.tv_sec <= after_time))
         {
-            printf("Failed on file %s: modify time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->modification_time);
+            printf("Failed on file %s: modify time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->modification_time.tv_sec);
             exit(-1);
         }
         else
@@ -216,14 +217,14 @@ void write_test()
         exit(-1);
     }
     struct iNode *inode = read_inode(inode_num);
-    if (!(inode->access_time >= previous_time && inode->access_time <= after_time))
+    if (!(inode->access_time.tv_sec >= previous_time && inode->access_time.tv_sec <= after_time))
     {
-        printf("Failed on file %s: access time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->access_time);
+        printf("Failed on file %s: access time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->access_time.tv_sec);
         exit(-1);
     }
-    else if (!(inode->modification_time >= previous_time && inode->modification_time <= after_time))
+    else if (!(inode->modification_time.tv_sec >= previous_time && inode->modification_time.tv_sec <= after_time))
     {
-        printf("Failed on file %s: modify time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->modification_time);
+        printf("Failed on file %s: modify time should be between %ld and %ld, actual: %ld\n", file_path, previous_time, after_time, inode->modification_time.tv_sec);
         exit(-1);
     }
     else
@@ -536,6 +537,1672 @@ void unlink_root_test()
     }
 }
 
+void orphan_reclaim_test()
+{
+    printf("Testing background reclaim of unlinked files...\n");
+    char *path = "/orphan";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    // large enough to need a few throttled steps and a single indirect block
+    ssize_t nbytes = (DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT / 2) * BLOCK_SIZE;
+    char *data = (char *)malloc(nbytes);
+    memset(data, 'o', nbytes);
+    if (custom_write(path, data, nbytes, 0) != nbytes)
+    {
+        printf("FAILED to write %ld bytes to %s\n", nbytes, path);
+        exit(-1);
+    }
+    free(data);
+    ssize_t inode_num = get_inode_num_from_path(path);
+    if (custom_unlink(path) != 0 || get_inode_num_from_path(path) != -1)
+    {
+        printf("FAILED to unlink %s\n", path);
+        exit(-1);
+    }
+    // unlink only parks the inode, the blocks are still owned by it
+    if (get_orphan_head() != inode_num)
+    {
+        printf("FAILED: Expected orphan head %ld, Actual: %ld\n", inode_num, get_orphan_head());
+        exit(-1);
+    }
+    ssize_t steps = 0;
+    while (reclaim_orphan_step(64))
+    {
+        steps++;
+    }
+    struct iNode *inode = read_inode(inode_num);
+    if (get_orphan_head() != 0 || inode->allocated || inode->num_blocks != 0)
+    {
+        printf("FAILED: orphan %ld not reclaimed, head: %ld, blocks: %ld\n", inode_num, get_orphan_head(), inode->num_blocks);
+        exit(-1);
+    }
+    if (steps < 2)
+    {
+        printf("FAILED: Expected a throttled reclaim, done in %ld steps\n", steps);
+        exit(-1);
+    }
+    free_memory(inode);
+    printf("Background reclaim of unlinked files: PASSED in %ld steps\n", steps);
+}
+
+void fallocate_test()
+{
+    printf("Testing fallocate with unwritten blocks and hole punching...\n");
+    char *path = "/prealloc";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    ssize_t inode_num = get_inode_num_from_path(path);
+    ssize_t nbytes = 4 * BLOCK_SIZE;
+    if (custom_fallocate(path, 0, 0, nbytes) != 0)
+    {
+        printf("FAILED to preallocate %ld bytes for %s\n", nbytes, path);
+        exit(-1);
+    }
+    struct iNode *inode = read_inode(inode_num);
+    if (inode->file_size != nbytes || inode->num_blocks != 4 || !IS_UNWRITTEN(fblock_num_to_dblock_num(inode, 0)))
+    {
+        printf("FAILED: Expected 4 unwritten blocks of size %ld, Actual: %ld blocks of size %ld\n", nbytes, inode->num_blocks, inode->file_size);
+        exit(-1);
+    }
+    free_memory(inode);
+    char *data = (char *)malloc(nbytes);
+    memset(data, 'x', nbytes);
+    if (custom_read(path, data, nbytes, 0) != nbytes)
+    {
+        printf("FAILED to read preallocated %s\n", path);
+        exit(-1);
+    }
+    for (ssize_t i = 0; i < nbytes; i++)
+    {
+        if (data[i] != 0)
+        {
+            printf("FAILED: Expected zeros in preallocated range at %ld\n", i);
+            exit(-1);
+        }
+    }
+    // a write into the middle of an unwritten block keeps zeros around it
+    memset(data, 'p', 100);
+    if (custom_write(path, data, 100, BLOCK_SIZE + 50) != 100)
+    {
+        printf("FAILED to write into preallocated %s\n", path);
+        exit(-1);
+    }
+    if (custom_read(path, data, BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE || data[49] != 0 || data[50] != 'p' || data[149] != 'p' || data[150] != 0)
+    {
+        printf("FAILED: Unexpected data around the write into an unwritten block\n");
+        exit(-1);
+    }
+    // KEEP_SIZE allocates past the end without growing the file
+    if (custom_fallocate(path, FALLOC_FL_KEEP_SIZE, nbytes, 2 * BLOCK_SIZE) != 0)
+    {
+        printf("FAILED to preallocate with KEEP_SIZE for %s\n", path);
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    if (inode->file_size != nbytes || inode->num_blocks != 6)
+    {
+        printf("FAILED: Expected 6 blocks of size %ld, Actual: %ld blocks of size %ld\n", nbytes, inode->num_blocks, inode->file_size);
+        exit(-1);
+    }
+    free_memory(inode);
+    // punch the written block out and part of its neighbours
+    memset(data, 'w', nbytes);
+    custom_write(path, data, nbytes, 0);
+    if (custom_fallocate(path, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, BLOCK_SIZE - 10, BLOCK_SIZE + 20) != 0)
+    {
+        printf("FAILED to punch a hole in %s\n", path);
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    if (inode->file_size != nbytes || fblock_num_to_dblock_num(inode, 1) != 0 || inode->alloc_blocks != count_mapped_dblocks(inode))
+    {
+        printf("FAILED: Expected block 1 to be released, Actual: %ld, %ld blocks counted of %ld\n", fblock_num_to_dblock_num(inode, 1),
+               inode->alloc_blocks, count_mapped_dblocks(inode));
+        exit(-1);
+    }
+    free_memory(inode);
+    custom_read(path, data, nbytes, 0);
+    for (ssize_t i = 0; i < nbytes; i++)
+    {
+        char expected = (i >= BLOCK_SIZE - 10 && i < 2 * BLOCK_SIZE + 10) ? 0 : 'w';
+        if (data[i] != expected)
+        {
+            printf("FAILED: Expected %d at %ld after punching, Actual: %d\n", expected, i, data[i]);
+            exit(-1);
+        }
+    }
+    free(data);
+    if (custom_fallocate(path, FALLOC_FL_PUNCH_HOLE, 0, BLOCK_SIZE) != -EOPNOTSUPP)
+    {
+        printf("FAILED: Expected punching without KEEP_SIZE to be rejected\n");
+        exit(-1);
+    }
+    custom_unlink(path);
+    // a large range is taken as one run, the indirect blocks go after it instead of in between the data
+    path = "/prealloc_run";
+    ssize_t num_blocks = DIRECT_B_COUNT + 2 * SINGLE_INDIRECT_BLOCK_COUNT;
+    if (!custom_mknod(path, S_IFREG, 0) || custom_fallocate(path, 0, 0, num_blocks * BLOCK_SIZE) != 0)
+    {
+        printf("FAILED to preallocate %ld blocks for %s\n", num_blocks, path);
+        exit(-1);
+    }
+    inode = read_inode(get_inode_num_from_path(path));
+    ssize_t breaks = 0;
+    for (ssize_t fblock_num = 0; fblock_num < num_blocks; fblock_num++)
+    {
+        ssize_t entry = fblock_num_to_dblock_num(inode, fblock_num);
+        if (!IS_UNWRITTEN(entry))
+        {
+            printf("FAILED: Expected block %ld of %s to be unwritten, Actual: %ld\n", fblock_num, path, entry);
+            exit(-1);
+        }
+        if (fblock_num > 0 && DBLOCK_NUM(entry) != DBLOCK_NUM(fblock_num_to_dblock_num(inode, fblock_num - 1)) + 1)
+        {
+            breaks++;
+        }
+    }
+    free_memory(inode);
+    if (breaks > 0)
+    {
+        printf("FAILED: Expected the preallocated blocks in one run, Actual: %ld runs\n", breaks + 1);
+        exit(-1);
+    }
+    custom_unlink(path);
+    printf("fallocate with unwritten blocks and hole punching: PASSED\n");
+}
+
+void block_placement_test()
+{
+    printf("Testing block placement near the owning inode...\n");
+    ssize_t expected_group = least_used_group();
+    if (!custom_mkdir("/placed", S_IRWXU))
+    {
+        printf("FAILED to create dir: /placed\n");
+        exit(-1);
+    }
+    ssize_t dir_inode_num = get_inode_num_from_path("/placed");
+    if (inode_group(dir_inode_num) != expected_group)
+    {
+        printf("FAILED: Expected dir in group %ld, Actual: %ld\n", expected_group, inode_group(dir_inode_num));
+        exit(-1);
+    }
+    char *path = "/placed/file";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    ssize_t nbytes = (DIRECT_B_COUNT + 2) * BLOCK_SIZE;
+    char *data = (char *)malloc(nbytes);
+    memset(data, 'g', nbytes);
+    if (custom_write(path, data, nbytes, 0) != nbytes)
+    {
+        printf("FAILED to write %ld bytes to %s\n", nbytes, path);
+        exit(-1);
+    }
+    free(data);
+    ssize_t inode_num = get_inode_num_from_path(path);
+    struct iNode *inode = read_inode(inode_num);
+    if (inode_group(inode_num) != expected_group)
+    {
+        printf("FAILED: Expected file in group %ld of its dir, Actual: %ld\n", expected_group, inode_group(inode_num));
+        exit(-1);
+    }
+    // the data runs contiguously, the single indirect block sits in the run right after the first block it maps
+    for (ssize_t i = 0; i < inode->num_blocks; i++)
+    {
+        ssize_t dblock_num = fblock_num_to_dblock_num(inode, i);
+        ssize_t expected = fblock_num_to_dblock_num(inode, 0) + i + (i > DIRECT_B_COUNT ? 1 : 0);
+        if (dblock_group(dblock_num) != expected_group || dblock_num != expected)
+        {
+            printf("FAILED: Expected fblock %ld at dblock %ld, Actual: %ld\n", i, expected, dblock_num);
+            exit(-1);
+        }
+    }
+    if (inode->single_indirect != fblock_num_to_dblock_num(inode, DIRECT_B_COUNT) + 1)
+    {
+        printf("FAILED: Single indirect block %ld is away from its data\n", inode->single_indirect);
+        exit(-1);
+    }
+    free_memory(inode);
+    custom_unlink(path);
+    printf("Block placement near the owning inode: PASSED\n");
+}
+
+void statfs_test()
+{
+    printf("Testing statfs free space counters...\n");
+    struct statvfs before, created, after;
+    // files unlinked by earlier tests are still waiting to be reclaimed
+    while (reclaim_orphan_step(RECLAIM_BATCH_BLOCKS))
+    {
+    }
+    custom_statfs(&before);
+    if (before.f_blocks != DATA_B_COUNT || before.f_bfree > before.f_blocks || before.f_ffree > before.f_files)
+    {
+        printf("FAILED: Inconsistent statfs, blocks: %ld free: %ld files: %ld free: %ld\n",
+               before.f_blocks, before.f_bfree, before.f_files, before.f_ffree);
+        exit(-1);
+    }
+    char *path = "/counted";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    // the directory may have taken a block for the new entry
+    custom_statfs(&created);
+    ssize_t nbytes = 4 * BLOCK_SIZE;
+    char *data = (char *)malloc(nbytes);
+    memset(data, 'c', nbytes);
+    custom_write(path, data, nbytes, 0);
+    free(data);
+    custom_statfs(&after);
+    if (after.f_bfree != created.f_bfree - 4 || after.f_ffree != before.f_ffree - 1)
+    {
+        printf("FAILED: Expected %ld free blocks and %ld free inodes, Actual: %ld and %ld\n",
+               created.f_bfree - 4, before.f_ffree - 1, after.f_bfree, after.f_ffree);
+        exit(-1);
+    }
+    custom_unlink(path);
+    while (reclaim_orphan_step(RECLAIM_BATCH_BLOCKS))
+    {
+    }
+    custom_statfs(&after);
+    if (after.f_bfree != created.f_bfree || after.f_ffree != before.f_ffree)
+    {
+        printf("FAILED: Expected counters back at %ld blocks and %ld inodes, Actual: %ld and %ld\n",
+               created.f_bfree, before.f_ffree, after.f_bfree, after.f_ffree);
+        exit(-1);
+    }
+    printf("statfs free space counters: PASSED\n");
+}
+
+void inline_data_test()
+{
+    printf("Testing inline data for small files and directories...\n");
+    if (!custom_mkdir("/small", S_IRWXU))
+    {
+        printf("FAILED to create dir: /small\n");
+        exit(-1);
+    }
+    // "." and ".." alone fit in the inode
+    struct iNode *dir_inode = read_inode(get_inode_num_from_path("/small"));
+    if (!dir_inode->is_inline || dir_inode->num_blocks != 0 || dir_inode->file_size != BLOCK_SIZE)
+    {
+        printf("FAILED: Expected an inline dir, Actual: inline %d with %ld blocks\n", dir_inode->is_inline, dir_inode->num_blocks);
+        exit(-1);
+    }
+    free_memory(dir_inode);
+    char *path = "/small/config";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    char *config = "key=value\nother_key=other_value\n";
+    ssize_t nbytes = strlen(config);
+    if (custom_write(path, config, nbytes, 0) != nbytes)
+    {
+        printf("FAILED to write to %s\n", path);
+        exit(-1);
+    }
+    ssize_t inode_num = get_inode_num_from_path(path);
+    struct iNode *inode = read_inode(inode_num);
+    if (!inode->is_inline || inode->num_blocks != 0)
+    {
+        printf("FAILED: Expected an inline file, Actual: inline %d with %ld blocks\n", inode->is_inline, inode->num_blocks);
+        exit(-1);
+    }
+    free_memory(inode);
+    char read_buff[BLOCK_SIZE];
+    if (custom_read(path, read_buff, BLOCK_SIZE, 0) != nbytes || strncmp(read_buff, config, nbytes) != 0)
+    {
+        printf("FAILED: Inline data read back does not match\n");
+        exit(-1);
+    }
+    // growing past the inode moves the data to a block
+    char *tail = (char *)malloc(BLOCK_SIZE);
+    memset(tail, 't', BLOCK_SIZE);
+    if (custom_write(path, tail, BLOCK_SIZE, nbytes) != BLOCK_SIZE)
+    {
+        printf("FAILED to grow %s\n", path);
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    if (inode->is_inline || inode->num_blocks != 2 || inode->file_size != nbytes + BLOCK_SIZE)
+    {
+        printf("FAILED: Expected 2 blocks after growing, Actual: %ld blocks of size %ld\n", inode->num_blocks, inode->file_size);
+        exit(-1);
+    }
+    free_memory(inode);
+    if (custom_read(path, read_buff, BLOCK_SIZE, 0) != BLOCK_SIZE || strncmp(read_buff, config, nbytes) != 0 || read_buff[nbytes] != 't')
+    {
+        printf("FAILED: Data moved out of the inode does not match\n");
+        exit(-1);
+    }
+    free(tail);
+    // enough entries to spill the directory out of the inode
+    char file_path[32];
+    for (ssize_t i = 0; i < 8; i++)
+    {
+        sprintf(file_path, "/small/entry%ld", i);
+        if (!custom_mknod(file_path, S_IFREG, 0))
+        {
+            printf("FAILED to create file: %s\n", file_path);
+            exit(-1);
+        }
+    }
+    dir_inode = read_inode(get_inode_num_from_path("/small"));
+    if (dir_inode->is_inline || dir_inode->num_blocks != 1)
+    {
+        printf("FAILED: Expected the dir in one block, Actual: inline %d with %ld blocks\n", dir_inode->is_inline, dir_inode->num_blocks);
+        exit(-1);
+    }
+    for (ssize_t i = 0; i < 8; i++)
+    {
+        char name[16];
+        sprintf(name, "entry%ld", i);
+        struct file_pos_in_dir file = find_file(name, dir_inode);
+        if (file.start_pos == -1)
+        {
+            printf("FAILED to find %s after the dir left the inode\n", name);
+            exit(-1);
+        }
+        free_memory(file.dblock);
+        sprintf(file_path, "/small/entry%ld", i);
+        custom_unlink(file_path);
+    }
+    free_memory(dir_inode);
+    custom_unlink(path);
+    if (custom_unlink("/small") != 0)
+    {
+        printf("FAILED to remove the emptied dir /small\n");
+        exit(-1);
+    }
+    printf("Inline data for small files and directories: PASSED\n");
+}
+
+void sparse_file_test()
+{
+    printf("Testing sparse files with holes...\n");
+    char *path = "/sparse";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    while (reclaim_orphan_step(RECLAIM_BATCH_BLOCKS))
+    {
+    }
+    struct statvfs before, after;
+    custom_statfs(&before);
+    // a write deep into the double indirect range only allocates what it touches
+    ssize_t offset = (DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + 5) * BLOCK_SIZE + 100;
+    char *data = "data past a hole";
+    ssize_t nbytes = strlen(data);
+    if (custom_write(path, data, nbytes, offset) != nbytes)
+    {
+        printf("FAILED to write at offset %ld of %s\n", offset, path);
+        exit(-1);
+    }
+    custom_statfs(&after);
+    // the data block plus the double indirect block and one single indirect block under it
+    if (before.f_bfree - after.f_bfree != 3)
+    {
+        printf("FAILED: Expected 3 blocks allocated, Actual: %ld\n", before.f_bfree - after.f_bfree);
+        exit(-1);
+    }
+    ssize_t inode_num = get_inode_num_from_path(path);
+    struct iNode *inode = read_inode(inode_num);
+    if (inode->file_size != offset + nbytes || inode->single_indirect != 0 || fblock_num_to_dblock_num(inode, DIRECT_B_COUNT) != 0)
+    {
+        printf("FAILED: Expected size %ld with unmapped single indirect, Actual: size %ld\n", offset + nbytes, inode->file_size);
+        exit(-1);
+    }
+    // st_blocks counts what is allocated, not the blocks the size spans
+    if (count_mapped_dblocks(inode) != 3 || inode->alloc_blocks != 3)
+    {
+        printf("FAILED: Expected 3 mapped dblocks, Actual: %ld counted as %ld of %ld blocks\n", count_mapped_dblocks(inode),
+               inode->alloc_blocks, inode->num_blocks);
+        exit(-1);
+    }
+    free_memory(inode);
+    char *read_buff = (char *)malloc(offset + nbytes);
+    memset(read_buff, 'x', offset + nbytes);
+    if (custom_read(path, read_buff, offset + nbytes, 0) != offset + nbytes)
+    {
+        printf("FAILED to read %s across the hole\n", path);
+        exit(-1);
+    }
+    for (ssize_t i = 0; i < offset; i++)
+    {
+        if (read_buff[i] != 0)
+        {
+            printf("FAILED: Expected zeros in the hole at %ld\n", i);
+            exit(-1);
+        }
+    }
+    if (strncmp(read_buff + offset, data, nbytes) != 0)
+    {
+        printf("FAILED: Data after the hole does not match\n");
+        exit(-1);
+    }
+    free(read_buff);
+    // truncating up only grows the size
+    custom_statfs(&before);
+    ssize_t new_size = 100 * BLOCK_SIZE * SINGLE_INDIRECT_BLOCK_COUNT;
+    if (custom_truncate(path, new_size) != 0)
+    {
+        printf("FAILED to truncate %s up to %ld\n", path, new_size);
+        exit(-1);
+    }
+    custom_statfs(&after);
+    inode = read_inode(inode_num);
+    if (inode->file_size != new_size || after.f_bfree != before.f_bfree)
+    {
+        printf("FAILED: Expected size %ld without new blocks, Actual: size %ld, %ld blocks used\n",
+               new_size, inode->file_size, before.f_bfree - after.f_bfree);
+        exit(-1);
+    }
+    free_memory(inode);
+    char tail[16];
+    memset(tail, 'x', sizeof(tail));
+    if (custom_read(path, tail, sizeof(tail), new_size - sizeof(tail)) != sizeof(tail) || tail[0] != 0 || tail[15] != 0)
+    {
+        printf("FAILED: Expected zeros at the end of the grown file\n");
+        exit(-1);
+    }
+    // the block map ends at MAX_FILE_SIZE, nothing may go past it
+    ssize_t far_offset = 600L * 1024 * 1024 * 1024;
+    if (custom_write(path, tail, sizeof(tail), far_offset) != -EFBIG || custom_truncate(path, MAX_FILE_SIZE + 1) != -EFBIG ||
+        custom_fallocate(path, 0, MAX_FILE_SIZE - BLOCK_SIZE, 2 * BLOCK_SIZE) != -EFBIG)
+    {
+        printf("FAILED: Expected EFBIG past the maximum file size %ld\n", MAX_FILE_SIZE);
+        exit(-1);
+    }
+    memset(tail, 'm', sizeof(tail));
+    if (custom_write(path, tail, sizeof(tail), MAX_FILE_SIZE - 4) != 4)
+    {
+        printf("FAILED: Expected a write crossing the maximum file size to be cut to 4 bytes\n");
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    if (inode->file_size != MAX_FILE_SIZE || inode->num_blocks != MAX_FILE_BLOCKS)
+    {
+        printf("FAILED: Expected %ld blocks of size %ld, Actual: %ld blocks of size %ld\n", MAX_FILE_BLOCKS, MAX_FILE_SIZE,
+               inode->num_blocks, inode->file_size);
+        exit(-1);
+    }
+    free_memory(inode);
+    memset(tail, 0, sizeof(tail));
+    if (custom_read(path, tail, 4, MAX_FILE_SIZE - 4) != 4 || tail[0] != 'm' || tail[3] != 'm')
+    {
+        printf("FAILED: Expected the last bytes of the largest file back\n");
+        exit(-1);
+    }
+    // cut down in one go, the reclaim thread would trim the huge block map a batch at a time
+    custom_truncate(path, 0);
+    custom_unlink(path);
+    printf("Sparse files with holes: PASSED\n");
+}
+
+void seek_data_hole_test()
+{
+    printf("Testing SEEK_DATA and SEEK_HOLE...\n");
+    char *path = "/seekable";
+    if (!custom_mknod(path, S_IFREG, 0))
+    {
+        printf("FAILED to create file: %s\n", path);
+        exit(-1);
+    }
+    // data in block 2 and in a block of the double indirect range, holes everywhere else
+    char block[BLOCK_SIZE];
+    memset(block, 's', BLOCK_SIZE);
+    ssize_t far_block = DIRECT_B_COUNT + SINGLE_INDIRECT_BLOCK_COUNT + 3;
+    custom_write(path, block, BLOCK_SIZE, 2 * BLOCK_SIZE);
+    custom_write(path, block, BLOCK_SIZE, far_block * BLOCK_SIZE);
+    custom_truncate(path, (far_block + 4) * BLOCK_SIZE);
+    ssize_t expected[][3] = {
+        {0, SEEK_DATA, 2 * BLOCK_SIZE},
+        {0, SEEK_HOLE, 0},
+        {2 * BLOCK_SIZE + 7, SEEK_DATA, 2 * BLOCK_SIZE + 7},
+        {2 * BLOCK_SIZE + 7, SEEK_HOLE, 3 * BLOCK_SIZE},
+        {3 * BLOCK_SIZE, SEEK_DATA, far_block * BLOCK_SIZE},
+        {far_block * BLOCK_SIZE, SEEK_HOLE, (far_block + 1) * BLOCK_SIZE},
+        {(far_block + 1) * BLOCK_SIZE, SEEK_DATA, -ENXIO},
+        {(far_block + 1) * BLOCK_SIZE, SEEK_HOLE, (far_block + 1) * BLOCK_SIZE},
+        {(far_block + 4) * BLOCK_SIZE, SEEK_HOLE, -ENXIO},
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        ssize_t found = custom_lseek(path, expected[i][0], expected[i][1]);
+        if (found != expected[i][2])
+        {
+            printf("FAILED: %s from %ld, Expected: %ld, Actual: %ld\n", expected[i][1] == SEEK_DATA ? "SEEK_DATA" : "SEEK_HOLE",
+                   expected[i][0], expected[i][2], found);
+            exit(-1);
+        }
+    }
+    custom_unlink(path);
+    printf("SEEK_DATA and SEEK_HOLE: PASSED\n");
+}
+
+void defrag_test()
+{
+    printf("Testing online defragmentation...\n");
+    char *paths[2] = {"/frag_a", "/frag_b"};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!custom_mknod(paths[i], S_IFREG, 0))
+        {
+            printf("FAILED to create file: %s\n", paths[i]);
+            exit(-1);
+        }
+    }
+    // writing both files a block at a time interleaves their blocks on the device
+    ssize_t block_count = DIRECT_B_COUNT + 10;
+    char block[BLOCK_SIZE];
+    for (ssize_t fblock = 0; fblock < block_count; fblock++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            memset(block, 'a' + (fblock + i) % 26, BLOCK_SIZE);
+            custom_write(paths[i], block, BLOCK_SIZE, fblock * BLOCK_SIZE);
+        }
+    }
+    ssize_t score = custom_frag_score(paths[0]);
+    if (score != 100)
+    {
+        printf("FAILED: Expected fragmentation score 100, Actual: %ld\n", score);
+        exit(-1);
+    }
+    while (reclaim_orphan_step(RECLAIM_BATCH_BLOCKS))
+    {
+    }
+    struct statvfs before, after;
+    custom_statfs(&before);
+    if (custom_defrag(paths[0]) != 0)
+    {
+        printf("FAILED to defragment %s\n", paths[0]);
+        exit(-1);
+    }
+    custom_statfs(&after);
+    score = custom_frag_score(paths[0]);
+    if (score != 0 || before.f_bfree != after.f_bfree)
+    {
+        printf("FAILED: Expected score 0 and no block leaked, Actual: score %ld, %ld blocks used\n",
+               score, before.f_bfree - after.f_bfree);
+        exit(-1);
+    }
+    struct iNode *inode = read_inode(get_inode_num_from_path(paths[0]));
+    if (inode->alloc_blocks != count_mapped_dblocks(inode))
+    {
+        printf("FAILED: Expected the new map to count %ld blocks, Actual: %ld\n", count_mapped_dblocks(inode), inode->alloc_blocks);
+        exit(-1);
+    }
+    free_memory(inode);
+    char read_buff[BLOCK_SIZE];
+    for (ssize_t fblock = 0; fblock < block_count; fblock++)
+    {
+        memset(block, 'a' + fblock % 26, BLOCK_SIZE);
+        if (custom_read(paths[0], read_buff, BLOCK_SIZE, fblock * BLOCK_SIZE) != BLOCK_SIZE ||
+            memcmp(block, read_buff, BLOCK_SIZE) != 0)
+        {
+            printf("FAILED: Data of block %ld changed by the defragmentation\n", fblock);
+            exit(-1);
+        }
+    }
+    // a file in one run is left alone
+    if (custom_defrag(paths[0]) != 0 || custom_frag_score(paths[0]) != 0)
+    {
+        printf("FAILED: Expected a contiguous file to stay as it is\n");
+        exit(-1);
+    }
+    custom_unlink(paths[0]);
+    custom_unlink(paths[1]);
+    printf("Online defragmentation: PASSED\n");
+}
+
+#define DEFRAG_RACE_BLOCKS ((ssize_t) 2048) // a copy long enough to span several scheduler time slices
+#define DEFRAG_RACE_ROUNDS 10
+
+struct defrag_writer
+{
+    const char *path;
+    volatile bool stop;
+    volatile ssize_t writes;
+    char last[DEFRAG_RACE_BLOCKS]; // byte each block was last written with
+};
+
+// keeps overwriting blocks of the file in place until told to stop
+static void *overwrite_blocks(void *arg)
+{
+    struct defrag_writer *writer = arg;
+    char block[BLOCK_SIZE];
+    for (ssize_t i = 0; !writer->stop; i++)
+    {
+        ssize_t fblock = (i * 37) % DEFRAG_RACE_BLOCKS;
+        char value = 'A' + i % 26;
+        memset(block, value, BLOCK_SIZE);
+        if (custom_write(writer->path, block, BLOCK_SIZE, fblock * BLOCK_SIZE) != BLOCK_SIZE)
+        {
+            printf("FAILED to overwrite block %ld of %s\n", fblock, writer->path);
+            exit(-1);
+        }
+        writer->last[fblock] = value;
+        writer->writes++;
+    }
+    return NULL;
+}
+
+void defrag_during_write_test()
+{
+    printf("Testing defragmentation while the file is written...\n");
+    char *paths[2] = {"/race_a", "/race_b"};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!custom_mknod(paths[i], S_IFREG, 0))
+        {
+            printf("FAILED to create file: %s\n", paths[i]);
+            exit(-1);
+        }
+    }
+    struct defrag_writer writer;
+    writer.path = paths[0];
+    char block[BLOCK_SIZE];
+    char read_buff[BLOCK_SIZE];
+    ssize_t done = 0, retried = 0;
+    for (int round = 0; round < DEFRAG_RACE_ROUNDS; round++)
+    {
+        // rewriting both files from scratch a block at a time interleaves them again
+        for (int i = 0; i < 2; i++)
+        {
+            custom_truncate(paths[i], 0);
+        }
+        for (ssize_t fblock = 0; fblock < DEFRAG_RACE_BLOCKS; fblock++)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                memset(block, 'a' + (fblock + i) % 26, BLOCK_SIZE);
+                custom_write(paths[i], block, BLOCK_SIZE, fblock * BLOCK_SIZE);
+            }
+            writer.last[fblock] = 'a' + fblock % 26;
+        }
+        writer.stop = false;
+        writer.writes = 0;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, overwrite_blocks, &writer) != 0)
+        {
+            printf("FAILED to start the writer thread\n");
+            exit(-1);
+        }
+        while (writer.writes < 10)
+        {
+            usleep(100);
+        }
+        // every attempt either swaps in a map with all the writes or gives up on the copy
+        bool defragmented = false;
+        for (int attempt = 0; attempt < 20 && !defragmented; attempt++)
+        {
+            ssize_t status = custom_defrag(paths[0]);
+            if (status != 0 && status != -EAGAIN)
+            {
+                printf("FAILED: Expected 0 or -EAGAIN from the defragmentation, Actual: %ld\n", status);
+                exit(-1);
+            }
+            defragmented = status == 0;
+            retried += status == -EAGAIN;
+        }
+        done += defragmented;
+        writer.stop = true;
+        pthread_join(thread, NULL);
+        for (ssize_t fblock = 0; fblock < DEFRAG_RACE_BLOCKS; fblock++)
+        {
+            memset(block, writer.last[fblock], BLOCK_SIZE);
+            if (custom_read(paths[0], read_buff, BLOCK_SIZE, fblock * BLOCK_SIZE) != BLOCK_SIZE ||
+                memcmp(block, read_buff, BLOCK_SIZE) != 0)
+            {
+                printf("FAILED: Block %ld lost a write made during the defragmentation in round %d\n", fblock, round);
+                exit(-1);
+            }
+        }
+    }
+    printf("Rounds defragmented: %ld of %d, copies given up: %ld\n", done, DEFRAG_RACE_ROUNDS, retried);
+    custom_unlink(paths[0]);
+    custom_unlink(paths[1]);
+    printf("Defragmentation during writes: PASSED\n");
+}
+
+void dir_index_test()
+{
+    printf("Testing hashed directory index...\n");
+    if (!custom_mkdir("/indexed", S_IRWXU))
+    {
+        printf("FAILED to create dir: /indexed\n");
+        exit(-1);
+    }
+    // long names fill the leaves quickly, enough of them to need a second index level
+    ssize_t file_count = 40000;
+    char path[64];
+    for (ssize_t i = 0; i < file_count; i++)
+    {
+        snprintf(path, sizeof(path), "/indexed/entry-with-a-longer-name-%06ld", i);
+        if (!custom_mknod(path, S_IFREG, 0))
+        {
+            printf("FAILED to create file: %s\n", path);
+            exit(-1);
+        }
+    }
+    struct iNode *dir_inode = read_inode(get_inode_num_from_path("/indexed"));
+    ssize_t dblock_num;
+    char *root = read_dir_block(dir_inode, 0, &dblock_num);
+    struct dx_header *header = (struct dx_header *)(root + DX_ROOT_OFFSET);
+    if (!dir_inode->is_indexed || header->levels != 2)
+    {
+        printf("FAILED: Expected an index of 2 levels, Actual: indexed %d with %u levels\n", dir_inode->is_indexed, header->levels);
+        exit(-1);
+    }
+    free(root);
+    free_memory(dir_inode);
+    for (ssize_t i = 0; i < file_count; i += 2)
+    {
+        snprintf(path, sizeof(path), "/indexed/entry-with-a-longer-name-%06ld", i);
+        if (custom_unlink(path) != 0)
+        {
+            printf("FAILED to unlink %s\n", path);
+            exit(-1);
+        }
+    }
+    // lookups go through the index, the path cache is bypassed by asking the directory itself
+    dir_inode = read_inode(get_inode_num_from_path("/indexed"));
+    char name[64];
+    for (ssize_t i = 0; i < file_count; i++)
+    {
+        snprintf(name, sizeof(name), "entry-with-a-longer-name-%06ld", i);
+        struct file_pos_in_dir file = find_file(name, dir_inode);
+        if ((file.start_pos != -1) != (i % 2 == 1))
+        {
+            printf("FAILED: Expected %s to be %s\n", name, i % 2 == 1 ? "found" : "gone");
+            exit(-1);
+        }
+        free_memory(file.dblock);
+    }
+    free_memory(dir_inode);
+    for (ssize_t i = 1; i < file_count; i += 2)
+    {
+        snprintf(path, sizeof(path), "/indexed/entry-with-a-longer-name-%06ld", i);
+        if (custom_unlink(path) != 0)
+        {
+            printf("FAILED to unlink %s\n", path);
+            exit(-1);
+        }
+    }
+    // unlink leaves the emptied leaves in place for readdir cookies, compaction takes the directory back to a single linear block
+    if (custom_compact_dir("/indexed") <= 0)
+    {
+        printf("FAILED to compact the emptied dir /indexed\n");
+        exit(-1);
+    }
+    dir_inode = read_inode(get_inode_num_from_path("/indexed"));
+    if (dir_inode->is_indexed || dir_inode->num_blocks != 1)
+    {
+        printf("FAILED: Expected an empty linear dir of 1 block, Actual: indexed %d with %ld blocks\n",
+               dir_inode->is_indexed, dir_inode->num_blocks);
+        exit(-1);
+    }
+    free_memory(dir_inode);
+    if (custom_unlink("/indexed") != 0)
+    {
+        printf("FAILED to remove the emptied dir /indexed\n");
+        exit(-1);
+    }
+    printf("Hashed directory index: PASSED\n");
+}
+
+void dentry_cache_test()
+{
+    printf("Testing the dentry cache...\n");
+    if (!custom_mkdir("/dcache", S_IRWXU) || !custom_mkdir("/dcache/sub", S_IRWXU) || !custom_mknod("/dcache/sub/leaf", S_IFREG, 0))
+    {
+        printf("FAILED to create /dcache/sub/leaf\n");
+        exit(-1);
+    }
+    ssize_t sub_inode_num = get_inode_num_from_path("/dcache/sub");
+    ssize_t leaf_inode_num = get_inode_num_from_path("//dcache/sub//leaf");
+    // the walk leaves one entry per component, repeated slashes count as one
+    if (leaf_inode_num == -1 || lookup_dentry("/dcache/sub/leaf") != leaf_inode_num ||
+        lookup_dentry("/dcache/sub/") != sub_inode_num)
+    {
+        printf("FAILED: Expected the components of /dcache/sub/leaf in the dentry cache\n");
+        exit(-1);
+    }
+    if (custom_unlink("/dcache/sub/leaf") != 0 || lookup_dentry("/dcache/sub/leaf") != -1 ||
+        get_inode_num_from_path("/dcache/sub/leaf") != -1)
+    {
+        printf("FAILED: Expected the dentry of an unlinked file to be dropped\n");
+        exit(-1);
+    }
+    if (!custom_mkdir("/dcache/sub/leaf", S_IRWXU) || get_inode_num_from_path("/dcache/sub/leaf") == -1 ||
+        get_inode_num_from_path("/dcache/sub/leaf/missing") != -1)
+    {
+        printf("FAILED: Expected the new /dcache/sub/leaf to be found\n");
+        exit(-1);
+    }
+    custom_unlink("/dcache/sub/leaf");
+    custom_unlink("/dcache/sub");
+    custom_unlink("/dcache");
+    printf("Dentry cache: PASSED\n");
+}
+
+void negative_dentry_test()
+{
+    printf("Testing negative dentries...\n");
+    if (!custom_mkdir("/neg", S_IRWXU))
+    {
+        printf("FAILED to create dir: /neg\n");
+        exit(-1);
+    }
+    if (get_inode_num_from_path("/neg/probe") != -1 || lookup_dentry("/neg/probe") != NEGATIVE_DENTRY)
+    {
+        printf("FAILED: Expected a negative dentry for /neg/probe\n");
+        exit(-1);
+    }
+    // a second miss is answered from the cache
+    if (get_inode_num_from_path("/neg/probe") != -1)
+    {
+        printf("FAILED: Expected /neg/probe to stay missing\n");
+        exit(-1);
+    }
+    // creating the name replaces the negative entry
+    if (!custom_mknod("/neg/probe", S_IFREG, 0))
+    {
+        printf("FAILED to create file: /neg/probe\n");
+        exit(-1);
+    }
+    ssize_t inode_num = get_inode_num_from_path("/neg/probe");
+    if (inode_num == -1 || lookup_dentry("/neg/probe") != inode_num)
+    {
+        printf("FAILED: Expected /neg/probe to be found after its creation, Actual: %ld\n", inode_num);
+        exit(-1);
+    }
+    custom_unlink("/neg/probe");
+    custom_unlink("/neg");
+    printf("Negative dentries: PASSED\n");
+}
+
+#define DENTRY_RACE_ROUNDS 500
+
+struct dentry_prober
+{
+    char path[64];
+    volatile bool stop;
+    volatile ssize_t lookups;
+};
+
+// keeps looking the path up, so its cache entry gets written while the name comes and goes
+static void *probe_path(void *arg)
+{
+    struct dentry_prober *prober = arg;
+    while (!prober->stop)
+    {
+        get_inode_num_from_path(prober->path);
+        prober->lookups++;
+    }
+    return NULL;
+}
+
+void negative_dentry_race_test()
+{
+    printf("Testing negative dentries against concurrent creates...\n");
+    if (!custom_mkdir("/negrace", S_IRWXU))
+    {
+        printf("FAILED to create dir: /negrace\n");
+        exit(-1);
+    }
+    struct dentry_prober prober;
+    for (int round = 0; round < DENTRY_RACE_ROUNDS; round++)
+    {
+        sprintf(prober.path, "/negrace/f%d", round);
+        prober.stop = false;
+        prober.lookups = 0;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, probe_path, &prober) != 0)
+        {
+            printf("FAILED to start the lookup thread\n");
+            exit(-1);
+        }
+        while (prober.lookups < 2)
+        {
+            usleep(10);
+        }
+        // a lookup that missed before the create must not leave its miss cached after it
+        if (!custom_mknod(prober.path, S_IFREG, 0))
+        {
+            printf("FAILED to create file: %s\n", prober.path);
+            exit(-1);
+        }
+        ssize_t lookups = prober.lookups;
+        while (prober.lookups < lookups + 2)
+        {
+            usleep(10);
+        }
+        ssize_t inode_num = get_inode_num_from_path(prober.path);
+        if (inode_num == -1 || lookup_dentry(prober.path) != inode_num)
+        {
+            printf("FAILED: Expected %s to be found after its creation in round %d\n", prober.path, round);
+            exit(-1);
+        }
+        // nor a hit from before the unlink stay cached after it
+        custom_unlink(prober.path);
+        prober.stop = true;
+        pthread_join(thread, NULL);
+        if (get_inode_num_from_path(prober.path) != -1)
+        {
+            printf("FAILED: Expected %s to be gone after its unlink in round %d\n", prober.path, round);
+            exit(-1);
+        }
+    }
+    custom_unlink("/negrace");
+    printf("Negative dentries against concurrent creates: PASSED\n");
+}
+
+void rename_test()
+{
+    printf("Testing rename...\n");
+    if (!custom_mkdir("/rendir", S_IRWXU) || !custom_mknod("/ren_a", S_IFREG, 0) || !custom_mknod("/rendir/c", S_IFREG, 0))
+    {
+        printf("FAILED to create the files to rename\n");
+        exit(-1);
+    }
+    ssize_t nbytes = 3 * BLOCK_SIZE;
+    char *data = (char *)malloc(nbytes);
+    memset(data, 'r', nbytes);
+    custom_write("/ren_a", data, nbytes, 0);
+    ssize_t inode_num = get_inode_num_from_path("/ren_a");
+    struct iNode *inode = read_inode(inode_num);
+    ssize_t first_dblock = fblock_num_to_dblock_num(inode, 0);
+    free_memory(inode);
+    // moving between directories keeps the inode and its blocks
+    if (custom_rename("/ren_a", "/rendir/b", 0) != 0 || get_inode_num_from_path("/ren_a") != -1 ||
+        get_inode_num_from_path("/rendir/b") != inode_num)
+    {
+        printf("FAILED: Expected /ren_a to move to /rendir/b\n");
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    char *read_buff = (char *)malloc(nbytes);
+    if (fblock_num_to_dblock_num(inode, 0) != first_dblock || custom_read("/rendir/b", read_buff, nbytes, 0) != nbytes ||
+        memcmp(data, read_buff, nbytes) != 0)
+    {
+        printf("FAILED: Expected the data of /rendir/b to stay in place\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    free(read_buff);
+    free(data);
+    ssize_t c_inode_num = get_inode_num_from_path("/rendir/c");
+    if (custom_rename("/rendir/b", "/rendir/c", RENAME_NOREPLACE) != -EEXIST)
+    {
+        printf("FAILED: Expected RENAME_NOREPLACE to refuse an existing target\n");
+        exit(-1);
+    }
+    if (custom_rename("/rendir/b", "/rendir/c", RENAME_EXCHANGE) != 0 || get_inode_num_from_path("/rendir/b") != c_inode_num ||
+        get_inode_num_from_path("/rendir/c") != inode_num)
+    {
+        printf("FAILED: Expected RENAME_EXCHANGE to swap /rendir/b and /rendir/c\n");
+        exit(-1);
+    }
+    // replacing drops the link of the file that was there
+    if (custom_rename("/rendir/c", "/rendir/b", 0) != 0 || get_inode_num_from_path("/rendir/c") != -1 ||
+        get_inode_num_from_path("/rendir/b") != inode_num)
+    {
+        printf("FAILED: Expected /rendir/c to replace /rendir/b\n");
+        exit(-1);
+    }
+    inode = read_inode(c_inode_num);
+    if (inode->link_count != 0)
+    {
+        printf("FAILED: Expected the replaced inode to lose its link, Actual: %ld links\n", inode->link_count);
+        exit(-1);
+    }
+    free_memory(inode);
+    // directories move with their contents and ".." follows the new parent
+    if (!custom_mkdir("/ren_d", S_IRWXU) || !custom_mknod("/ren_d/inner", S_IFREG, 0))
+    {
+        printf("FAILED to create /ren_d/inner\n");
+        exit(-1);
+    }
+    ssize_t inner_inode_num = get_inode_num_from_path("/ren_d/inner");
+    if (custom_rename("/ren_d", "/rendir/moved", 0) != 0 || get_inode_num_from_path("/rendir/moved/inner") != inner_inode_num ||
+        get_inode_num_from_path("/ren_d/inner") != -1)
+    {
+        printf("FAILED: Expected /ren_d to move to /rendir/moved\n");
+        exit(-1);
+    }
+    inode = read_inode(get_inode_num_from_path("/rendir/moved"));
+    struct file_pos_in_dir parent_ref = find_file("..", inode);
+    if (parent_ref.start_pos == -1 || dir_entry_inum(parent_ref.dblock, parent_ref.start_pos) != get_inode_num_from_path("/rendir"))
+    {
+        printf("FAILED: Expected .. of /rendir/moved to be /rendir\n");
+        exit(-1);
+    }
+    free_memory(parent_ref.dblock);
+    free_memory(inode);
+    if (custom_rename("/rendir", "/rendir/moved/loop", 0) != -EINVAL)
+    {
+        printf("FAILED: Expected a directory not to move into itself\n");
+        exit(-1);
+    }
+    custom_unlink("/rendir/moved/inner");
+    custom_unlink("/rendir/moved");
+    custom_unlink("/rendir/b");
+    custom_unlink("/rendir");
+    printf("Rename: PASSED\n");
+}
+
+void link_test()
+{
+    printf("Testing hard links...\n");
+    if (!custom_mkdir("/lnk_dir", S_IRWXU) || !custom_mknod("/lnk_a", S_IFREG, 0))
+    {
+        printf("FAILED to create the files to link\n");
+        exit(-1);
+    }
+    char data[] = "shared by both names";
+    ssize_t nbytes = sizeof(data);
+    custom_write("/lnk_a", data, nbytes, 0);
+    ssize_t inode_num = get_inode_num_from_path("/lnk_a");
+    if (custom_link("/lnk_a", "/lnk_dir/b") != 0 || get_inode_num_from_path("/lnk_dir/b") != inode_num)
+    {
+        printf("FAILED: Expected /lnk_dir/b to share the inode of /lnk_a\n");
+        exit(-1);
+    }
+    struct iNode *inode = read_inode(inode_num);
+    if (inode->link_count != 2)
+    {
+        printf("FAILED: Expected 2 links, Actual: %ld\n", inode->link_count);
+        exit(-1);
+    }
+    free_memory(inode);
+    if (custom_link("/lnk_a", "/lnk_dir/b") != -EEXIST || custom_link("/lnk_dir", "/lnk_dir2") != -EPERM)
+    {
+        printf("FAILED: Expected links over an existing name or to a directory to fail\n");
+        exit(-1);
+    }
+    // the data outlives the first name
+    custom_unlink("/lnk_a");
+    char read_buff[sizeof(data)];
+    if (custom_read("/lnk_dir/b", read_buff, nbytes, 0) != nbytes || memcmp(data, read_buff, nbytes) != 0)
+    {
+        printf("FAILED: Expected /lnk_dir/b to keep the data after /lnk_a is unlinked\n");
+        exit(-1);
+    }
+    inode = read_inode(inode_num);
+    if (inode->link_count != 1)
+    {
+        printf("FAILED: Expected 1 link after unlink, Actual: %ld\n", inode->link_count);
+        exit(-1);
+    }
+    free_memory(inode);
+    custom_unlink("/lnk_dir/b");
+    custom_unlink("/lnk_dir");
+    printf("Hard links: PASSED\n");
+}
+
+void symlink_test()
+{
+    printf("Testing symbolic links...\n");
+    char short_target[] = "release-42";
+    char long_target[2 * INLINE_DATA_SIZE + 1];
+    memset(long_target, 'l', sizeof(long_target) - 1);
+    long_target[sizeof(long_target) - 1] = '\0';
+    if (custom_symlink(short_target, "/sym_short") != 0 || custom_symlink(long_target, "/sym_long") != 0)
+    {
+        printf("FAILED to create the symbolic links\n");
+        exit(-1);
+    }
+    if (custom_symlink(short_target, "/sym_short") != -EEXIST)
+    {
+        printf("FAILED: Expected a second link with the same name to fail\n");
+        exit(-1);
+    }
+    // the short target is resolved from the inode alone
+    struct iNode *inode = read_inode(get_inode_num_from_path("/sym_short"));
+    if (!S_ISLNK(inode->mode) || !inode->is_inline || inode->num_blocks != 0)
+    {
+        printf("FAILED: Expected /sym_short to keep its target inline\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    inode = read_inode(get_inode_num_from_path("/sym_long"));
+    if (inode->is_inline || inode->num_blocks != 1 || inode->file_size != (ssize_t)strlen(long_target))
+    {
+        printf("FAILED: Expected /sym_long to keep its target in a dblock\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    char buff[BLOCK_SIZE];
+    ssize_t nbytes = custom_readlink("/sym_short", buff, sizeof(buff));
+    if (nbytes != (ssize_t)strlen(short_target) || memcmp(buff, short_target, nbytes) != 0)
+    {
+        printf("FAILED: Wrong target for /sym_short\n");
+        exit(-1);
+    }
+    nbytes = custom_readlink("/sym_long", buff, sizeof(buff));
+    if (nbytes != (ssize_t)strlen(long_target) || memcmp(buff, long_target, nbytes) != 0)
+    {
+        printf("FAILED: Wrong target for /sym_long\n");
+        exit(-1);
+    }
+    if (custom_readlink("/sym_long", buff, 4) != 4 || custom_mknod("/sym_file", S_IFREG, 0) == false ||
+        custom_readlink("/sym_file", buff, sizeof(buff)) != -EINVAL)
+    {
+        printf("FAILED: Expected readlink to truncate and to refuse regular files\n");
+        exit(-1);
+    }
+    custom_unlink("/sym_short");
+    custom_unlink("/sym_long");
+    custom_unlink("/sym_file");
+    printf("Symbolic links: PASSED\n");
+}
+
+struct readdir_batch
+{
+    ssize_t seen;
+    ssize_t limit;
+    ssize_t next_offset;
+    bool *found;
+};
+
+bool collect_dir_entry(const char *name, ssize_t inode_num, unsigned char type, const struct iNode *inode,
+                       ssize_t next_offset, void *arg)
+{
+    struct readdir_batch *batch = arg;
+    if (batch->seen == batch->limit)
+    {
+        return false;
+    }
+    ssize_t file_num;
+    if (sscanf(name, "rd_%ld", &file_num) == 1)
+    {
+        if (batch->found[file_num])
+        {
+            printf("FAILED: %s returned twice across resumed walks\n", name);
+            exit(-1);
+        }
+        batch->found[file_num] = true;
+    }
+    batch->seen++;
+    batch->next_offset = next_offset;
+    return true;
+}
+
+void resumable_readdir_test()
+{
+    printf("Testing resumable readdir...\n");
+    ssize_t num_files = 300;
+    custom_mkdir("/rd_dir", S_IRWXU);
+    char path[64];
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/rd_dir/rd_%ld", file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    struct iNode *inode = read_inode(get_inode_num_from_path("/rd_dir"));
+    bool found[num_files];
+    memset(found, 0, sizeof(found));
+    // small batches, each walk picks up at the cookie the previous one stopped on
+    struct readdir_batch batch = {0, 7, 0, found};
+    ssize_t total = 0;
+    do
+    {
+        batch.seen = 0;
+        if (!walk_dir_entries(inode, batch.next_offset, false, collect_dir_entry, &batch))
+        {
+            printf("FAILED: walk_dir_entries could not read the directory\n");
+            exit(-1);
+        }
+        total += batch.seen;
+    } while (batch.seen == batch.limit);
+    free_memory(inode);
+    // "." and ".." besides the files
+    if (total != num_files + 2)
+    {
+        printf("FAILED: Expected %ld entries, Actual: %ld\n", num_files + 2, total);
+        exit(-1);
+    }
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        if (!found[file_num])
+        {
+            printf("FAILED: rd_%ld was skipped\n", file_num);
+            exit(-1);
+        }
+        sprintf(path, "/rd_dir/rd_%ld", file_num);
+        custom_unlink(path);
+    }
+    custom_unlink("/rd_dir");
+    printf("Resumable readdir: PASSED\n");
+}
+
+// unlinks the files a batch returned, and the first time also every third file not listed yet
+void unlink_listed_files(const char *dir, bool *found, bool *unlinked, ssize_t num_files, bool ahead)
+{
+    char path[64];
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        if (!unlinked[file_num] && (found[file_num] || (ahead && file_num % 3 == 0)))
+        {
+            sprintf(path, "%s/rd_%ld", dir, file_num);
+            if (custom_unlink(path) != 0)
+            {
+                printf("FAILED to unlink %s\n", path);
+                exit(-1);
+            }
+            unlinked[file_num] = true;
+        }
+    }
+}
+
+void readdir_during_unlink_test(ssize_t num_files)
+{
+    printf("Testing readdir while the listed files are unlinked, %ld files...\n", num_files);
+    char dir[32];
+    char path[64];
+    sprintf(dir, "/rd_unlink_%ld", num_files);
+    custom_mkdir(dir, S_IRWXU);
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "%s/rd_%ld", dir, file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    bool found[num_files];
+    bool unlinked[num_files];
+    memset(found, 0, sizeof(found));
+    memset(unlinked, 0, sizeof(unlinked));
+    // what rm -r does, every batch resumes at its cookie after the names before it were removed
+    struct readdir_batch batch = {0, 7, 0, found};
+    ssize_t batches = 0;
+    do
+    {
+        batch.seen = 0;
+        struct iNode *inode = read_inode(get_inode_num_from_path(dir));
+        if (!walk_dir_entries(inode, batch.next_offset, false, collect_dir_entry, &batch))
+        {
+            printf("FAILED: walk_dir_entries could not read the directory\n");
+            exit(-1);
+        }
+        free_memory(inode);
+        unlink_listed_files(dir, found, unlinked, num_files, batches == 0);
+        batches++;
+    } while (batch.seen == batch.limit);
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        // only a file unlinked before the walk reached it may be missing
+        if (!found[file_num] && !(unlinked[file_num] && file_num % 3 == 0))
+        {
+            printf("FAILED: rd_%ld was skipped after %ld batches\n", file_num, batches);
+            exit(-1);
+        }
+        if (!unlinked[file_num])
+        {
+            printf("FAILED: rd_%ld was never listed\n", file_num);
+            exit(-1);
+        }
+    }
+    if (custom_unlink(dir) != 0)
+    {
+        printf("FAILED: %s is not empty after the walk\n", dir);
+        exit(-1);
+    }
+    printf("Readdir while unlinking: PASSED\n");
+}
+
+void readdir_across_split_test(ssize_t num_files)
+{
+    printf("Testing readdir while the directory grows, %ld files...\n", num_files);
+    char dir[32];
+    char path[64];
+    sprintf(dir, "/rd_grow_%ld", num_files);
+    custom_mkdir(dir, S_IRWXU);
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "%s/rd_%ld", dir, file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    struct iNode *inode = read_inode(get_inode_num_from_path(dir));
+    ssize_t num_blocks = inode->num_blocks;
+    bool found[num_files];
+    memset(found, 0, sizeof(found));
+    // half of the names are listed before the directory grows
+    struct readdir_batch batch = {0, num_files / 2, 0, found};
+    if (!walk_dir_entries(inode, 0, false, collect_dir_entry, &batch))
+    {
+        printf("FAILED: walk_dir_entries could not read the directory\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    // the new names split the leaves, a small directory gets its index here
+    ssize_t added = 2000;
+    for (ssize_t file_num = 0; file_num < added; file_num++)
+    {
+        sprintf(path, "%s/new_%ld", dir, file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    inode = read_inode(get_inode_num_from_path(dir));
+    if (!inode->is_indexed || inode->num_blocks <= num_blocks)
+    {
+        printf("FAILED: Expected the directory to grow an index past %ld blocks, Actual: %ld blocks\n", num_blocks,
+               inode->num_blocks);
+        exit(-1);
+    }
+    // the walk resumes at the cookie, every old name has to come exactly once
+    batch.limit = num_files + added + 2;
+    if (!walk_dir_entries(inode, batch.next_offset, false, collect_dir_entry, &batch))
+    {
+        printf("FAILED: walk_dir_entries could not read the directory\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        if (!found[file_num])
+        {
+            printf("FAILED: rd_%ld was skipped when the walk resumed\n", file_num);
+            exit(-1);
+        }
+        sprintf(path, "%s/rd_%ld", dir, file_num);
+        custom_unlink(path);
+    }
+    for (ssize_t file_num = 0; file_num < added; file_num++)
+    {
+        sprintf(path, "%s/new_%ld", dir, file_num);
+        custom_unlink(path);
+    }
+    if (custom_unlink(dir) != 0)
+    {
+        printf("FAILED: %s is not empty after the walk\n", dir);
+        exit(-1);
+    }
+    printf("Readdir while the directory grows: PASSED\n");
+}
+
+struct type_check
+{
+    ssize_t entries;
+    ssize_t mismatches;
+};
+
+bool check_dir_entry_type(const char *name, ssize_t inode_num, unsigned char type, const struct iNode *inode,
+                          ssize_t next_offset, void *arg)
+{
+    struct type_check *check = arg;
+    if (type != DIR_ENTRY_TYPE(inode->mode))
+    {
+        check->mismatches++;
+    }
+    check->entries++;
+    return true;
+}
+
+void dir_entry_type_test()
+{
+    printf("Testing file types in directory entries...\n");
+    ssize_t num_files = 1000;
+    custom_mkdir("/ty_dir", S_IRWXU);
+    char path[64];
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        // enough entries to give the directory a hashed index, the types have to survive the move
+        switch (file_num % 3)
+        {
+        case 0:
+            sprintf(path, "/ty_dir/f_%ld", file_num);
+            custom_mknod(path, S_IFREG, 0);
+            break;
+        case 1:
+            sprintf(path, "/ty_dir/d_%ld", file_num);
+            custom_mkdir(path, S_IRWXU);
+            break;
+        default:
+            sprintf(path, "/ty_dir/l_%ld", file_num);
+            custom_symlink("f_0", path);
+        }
+    }
+    struct iNode *inode = read_inode(get_inode_num_from_path("/ty_dir"));
+    if (!inode->is_indexed)
+    {
+        printf("FAILED: Expected /ty_dir to be indexed\n");
+        exit(-1);
+    }
+    // the inodes come from the batched loader, each one is checked against the type in its entry
+    struct type_check check = {0, 0};
+    if (!walk_dir_entries(inode, 0, true, check_dir_entry_type, &check) || check.entries != num_files + 2 || check.mismatches != 0)
+    {
+        printf("FAILED: Expected %ld typed entries, Actual: %ld entries, %ld mismatches\n", num_files + 2, check.entries,
+               check.mismatches);
+        exit(-1);
+    }
+    free_memory(inode);
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/ty_dir/%c_%ld", "fdl"[file_num % 3], file_num);
+        custom_unlink(path);
+    }
+    custom_unlink("/ty_dir");
+    printf("Directory entry types: PASSED\n");
+}
+
+void dir_space_reuse_test()
+{
+    printf("Testing reuse of freed directory space...\n");
+    custom_mkdir("/sp_dir", S_IRWXU);
+    char path[64];
+    ssize_t num_files = 400;
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/sp_dir/s_%03ld", file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    struct iNode *inode = read_inode(get_inode_num_from_path("/sp_dir"));
+    ssize_t num_blocks = inode->num_blocks;
+    free_memory(inode);
+    // holes in the first block are filled before the directory grows
+    for (ssize_t file_num = 0; file_num < 100; file_num++)
+    {
+        sprintf(path, "/sp_dir/s_%03ld", file_num);
+        custom_unlink(path);
+    }
+    for (ssize_t file_num = 0; file_num < 100; file_num++)
+    {
+        sprintf(path, "/sp_dir/n_%03ld", file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    inode = read_inode(get_inode_num_from_path("/sp_dir"));
+    if (inode->num_blocks != num_blocks || inode->is_indexed)
+    {
+        printf("FAILED: Expected %ld linear blocks after reusing holes, Actual: %ld\n", num_blocks, inode->num_blocks);
+        exit(-1);
+    }
+    free_memory(inode);
+    // a mass delete leaves the entries spread out until the directory is compacted
+    for (ssize_t file_num = 100; file_num < num_files; file_num += 4)
+    {
+        for (ssize_t i = file_num; i < file_num + 3; i++)
+        {
+            sprintf(path, "/sp_dir/s_%03ld", i);
+            custom_unlink(path);
+        }
+    }
+    ssize_t freed = custom_compact_dir("/sp_dir");
+    inode = read_inode(get_inode_num_from_path("/sp_dir"));
+    if (freed <= 0 || inode->num_blocks != num_blocks - freed || inode->num_blocks != 1)
+    {
+        printf("FAILED: Expected compaction down to 1 block, Actual: %ld blocks, %ld freed\n", inode->num_blocks, freed);
+        exit(-1);
+    }
+    free_memory(inode);
+    for (ssize_t file_num = 0; file_num < 100; file_num++)
+    {
+        sprintf(path, "/sp_dir/n_%03ld", file_num);
+        if (get_inode_num_from_path(path) == -1)
+        {
+            printf("FAILED: %s was lost by the compaction\n", path);
+            exit(-1);
+        }
+        custom_unlink(path);
+    }
+    for (ssize_t file_num = 103; file_num < num_files; file_num += 4)
+    {
+        sprintf(path, "/sp_dir/s_%03ld", file_num);
+        if (get_inode_num_from_path(path) == -1)
+        {
+            printf("FAILED: %s was lost by the compaction\n", path);
+            exit(-1);
+        }
+        custom_unlink(path);
+    }
+    // emptied leaves of an indexed directory stay until it is compacted, a listing in progress keeps its place
+    num_files = 5000;
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/sp_dir/x_%ld", file_num);
+        custom_mknod(path, S_IFREG, 0);
+    }
+    for (ssize_t file_num = 10; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/sp_dir/x_%ld", file_num);
+        custom_unlink(path);
+    }
+    inode = read_inode(get_inode_num_from_path("/sp_dir"));
+    num_blocks = inode->num_blocks;
+    free_memory(inode);
+    freed = custom_compact_dir("/sp_dir");
+    inode = read_inode(get_inode_num_from_path("/sp_dir"));
+    if (freed != num_blocks - 1 || inode->is_indexed || inode->num_blocks != 1)
+    {
+        printf("FAILED: Expected the emptied index to shrink to 1 linear block, Actual: %ld blocks, %ld freed\n",
+               inode->num_blocks, freed);
+        exit(-1);
+    }
+    free_memory(inode);
+    for (ssize_t file_num = 0; file_num < 10; file_num++)
+    {
+        sprintf(path, "/sp_dir/x_%ld", file_num);
+        if (get_inode_num_from_path(path) == -1)
+        {
+            printf("FAILED: %s was lost while the index shrank\n", path);
+            exit(-1);
+        }
+        custom_unlink(path);
+    }
+    custom_unlink("/sp_dir");
+    printf("Directory space reuse: PASSED\n");
+}
+
+void compact_dirent_test()
+{
+    printf("Testing the compact directory entry format...\n");
+    custom_mkdir("/cd_dir", S_IRWXU);
+    // ".", ".." and one short name fit in the inode
+    custom_mknod("/cd_dir/a", S_IFREG, 0);
+    struct iNode *inode = read_inode(get_inode_num_from_path("/cd_dir"));
+    if (!inode->is_inline)
+    {
+        printf("FAILED: Expected a directory with one short name to stay inline\n");
+        exit(-1);
+    }
+    free_memory(inode);
+    custom_unlink("/cd_dir/a");
+    char path[64];
+    ssize_t num_files = 0;
+    do
+    {
+        sprintf(path, "/cd_dir/e_%06ld", num_files++);
+        custom_mknod(path, S_IFREG, 0);
+        inode = read_inode(get_inode_num_from_path("/cd_dir"));
+        ssize_t num_blocks = inode->is_inline ? 0 : inode->num_blocks;
+        free_memory(inode);
+        if (num_blocks > 1)
+        {
+            break;
+        }
+    } while (num_files < BLOCK_SIZE);
+    // the entry that started the second block did not fit the first one
+    ssize_t per_block = num_files - 1;
+    ssize_t expected = (BLOCK_SIZE - (ssize_t)(2 * sizeof(struct dir_entry) + 3)) / (ssize_t)(sizeof(struct dir_entry) + 8);
+    if (per_block != expected)
+    {
+        printf("FAILED: Expected %ld entries of 8 characters in a block, Actual: %ld\n", expected, per_block);
+        exit(-1);
+    }
+    for (ssize_t file_num = 0; file_num < num_files; file_num++)
+    {
+        sprintf(path, "/cd_dir/e_%06ld", file_num);
+        if (get_inode_num_from_path(path) == -1)
+        {
+            printf("FAILED: %s not found\n", path);
+            exit(-1);
+        }
+        custom_unlink(path);
+    }
+    custom_unlink("/cd_dir");
+    printf("Compact directory entries: PASSED\n");
+}
+
+void path_cache_invalidation_test()
+{
+    printf("Testing subtree invalidation of the dentry cache...\n");
+    if (!custom_mkdir("/pcache", S_IRWXU) || !custom_mkdir("/pcache/a", S_IRWXU) || !custom_mkdir("/pcache/a/b", S_IRWXU) ||
+        !custom_mknod("/pcache/a/b/leaf", S_IFREG, 0))
+    {
+        printf("FAILED to create /pcache/a/b/leaf\n");
+        exit(-1);
+    }
+    ssize_t leaf_inode_num = get_inode_num_from_path("/pcache/a/b/leaf");
+    if (leaf_inode_num == -1 || get_inode_num_from_path("/pcache/a/b/missing") != -1 ||
+        lookup_dentry("/pcache/a/b/missing") != NEGATIVE_DENTRY)
+    {
+        printf("FAILED: Expected /pcache/a/b/leaf and a negative /pcache/a/b/missing in the cache\n");
+        exit(-1);
+    }
+    // moving a directory drops everything cached under its old path in one go
+    if (custom_rename("/pcache/a", "/pcache/moved", 0) != 0 || lookup_dentry("/pcache/a") != -1 ||
+        lookup_dentry("/pcache/a/b") != -1 || lookup_dentry("/pcache/a/b/leaf") != -1 ||
+        lookup_dentry("/pcache/a/b/missing") != -1)
+    {
+        printf("FAILED: Expected the subtree of /pcache/a to be dropped by the rename\n");
+        exit(-1);
+    }
+    if (get_inode_num_from_path("/pcache/a/b/leaf") != -1 || get_inode_num_from_path("/pcache/moved/b/leaf") != leaf_inode_num)
+    {
+        printf("FAILED: Expected /pcache/a/b/leaf to be found as /pcache/moved/b/leaf only\n");
+        exit(-1);
+    }
+    // paths with ".." resolve but are never cached, their entries could not be dropped by the real path
+    if (get_inode_num_from_path("/pcache/moved/b/../b/leaf") != leaf_inode_num || lookup_dentry("/pcache/moved/b/..") != -1)
+    {
+        printf("FAILED: Expected /pcache/moved/b/../b/leaf to resolve without being cached\n");
+        exit(-1);
+    }
+    if (custom_unlink("/pcache/moved/b/leaf") != 0 || custom_unlink("/pcache/moved/b") != 0 ||
+        lookup_dentry("/pcache/moved/b") != -1 || get_inode_num_from_path("/pcache/moved/b/leaf") != -1)
+    {
+        printf("FAILED: Expected the removed /pcache/moved/b to be gone from the cache\n");
+        exit(-1);
+    }
+    custom_unlink("/pcache/moved");
+    custom_unlink("/pcache");
+    printf("Dentry cache subtree invalidation: PASSED\n");
+}
+
 int main()
 {
     // Initialize file system
@@ -584,6 +2251,55 @@ int main()
     // Test to unlink empty dir
     printf("------------------------------------------------------------------------\n");
     unlink_empty_dir_test();
+    printf("------------------------------------------------------------------------\n");
+    orphan_reclaim_test();
+    printf("------------------------------------------------------------------------\n");
+    fallocate_test();
+    printf("------------------------------------------------------------------------\n");
+    block_placement_test();
+    printf("------------------------------------------------------------------------\n");
+    statfs_test();
+    printf("------------------------------------------------------------------------\n");
+    inline_data_test();
+    printf("------------------------------------------------------------------------\n");
+    sparse_file_test();
+    printf("------------------------------------------------------------------------\n");
+    seek_data_hole_test();
+    printf("------------------------------------------------------------------------\n");
+    defrag_test();
+    printf("------------------------------------------------------------------------\n");
+    defrag_during_write_test();
+    printf("------------------------------------------------------------------------\n");
+    dir_index_test();
+    printf("------------------------------------------------------------------------\n");
+    dentry_cache_test();
+    printf("------------------------------------------------------------------------\n");
+    negative_dentry_test();
+    printf("------------------------------------------------------------------------\n");
+    negative_dentry_race_test();
+    printf("------------------------------------------------------------------------\n");
+    rename_test();
+    printf("------------------------------------------------------------------------\n");
+    link_test();
+    printf("------------------------------------------------------------------------\n");
+    symlink_test();
+    printf("------------------------------------------------------------------------\n");
+    resumable_readdir_test();
+    printf("------------------------------------------------------------------------\n");
+    // a few linear blocks, and enough names for a hashed index
+    readdir_during_unlink_test(300);
+    readdir_during_unlink_test(3000);
+    printf("------------------------------------------------------------------------\n");
+    readdir_across_split_test(100);
+    readdir_across_split_test(2000);
+    printf("------------------------------------------------------------------------\n");
+    dir_entry_type_test();
+    printf("------------------------------------------------------------------------\n");
+    dir_space_reuse_test();
+    printf("------------------------------------------------------------------------\n");
+    compact_dirent_test();
+    printf("------------------------------------------------------------------------\n");
+    path_cache_invalidation_test();
     printf("All tests passed.\n");
     return 0;
 }
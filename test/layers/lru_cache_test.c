@@ -44,6 +44,69 @@ int main() {
     set_cache(&cache, NULL, 6); // Should not change cache
     assert(get_cache(&cache, NULL)==-1); // Output: -1
     printf("LRU Cache corner case Successful\n");
+    // Many more keys than buckets, every bucket chains several of them
+    static struct lru_cache big_cache;
+    create_cache(&big_cache, 50);
+    char key[16];
+    for (ssize_t i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "%ld/name", i);
+        set_cache(&big_cache, key, i);
+    }
+    assert(big_cache.size==50);
+    for (ssize_t i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "%ld/name", i);
+        assert(get_cache(&big_cache, key)==(i < 150 ? -1 : i));
+    }
+    // Popping one key leaves the rest of its bucket reachable
+    assert(pop_cache(&big_cache, "170/name"));
+    assert(!pop_cache(&big_cache, "170/name"));
+    for (ssize_t i = 150; i < 200; i++) {
+        snprintf(key, sizeof(key), "%ld/name", i);
+        assert(get_cache(&big_cache, key)==(i == 170 ? -1 : i));
+    }
+    assert(big_cache.size==49);
+    printf("LRU Cache bucket chaining Successful\n");
+    // Path cache, a path is only cached once its parent is
+    static struct path_cache paths;
+    create_path_cache(&paths, 5);
+    assert(set_path_cache(&paths, "/a", 2, 1));
+    assert(set_path_cache(&paths, "/a/b", 4, 2));
+    assert(set_path_cache(&paths, "//a//b/c/", 9, 3));
+    assert(!set_path_cache(&paths, "/x/y", 4, 4));
+    assert(set_path_cache(&paths, "/a/d", 4, 5));
+    assert(paths.size==4);
+    ssize_t matched;
+    assert(get_path_cache(&paths, "/a/b/c", &matched)==3 && matched==6);
+    // the longest cached prefix answers for the rest of the path
+    assert(get_path_cache(&paths, "/a/b/zz/c", &matched)==2 && matched==4);
+    assert(get_path_cache(&paths, "/q", &matched)==-1 && matched==0);
+    printf("Path Cache prefix lookup Successful\n");
+    // Dropping a directory drops its whole subtree and leaves its siblings
+    assert(pop_path_cache(&paths, "/a/b")==2);
+    assert(get_path_cache(&paths, "/a/b/c", &matched)==1 && matched==2);
+    assert(get_path_cache(&paths, "/a/d", NULL)==5);
+    assert(paths.size==2);
+    // A new value for a path drops what was cached under the old one
+    assert(set_path_cache(&paths, "/a/b", 4, 6));
+    assert(set_path_cache(&paths, "/a/b/c", 6, 7));
+    assert(set_path_cache(&paths, "/a/b", 4, 8));
+    assert(get_path_cache(&paths, "/a/b/c", &matched)==8 && matched==4);
+    printf("Path Cache subtree invalidation Successful\n");
+    // Eviction takes the least recently used leaf, never a parent of a cached path
+    assert(set_path_cache(&paths, "/a/b/c", 6, 9));
+    assert(set_path_cache(&paths, "/e", 2, 10));
+    assert(paths.size==5);
+    assert(get_path_cache(&paths, "/a/b/c", NULL)==9);
+    assert(set_path_cache(&paths, "/f", 2, 11));
+    assert(paths.size==5);
+    assert(get_path_cache(&paths, "/a/d", &matched)==1 && matched==2);
+    assert(get_path_cache(&paths, "/a/b/c", NULL)==9);
+    assert(get_path_cache(&paths, "/e", NULL)==10 && get_path_cache(&paths, "/f", NULL)==11);
+    // An empty path empties the cache
+    assert(pop_path_cache(&paths, "/")==5);
+    assert(paths.size==0 && paths.head==NULL && paths.tail==NULL);
+    free_path_cache(&paths);
+    printf("Path Cache eviction Successful\n");
     printf("All test cases for LRU Cache Passed!!\n");
     return 0;
 }
\ No newline at end of file